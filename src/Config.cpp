@@ -1,5 +1,13 @@
 #include "Config.hpp"
 #include "helper/DspHelper.hpp"
+#include "StepScheduler.hpp"
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <cstring>
+#include <cstdio>
 
 void mck::sampler::to_json(nlohmann::json &j, const mck::sampler::Sample &s)
 {
@@ -27,22 +35,78 @@ void mck::sampler::to_json(nlohmann::json &j, const Step &s)
 {
     j["active"] = s.active;
     j["velocity"] = s.velocity;
+    j["offset"] = s.offset;
 }
 void mck::sampler::from_json(const nlohmann::json &j, Step &s)
 {
     s.active = j.at("active").get<bool>();
     s.velocity = std::min((unsigned)127, j.at("velocity").get<unsigned>());
+    if (j.contains("offset"))
+    {
+        s.offset = std::min(SAMPLER_MAX_STEP_OFFSET, std::max(-SAMPLER_MAX_STEP_OFFSET, j.at("offset").get<double>()));
+    }
+}
+
+bool mck::sampler::operator==(const Step &a, const Step &b)
+{
+    return a.active == b.active && a.velocity == b.velocity && a.offset == b.offset;
 }
 
 void mck::sampler::to_json(nlohmann::json &j, const mck::sampler::Pattern &p)
 {
     j["nSteps"] = p.nSteps;
+    j["resolution"] = p.resolution;
     j["steps"] = p.steps;
 }
 void mck::sampler::from_json(const nlohmann::json &j, mck::sampler::Pattern &p)
 {
-    p.nSteps = j.at("nSteps").get<unsigned>();
+    p.nSteps = std::max(1u, std::min(SAMPLER_MAX_STEPS, j.at("nSteps").get<unsigned>()));
+    p.resolution = CheckResolution(j.contains("resolution") ? j.at("resolution").get<unsigned>() : 4);
     p.steps = j.at("steps").get<std::vector<Step>>();
+    // A new length keeps the steps it shares with the old one
+    p.steps.resize(p.nSteps);
+}
+
+bool mck::sampler::operator==(const Pattern &a, const Pattern &b)
+{
+    return a.nSteps == b.nSteps && a.resolution == b.resolution && a.steps == b.steps;
+}
+
+unsigned mck::sampler::CheckResolution(unsigned resolution)
+{
+    if (resolution == 0 || resolution > SAMPLER_MAX_RESOLUTION || SAMPLER_TICKS_PER_BEAT % resolution != 0)
+    {
+        return 4;
+    }
+    return resolution;
+}
+
+void mck::sampler::to_json(nlohmann::json &j, const Groove &g)
+{
+    j["type"] = g.type;
+    j["swing"] = g.swing;
+    j["timing"] = g.timing;
+    j["velocity"] = g.velocity;
+}
+void mck::sampler::from_json(const nlohmann::json &j, Groove &g)
+{
+    g.type = std::min((char)(GRV_LENGTH - 1), std::max((char)GRV_STRAIGHT, j.at("type").get<char>()));
+    g.swing = std::min(75.0, std::max(50.0, j.at("swing").get<double>()));
+    g.timing = j.at("timing").get<std::vector<double>>();
+    g.velocity = j.at("velocity").get<std::vector<double>>();
+    g.timing.resize(SAMPLER_GROOVE_SLOTS, 0.0);
+    g.velocity.resize(SAMPLER_GROOVE_SLOTS, 1.0);
+    for (unsigned i = 0; i < SAMPLER_GROOVE_SLOTS; i++)
+    {
+        // Slots never pass each other
+        g.timing[i] = std::min(0.45, std::max(-0.45, g.timing[i]));
+        g.velocity[i] = std::min(1.0, std::max(0.0, g.velocity[i]));
+    }
+}
+
+bool mck::sampler::operator==(const Groove &a, const Groove &b)
+{
+    return a.type == b.type && a.swing == b.swing && a.timing == b.timing && a.velocity == b.velocity;
 }
 
 void mck::sampler::to_json(nlohmann::json &j, const Delay &d)
@@ -62,6 +126,10 @@ void mck::sampler::from_json(const nlohmann::json &j, Delay &d)
     d.feedback = std::min(1.0, std::max(0.0, j.at("feedback").get<double>()));
 }
 
+bool mck::sampler::operator==(const Delay &a, const Delay &b)
+{
+    return a.active == b.active && a.type == b.type && a.timeMs == b.timeMs && a.gain == b.gain && a.feedback == b.feedback;
+}
 
 void mck::sampler::to_json(nlohmann::json &j, const Compressor &c)
 {
@@ -83,12 +151,18 @@ void mck::sampler::from_json(const nlohmann::json &j, Compressor &c)
     c.makeup = std::max(0.0, std::min(20.0, j.at("makeup").get<double>()));
 }
 
+bool mck::sampler::operator==(const Compressor &a, const Compressor &b)
+{
+    return a.active == b.active && a.attackMs == b.attackMs && a.releaseMs == b.releaseMs && a.threshold == b.threshold && a.ratio == b.ratio && a.makeup == b.makeup;
+}
+
 void mck::sampler::to_json(nlohmann::json &j, const mck::sampler::Pad &p)
 {
     j["available"] = p.available;
     j["reverse"] = p.reverse;
     j["lengthMs"] = p.lengthMs;
     j["maxLengthMs"] = p.maxLengthMs;
+    j["startMs"] = p.startMs;
     j["tone"] = p.tone;
     j["ctrl"] = p.ctrl;
     j["samplePath"] = p.samplePath;
@@ -107,6 +181,7 @@ void mck::sampler::from_json(const nlohmann::json &j, mck::sampler::Pad &p)
     p.available = j.at("available").get<bool>();
     p.reverse = j.at("reverse").get<bool>();
     p.lengthMs = j.at("lengthMs").get<unsigned>();
+    p.startMs = j.contains("startMs") ? j.at("startMs").get<double>() : 0.0;
     p.tone = j.at("tone").get<unsigned>();
     p.ctrl = j.at("ctrl").get<unsigned>();
     p.samplePath = j.at("samplePath").get<std::string>();
@@ -132,8 +207,9 @@ void mck::sampler::from_json(const nlohmann::json &j, mck::sampler::Pad &p)
     }
     try
     {
-        p.nPatterns = j.at("nPatterns").get<unsigned>();
+        p.nPatterns = std::max(1u, std::min(SAMPLER_MAX_PATTERNS, j.at("nPatterns").get<unsigned>()));
         p.patterns = j.at("patterns").get<std::vector<Pattern>>();
+        p.patterns.resize(p.nPatterns);
     }
     catch (std::exception &e)
     {
@@ -142,6 +218,26 @@ void mck::sampler::from_json(const nlohmann::json &j, mck::sampler::Pad &p)
     }
 }
 
+bool mck::sampler::operator==(const Pad &a, const Pad &b)
+{
+    return a.available == b.available &&
+           a.reverse == b.reverse &&
+           a.lengthMs == b.lengthMs &&
+           a.maxLengthMs == b.maxLengthMs &&
+           a.startMs == b.startMs &&
+           a.tone == b.tone &&
+           a.ctrl == b.ctrl &&
+           a.samplePath == b.samplePath &&
+           a.sampleName == b.sampleName &&
+           a.gain == b.gain &&
+           a.pan == b.pan &&
+           a.pitch == b.pitch &&
+           a.delay == b.delay &&
+           a.comp == b.comp &&
+           a.nPatterns == b.nPatterns &&
+           a.patterns == b.patterns;
+}
+
 void mck::sampler::to_json(nlohmann::json &j, const mck::sampler::Config &c)
 {
     j["tempo"] = c.tempo;
@@ -154,6 +250,9 @@ void mck::sampler::to_json(nlohmann::json &j, const mck::sampler::Config &c)
     j["midiOutConnections"] = c.midiOutConnections;
     j["audioLeftConnections"] = c.audioLeftConnections;
     j["audioRightConnections"] = c.audioRightConnections;
+    j["compactSamples"] = c.compactSamples;
+    j["groove"] = c.groove;
+    j["saveDelayMs"] = c.saveDelayMs;
 }
 
 void mck::sampler::from_json(const nlohmann::json &j, mck::sampler::Config &c)
@@ -168,34 +267,233 @@ void mck::sampler::from_json(const nlohmann::json &j, mck::sampler::Config &c)
     c.midiOutConnections = j.at("midiOutConnections").get<std::vector<std::string>>();
     c.audioLeftConnections = j.at("audioLeftConnections").get<std::vector<std::string>>();
     c.audioRightConnections = j.at("audioRightConnections").get<std::vector<std::string>>();
+    if (j.contains("compactSamples"))
+    {
+        c.compactSamples = j.at("compactSamples").get<bool>();
+    }
+    if (j.contains("groove"))
+    {
+        c.groove = j.at("groove").get<Groove>();
+    }
+    if (j.contains("saveDelayMs"))
+    {
+        c.saveDelayMs = std::min(SAMPLER_MAX_SAVE_DELAY_MS, j.at("saveDelayMs").get<unsigned>());
+    }
+}
+
+void mck::sampler::DiffConfig(const Config &oldConfig, const Config &newConfig, nlohmann::json &patch)
+{
+    auto replace = [&patch](std::string path, nlohmann::json value) {
+        patch.push_back({{"op", "replace"}, {"path", path}, {"value", value}});
+    };
+
+    if (oldConfig.tempo != newConfig.tempo)
+    {
+        replace("/tempo", newConfig.tempo);
+    }
+    if (oldConfig.numPads != newConfig.numPads)
+    {
+        replace("/numPads", newConfig.numPads);
+    }
+    if (oldConfig.numSamples != newConfig.numSamples)
+    {
+        replace("/numSamples", newConfig.numSamples);
+    }
+    if (oldConfig.midiChan != newConfig.midiChan)
+    {
+        replace("/midiChan", newConfig.midiChan);
+    }
+    if (oldConfig.reconnect != newConfig.reconnect)
+    {
+        replace("/reconnect", newConfig.reconnect);
+    }
+    if (oldConfig.midiInConnections != newConfig.midiInConnections)
+    {
+        replace("/midiInConnections", newConfig.midiInConnections);
+    }
+    if (oldConfig.midiOutConnections != newConfig.midiOutConnections)
+    {
+        replace("/midiOutConnections", newConfig.midiOutConnections);
+    }
+    if (oldConfig.audioLeftConnections != newConfig.audioLeftConnections)
+    {
+        replace("/audioLeftConnections", newConfig.audioLeftConnections);
+    }
+    if (oldConfig.audioRightConnections != newConfig.audioRightConnections)
+    {
+        replace("/audioRightConnections", newConfig.audioRightConnections);
+    }
+    if (oldConfig.compactSamples != newConfig.compactSamples)
+    {
+        replace("/compactSamples", newConfig.compactSamples);
+    }
+    if ((oldConfig.groove == newConfig.groove) == false)
+    {
+        replace("/groove", newConfig.groove);
+    }
+    if (oldConfig.saveDelayMs != newConfig.saveDelayMs)
+    {
+        replace("/saveDelayMs", newConfig.saveDelayMs);
+    }
+
+    if (oldConfig.pads.size() != newConfig.pads.size())
+    {
+        replace("/pads", newConfig.pads);
+        return;
+    }
+    for (unsigned i = 0; i < newConfig.pads.size(); i++)
+    {
+        if (oldConfig.pads[i] == newConfig.pads[i])
+        {
+            continue;
+        }
+        std::string prefix = "/pads/" + std::to_string(i);
+        nlohmann::json padPatch = nlohmann::json::diff(oldConfig.pads[i], newConfig.pads[i]);
+        for (auto &op : padPatch)
+        {
+            op["path"] = prefix + op["path"].get<std::string>();
+            patch.push_back(op);
+        }
+    }
 }
 
-bool mck::sampler::ScanSampleFolder(std::string path, std::vector<Sample> &sampleList)
+bool mck::sampler::ScanSampleFolder(std::string path, std::vector<Sample> &sampleList, std::string cachePath,
+                                    std::function<void(const Sample &)> callback, unsigned numThreads)
 {
     sampleList.clear();
-    Sample tmp;
-    fs::path tmpPath;
-    SNDFILE *tmpSnd;
-    SF_INFO tmpInfo;
 
-    for (auto &p : std::filesystem::recursive_directory_iterator(path))
+    struct Probe
+    {
+        Sample sample;
+        uint64_t fileSize;
+        int64_t mtime;
+        bool valid;
+    };
+
+    // Cached headers by full path
+    std::map<std::string, Probe> cache;
+    if (cachePath != "")
     {
-        if (p.path().extension() == ".wav")
+        std::ifstream cacheFile(cachePath);
+        try
         {
-            tmpPath = fs::relative(p.path(), fs::path(path));
-            tmp.relativePath = tmpPath.string();
-            tmp.name = tmpPath.stem().string();
-            tmp.fullPath = p.path().string();
+            nlohmann::json j;
+            cacheFile >> j;
+            for (auto &e : j.at("files"))
+            {
+                Probe probe;
+                probe.sample = e.at("sample").get<Sample>();
+                probe.fileSize = e.at("fileSize").get<uint64_t>();
+                probe.mtime = e.at("mtime").get<int64_t>();
+                probe.valid = true;
+                cache[probe.sample.fullPath] = probe;
+            }
+        }
+        catch (std::exception &e)
+        {
+            cache.clear();
+        }
+    }
 
-            tmpSnd = sf_open(tmp.fullPath.c_str(), SFM_READ, &tmpInfo);
+    // Only the directory walk is serial, it does not open any file
+    std::vector<Probe> probes;
+    std::error_code ec;
+    for (auto &p : fs::recursive_directory_iterator(path, ec))
+    {
+        if (p.path().extension() != ".wav")
+        {
+            continue;
+        }
+        Probe probe;
+        fs::path relPath = p.path().lexically_relative(path);
+        probe.sample.relativePath = relPath.string();
+        probe.sample.name = relPath.stem().string();
+        probe.sample.fullPath = p.path().string();
+        probe.fileSize = p.file_size(ec);
+        probe.mtime = p.last_write_time(ec).time_since_epoch().count();
+        probe.valid = false;
 
-            tmp.numChannels = tmpInfo.channels;
-            tmp.numFrames = tmpInfo.frames;
-            tmp.sampleRate = tmpInfo.samplerate;
+        auto it = cache.find(probe.sample.fullPath);
+        if (it != cache.end() && it->second.fileSize == probe.fileSize && it->second.mtime == probe.mtime)
+        {
+            probe.sample = it->second.sample;
+            probe.valid = true;
+            if (callback)
+            {
+                callback(probe.sample);
+            }
+        }
+        probes.push_back(probe);
+    }
 
-            sf_close(tmpSnd);
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::atomic<size_t> next(0);
+    std::mutex callbackMutex;
+    auto worker = [&]() {
+        SF_INFO info;
+        for (size_t i = next++; i < probes.size(); i = next++)
+        {
+            Probe &probe = probes[i];
+            if (probe.valid)
+            {
+                continue;
+            }
+            std::memset(&info, 0, sizeof(SF_INFO));
+            SNDFILE *snd = sf_open(probe.sample.fullPath.c_str(), SFM_READ, &info);
+            if (snd == nullptr)
+            {
+                std::fprintf(stderr, "Failed to read the header of %s: %s\n", probe.sample.fullPath.c_str(), sf_strerror(nullptr));
+                continue;
+            }
+            sf_close(snd);
 
-            sampleList.push_back(tmp);
+            probe.sample.available = true;
+            probe.sample.numChannels = info.channels;
+            probe.sample.numFrames = info.frames;
+            probe.sample.sampleRate = info.samplerate;
+            probe.valid = true;
+            if (callback)
+            {
+                std::lock_guard<std::mutex> lock(callbackMutex);
+                callback(probe.sample);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < numThreads; i++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    nlohmann::json j;
+    j["files"] = nlohmann::json::array();
+    for (auto &probe : probes)
+    {
+        if (probe.valid == false)
+        {
+            continue;
+        }
+        sampleList.push_back(probe.sample);
+        j["files"].push_back({{"sample", probe.sample}, {"fileSize", probe.fileSize}, {"mtime", probe.mtime}});
+    }
+    if (cachePath != "")
+    {
+        std::string tmpPath = cachePath + ".tmp";
+        std::ofstream cacheFile(tmpPath);
+        cacheFile << j.dump() << std::endl;
+        cacheFile.close();
+        if (cacheFile.fail() || std::rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+        {
+            std::remove(tmpPath.c_str());
+            std::fprintf(stderr, "Failed to write sample header cache %s\n", cachePath.c_str());
         }
     }
 
@@ -218,6 +516,8 @@ bool mck::sampler::VerifyConfiguration(Config &config, std::string samplePackPat
         config.pads[i].gainLeftLin = gainLin * std::sqrt((double)(100 - config.pads[i].pan) / 200.0);
         config.pads[i].gainRightLin = gainLin * std::sqrt((double)(100 + config.pads[i].pan) / 200.0);
         config.pads[i].lengthSamps = (unsigned)std::floor((double)config.pads[i].lengthMs * (double)sampleRate / 1000.0);
+        config.pads[i].startMs = std::max(0.0, config.pads[i].startMs);
+        config.pads[i].startSamps = (unsigned)std::floor(config.pads[i].startMs * (double)sampleRate / 1000.0);
 
         fs::path samplePath(samplePackPath);
         samplePath.append(config.pads[i].samplePath);
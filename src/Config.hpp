@@ -5,6 +5,7 @@
 #include <nlohmann/json.hpp>
 #include <sndfile.h>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 
 #include "Types.hpp"
@@ -14,6 +15,14 @@ namespace mck
     namespace sampler
     {
         namespace fs = std::filesystem;
+        const unsigned SAMPLER_MAX_STEPS = 64;
+        const unsigned SAMPLER_MAX_PATTERNS = 16;   // Chained per pad
+        const unsigned SAMPLER_MAX_RESOLUTION = 32; // Steps per beat
+        const unsigned SAMPLER_GROOVE_SLOTS = 16;   // 16th notes of a bar
+        const double SAMPLER_MAX_STEP_OFFSET = 0.5; // Fraction of a step
+        const unsigned SAMPLER_SAVE_DELAY_MS = 1000;
+        const unsigned SAMPLER_MAX_SAVE_DELAY_MS = 60000;
+
         struct Sample
         {
             bool available;
@@ -32,27 +41,62 @@ namespace mck
         {
             bool active;
             unsigned velocity;
-            Step() : active(false), velocity(100) {}
+            double offset; // Micro timing in steps, negative is early
+            Step() : active(false), velocity(100), offset(0.0) {}
         };
         void to_json(nlohmann::json &j, const Step &s);
         void from_json(const nlohmann::json &j, Step &s);
+        bool operator==(const Step &a, const Step &b);
 
         struct Pattern
         {
             unsigned nSteps;
+            unsigned resolution; // Steps per beat, 3 and 6 are triplets
             std::vector<Step> steps;
-            Pattern() : nSteps(16)
+            Pattern() : nSteps(16), resolution(4)
             {
                 steps.resize(nSteps);
             }
             Pattern(unsigned stepCount)
-                : nSteps(stepCount)
+                : nSteps(stepCount),
+                  resolution(4)
             {
                 steps.resize(nSteps);
             }
         };
         void to_json(nlohmann::json &j, const Pattern &p);
         void from_json(const nlohmann::json &j, Pattern &p);
+        bool operator==(const Pattern &a, const Pattern &b);
+        // Resolutions off the tick grid of the sequencer fall back to 16th notes
+        unsigned CheckResolution(unsigned resolution);
+
+        enum GrooveType
+        {
+            GRV_STRAIGHT = 0,
+            GRV_SWING_8,
+            GRV_SWING_16,
+            GRV_USER,
+            GRV_LENGTH
+        };
+
+        // Shifts the steps of all pads by their position in the bar
+        struct Groove
+        {
+            char type;
+            double swing;                 // MPC style, the second note of a pair starts at 50 - 75 % of it
+            std::vector<double> timing;   // GRV_USER, shift of each 16th of the bar in 16ths
+            std::vector<double> velocity; // GRV_USER, factor of each 16th
+            Groove()
+                : type(GRV_STRAIGHT),
+                  swing(50.0),
+                  timing(SAMPLER_GROOVE_SLOTS, 0.0),
+                  velocity(SAMPLER_GROOVE_SLOTS, 1.0)
+            {
+            }
+        };
+        void to_json(nlohmann::json &j, const Groove &g);
+        void from_json(const nlohmann::json &j, Groove &g);
+        bool operator==(const Groove &a, const Groove &b);
 
         enum DelayType
         {
@@ -83,6 +127,7 @@ namespace mck
         };
         void to_json(nlohmann::json &j, const Delay &d);
         void from_json(const nlohmann::json &j, Delay &d);
+        bool operator==(const Delay &a, const Delay &b);
 
         struct Compressor
         {
@@ -106,6 +151,7 @@ namespace mck
         };
         void to_json(nlohmann::json &j, const Compressor &c);
         void from_json(const nlohmann::json &j, Compressor &c);
+        bool operator==(const Compressor &a, const Compressor &b);
 
         struct Pad
         {
@@ -114,6 +160,8 @@ namespace mck
             unsigned lengthMs;
             unsigned lengthSamps;
             unsigned maxLengthMs;
+            double startMs; // Skipped leading silence, forward playback only
+            unsigned startSamps;
             unsigned tone;
             unsigned ctrl;
             std::string samplePath;
@@ -133,6 +181,8 @@ namespace mck
                   lengthMs(60000),
                   lengthSamps(0),
                   maxLengthMs(60000),
+                  startMs(0.0),
+                  startSamps(0),
                   tone(255),
                   ctrl(255),
                   samplePath(""),
@@ -150,6 +200,7 @@ namespace mck
         };
         void to_json(nlohmann::json &j, const Pad &p);
         void from_json(const nlohmann::json &j, Pad &p);
+        bool operator==(const Pad &a, const Pad &b);
 
         struct Config
         {
@@ -163,15 +214,23 @@ namespace mck
             std::vector<std::string> midiOutConnections;
             std::vector<std::string> audioLeftConnections;
             std::vector<std::string> audioRightConnections;
-            Config() : tempo(110.0), numPads(0), midiChan(0), numSamples(0), reconnect(true)
+            bool compactSamples; // 16 bit sample storage
+            Groove groove;
+            unsigned saveDelayMs; // Changes are written once the config was left alone this long
+            Config() : tempo(110.0), numPads(0), midiChan(0), numSamples(0), reconnect(true), compactSamples(false), groove(), saveDelayMs(SAMPLER_SAVE_DELAY_MS)
             {
                 pads.resize(numPads);
             };
         };
         void to_json(nlohmann::json &j, const Config &c);
         void from_json(const nlohmann::json &j, Config &c);
+        // Appends the JSON Patch operations turning oldConfig into newConfig, only changed pads are serialised
+        void DiffConfig(const Config &oldConfig, const Config &newConfig, nlohmann::json &patch);
 
-        bool ScanSampleFolder(std::string path, std::vector<Sample> &sampleList);
+        // Headers are probed on numThreads workers (0 = all cores), files with unchanged size and mtime
+        // are taken from the JSON cache at cachePath. callback receives each sample as soon as it is known.
+        bool ScanSampleFolder(std::string path, std::vector<Sample> &sampleList, std::string cachePath = "",
+                              std::function<void(const Sample &)> callback = nullptr, unsigned numThreads = 0);
         bool VerifyConfiguration(Config &config, std::string samplePackPath, unsigned sampleRate);
     } // namespace sampler
 } // namespace mck
\ No newline at end of file
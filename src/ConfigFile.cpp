@@ -1,8 +1,11 @@
 #include "ConfigFile.hpp"
+#include "Snapshot.hpp"
 #include <unistd.h>
 #include <sys/types.h>
 #include <pwd.h>
+#include <fcntl.h>
 #include <cstdio>
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <nlohmann/json.hpp>
@@ -10,12 +13,17 @@
 mck::ConfigFile::ConfigFile()
     : m_fileLoaded(false),
       m_filePath(""),
-      m_config()
+      m_config(),
+      m_isRunning(false),
+      m_isDirty(false),
+      m_debounceMs(0),
+      m_retryMs(0)
 {
 }
 
 mck::ConfigFile::~ConfigFile()
 {
+    Stop();
 }
 
 bool mck::ConfigFile::ReadFile(std::string path)
@@ -29,25 +37,21 @@ bool mck::ConfigFile::ReadFile(std::string path)
         return false;
     }
 
-    std::ifstream confFile(path);
-    nlohmann::json j;
-    confFile >> j;
-    confFile.close();
-    try
+    sampler::Config config;
+    if (Load(path, config) == false)
     {
-        m_config = j.get<mck::sampler::Config>();
+        return false;
     }
-    catch (std::exception &e)
     {
-        std::printf("Failed to convert the config file: %s", e.what());
-        return false;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_config = config;
     }
 
     m_filePath = path;
     return true;
 }
 
-bool mck::ConfigFile::WriteFile(std::string path)
+bool mck::ConfigFile::WriteFile(std::string path, bool report)
 {
     if (path == "")
     {
@@ -55,30 +59,120 @@ bool mck::ConfigFile::WriteFile(std::string path)
     }
     VerifyPath(path);
 
-    std::ofstream confFile(path);
+    sampler::Config config;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        config = m_config;
+    }
+    return Save(path, config, report);
+}
+
+bool mck::ConfigFile::Load(std::string path, sampler::Config &config)
+{
+    std::ifstream confFile(path, std::ios::binary);
+    if (confFile.is_open() == false)
+    {
+        return false;
+    }
+    std::string content((std::istreambuf_iterator<char>(confFile)), std::istreambuf_iterator<char>());
+    confFile.close();
+
+    // Binary snapshots are detected by their magic, everything else is treated as JSON
+    if (sampler::IsSnapshot(content))
+    {
+        if (sampler::ReadSnapshot(content, config) == false)
+        {
+            std::printf("Failed to read the config snapshot %s\n", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
     try
     {
-        nlohmann::json j = m_config;
-        confFile << j.dump(4) << std::endl;
-        confFile.close();
+        nlohmann::json j = nlohmann::json::parse(content);
+        config = j.get<mck::sampler::Config>();
     }
     catch (std::exception &e)
     {
-        std::printf("Failed to write config file: %s", e.what());
+        std::printf("Failed to convert the config file: %s", e.what());
         return false;
     }
     return true;
 }
 
+bool mck::ConfigFile::Save(std::string path, const sampler::Config &config, bool report)
+{
+    std::string content;
+    if (std::filesystem::path(path).extension() == ".json")
+    {
+        try
+        {
+            nlohmann::json j = config;
+            content = j.dump(4) + "\n";
+        }
+        catch (std::exception &e)
+        {
+            std::printf("Failed to write config file: %s", e.what());
+            return false;
+        }
+    }
+    else
+    {
+        sampler::WriteSnapshot(config, content);
+    }
+    return WriteAtomic(path, content, report);
+}
+
 bool mck::ConfigFile::GetConfig(sampler::Config &config)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
     config = m_config;
     return m_fileLoaded;
 }
 
 void mck::ConfigFile::SetConfig(sampler::Config &config)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
     m_config = config;
+    m_debounceMs = config.saveDelayMs;
+    if (m_isRunning)
+    {
+        m_isDirty = true;
+        m_lastChange = std::chrono::steady_clock::now();
+        m_cond.notify_one();
+    }
+}
+
+bool mck::ConfigFile::Start(std::string path, unsigned debounceMs)
+{
+    if (path == "" || m_thread.joinable())
+    {
+        return false;
+    }
+    VerifyPath(path);
+
+    m_filePath = path;
+    m_debounceMs = debounceMs;
+    m_isDirty = false;
+    m_retryMs = 0;
+    m_isRunning = true;
+    m_thread = std::thread(&mck::ConfigFile::WriteThread, this);
+    return true;
+}
+
+void mck::ConfigFile::Stop()
+{
+    if (m_thread.joinable() == false)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_isRunning = false;
+    }
+    m_cond.notify_one();
+    m_thread.join();
 }
 
 std::string mck::ConfigFile::GetHomeDir()
@@ -97,4 +191,129 @@ bool mck::ConfigFile::VerifyPath(std::string path)
     }
 
     return std::filesystem::exists(path);
-}
\ No newline at end of file
+}
+
+bool mck::ConfigFile::WriteAtomic(std::string path, const std::string &content, bool report)
+{
+    // Write to a temporary file next to the target and rename it afterwards,
+    // so the config is either the old or the new version, never a partial one
+    std::string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        if (report)
+        {
+            std::fprintf(stderr, "Failed to open temporary config file %s\n", tmpPath.c_str());
+        }
+        return false;
+    }
+
+    size_t offset = 0;
+    while (offset < content.size())
+    {
+        ssize_t ret = write(fd, content.data() + offset, content.size() - offset);
+        if (ret < 0)
+        {
+            if (report)
+            {
+                std::fprintf(stderr, "Failed to write temporary config file %s\n", tmpPath.c_str());
+            }
+            close(fd);
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        offset += ret;
+    }
+
+    if (fsync(fd) != 0)
+    {
+        if (report)
+        {
+            std::fprintf(stderr, "Failed to sync temporary config file %s\n", tmpPath.c_str());
+        }
+        close(fd);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    close(fd);
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        if (report)
+        {
+            std::fprintf(stderr, "Failed to replace config file %s\n", path.c_str());
+        }
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    // Persist the rename itself
+    std::filesystem::path fp(path);
+    int dirFd = open(fp.parent_path().c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd >= 0)
+    {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    return true;
+}
+
+void mck::ConfigFile::WriteThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cond.wait(lock, [this] { return m_isDirty || m_isRunning == false; });
+
+        // Coalesce changes until the config was left untouched for the debounce window
+        while (m_isRunning && m_isDirty)
+        {
+            auto deadline = m_lastChange + std::chrono::milliseconds(m_debounceMs);
+            // Newer changes do not cut a backoff short, every one of them would fail the same way
+            if (m_retryMs > 0)
+            {
+                deadline = std::max(deadline, m_retryAt);
+            }
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                break;
+            }
+            m_cond.wait_until(lock, deadline);
+        }
+
+        if (m_isDirty)
+        {
+            m_isDirty = false;
+            bool report = m_retryMs == 0;
+            lock.unlock();
+            bool written = WriteFile(m_filePath, report);
+            lock.lock();
+            if (written == false)
+            {
+                // A read-only or full disk fails every write, so a zero saveDelayMs must not turn
+                // the retries into a busy loop
+                if (m_retryMs == 0)
+                {
+                    std::fprintf(stderr, "Failed to persist the config to %s, retrying in the background\n", m_filePath.c_str());
+                    m_retryMs = std::max(m_debounceMs, SAMPLER_SAVE_RETRY_MS);
+                }
+                else
+                {
+                    m_retryMs = std::min(m_retryMs * 2, SAMPLER_MAX_SAVE_RETRY_MS);
+                }
+                m_isDirty = true;
+                m_retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_retryMs);
+            }
+            else if (m_retryMs > 0)
+            {
+                std::fprintf(stderr, "Persisted the config to %s again\n", m_filePath.c_str());
+                m_retryMs = 0;
+            }
+        }
+
+        if (m_isRunning == false)
+        {
+            return;
+        }
+    }
+}
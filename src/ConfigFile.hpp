@@ -1,26 +1,57 @@
 #pragma once
 
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include "Config.hpp"
 
 namespace mck {
+    const unsigned SAMPLER_SAVE_RETRY_MS = 1000;      // First retry of a failed write, at least
+    const unsigned SAMPLER_MAX_SAVE_RETRY_MS = 60000; // Retries back off up to this
+
     class ConfigFile {
         public:
             ConfigFile();
             ~ConfigFile();
 
             bool ReadFile(std::string path);
-            bool WriteFile(std::string path);
+            bool WriteFile(std::string path, bool report = true);
 
             bool GetConfig(sampler::Config &config);
             void SetConfig(sampler::Config &config);
 
+            // Background persistence, changes are coalesced over the debounce window. The window
+            // follows the saveDelayMs of the latest config. Failed writes are retried with a backoff
+            // of their own, only the first failure of a run is reported
+            bool Start(std::string path, unsigned debounceMs);
+            void Stop();
+
+            // Format is picked by extension on write (.json or binary snapshot) and detected on read
+            static bool Load(std::string path, sampler::Config &config);
+            static bool Save(std::string path, const sampler::Config &config, bool report = true);
+
             static std::string GetHomeDir();
         private:
             bool VerifyPath(std::string path);
-            
+            static bool WriteAtomic(std::string path, const std::string &content, bool report);
+            void WriteThread();
+
             bool m_fileLoaded;
             std::string m_filePath;
             sampler::Config m_config;
+
+            // Persistence
+            std::mutex m_mutex;
+            std::condition_variable m_cond;
+            std::thread m_thread;
+            bool m_isRunning;
+            bool m_isDirty;
+            unsigned m_debounceMs;
+            std::chrono::steady_clock::time_point m_lastChange;
+            unsigned m_retryMs; // 0 unless the last write failed
+            std::chrono::steady_clock::time_point m_retryAt;
     };
 }
@@ -0,0 +1,86 @@
+#include "Groove.hpp"
+#include "StepScheduler.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    const double SLOT_TICKS = mck::SAMPLER_TICKS_PER_BAR / mck::sampler::SAMPLER_GROOVE_SLOTS;
+
+    // Position of x from 0 to 1 in a swung pair, the second half starts at split
+    double Swing(double x, double split)
+    {
+        return x < 0.5 ? x * 2.0 * split : split + (x - 0.5) * 2.0 * (1.0 - split);
+    }
+} // namespace
+
+double mck::ApplyGroove(const sampler::Groove &groove, double tick, double &strength)
+{
+    double bar = std::floor(tick / SAMPLER_TICKS_PER_BAR) * SAMPLER_TICKS_PER_BAR;
+    double pos = tick - bar;
+
+    if (groove.type == sampler::GRV_SWING_8 || groove.type == sampler::GRV_SWING_16)
+    {
+        double pair = groove.type == sampler::GRV_SWING_8 ? SAMPLER_TICKS_PER_BEAT : SAMPLER_TICKS_PER_BEAT / 2.0;
+        double start = std::floor(pos / pair) * pair;
+        return bar + start + Swing((pos - start) / pair, groove.swing / 100.0) * pair;
+    }
+    else if (groove.type == sampler::GRV_USER)
+    {
+        // Straight between the shifted 16ths, so steps of any resolution follow the groove
+        unsigned numSlots = sampler::SAMPLER_GROOVE_SLOTS;
+        double slot = pos / SLOT_TICKS;
+        unsigned k = std::min(numSlots - 1, (unsigned)slot);
+        double a = k + groove.timing[k];
+        double b = k + 1 + groove.timing[(k + 1) % numSlots];
+        strength *= groove.velocity[(unsigned)std::lround(slot) % numSlots];
+        return bar + (a + (slot - k) * (b - a)) * SLOT_TICKS;
+    }
+    return tick;
+}
+
+bool mck::ExtractGroove(const std::vector<GrooveHit> &hits, sampler::Groove &groove)
+{
+    if (hits.size() < SAMPLER_GROOVE_MIN_HITS)
+    {
+        return false;
+    }
+
+    unsigned numSlots = sampler::SAMPLER_GROOVE_SLOTS;
+    std::vector<double> timing(numSlots, 0.0);
+    std::vector<double> velocity(numSlots, 0.0);
+    std::vector<unsigned> count(numSlots, 0);
+
+    for (auto &hit : hits)
+    {
+        int64_t k = std::llround(hit.tick / SLOT_TICKS);
+        unsigned slot = (unsigned)(((k % numSlots) + numSlots) % numSlots);
+        timing[slot] += hit.tick / SLOT_TICKS - k;
+        velocity[slot] += hit.velocity;
+        count[slot]++;
+    }
+
+    double maxVelocity = 0.0;
+    for (unsigned i = 0; i < numSlots; i++)
+    {
+        if (count[i] > 0)
+        {
+            timing[i] /= count[i];
+            velocity[i] /= count[i];
+            maxVelocity = std::max(maxVelocity, velocity[i]);
+        }
+    }
+    if (maxVelocity <= 0.0)
+    {
+        return false;
+    }
+
+    groove.type = sampler::GRV_USER;
+    for (unsigned i = 0; i < numSlots; i++)
+    {
+        // 16ths that were never played stay straight and at full velocity
+        groove.timing[i] = count[i] > 0 ? std::min(0.45, std::max(-0.45, timing[i])) : 0.0;
+        groove.velocity[i] = count[i] > 0 ? velocity[i] / maxVelocity : 1.0;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+#include "Config.hpp"
+
+namespace mck
+{
+    const unsigned SAMPLER_GROOVE_MIN_HITS = 8; // Fewer notes do not make a groove
+
+    // Note played along the transport, while a groove is learned
+    struct GrooveHit
+    {
+        double tick; // From the start of the transport
+        double velocity;
+    };
+
+    // Moves a tick of the straight grid to where the groove plays it, bars start at multiples of
+    // SAMPLER_TICKS_PER_BAR. strength is scaled by the velocity of the groove
+    double ApplyGroove(const sampler::Groove &groove, double tick, double &strength);
+    // Average timing and velocity of each 16th of the bar, taken from the nearest 16th of every note
+    bool ExtractGroove(const std::vector<GrooveHit> &hits, sampler::Groove &groove);
+} // namespace mck
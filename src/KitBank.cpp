@@ -0,0 +1,592 @@
+#include "KitBank.hpp"
+#include "ConfigFile.hpp"
+#include "SampleLoader.hpp"
+#include "SampleStreamer.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <regex>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sndfile.h>
+
+namespace fs = std::filesystem;
+
+mck::KitBank::KitBank()
+    : m_isInitialized(false),
+      m_kitPath(""),
+      m_samplePackPath(""),
+      m_sampleRate(0),
+      m_memoryBudget(0),
+      m_activeKit(-1),
+      m_useCount(0),
+      m_loader(nullptr),
+      m_compact(false),
+      m_upgradeCallback(),
+      m_diskCache(),
+      m_kits(),
+      m_sampleCache()
+{
+}
+
+mck::KitBank::~KitBank()
+{
+}
+
+bool mck::KitBank::Init(std::string kitPath, std::string samplePackPath, std::string cachePath, unsigned sampleRate, size_t memoryBudget)
+{
+    if (m_isInitialized)
+    {
+        return false;
+    }
+
+    m_kitPath = kitPath;
+    m_samplePackPath = samplePackPath;
+    m_sampleRate = sampleRate;
+    m_memoryBudget = memoryBudget;
+
+    if (fs::exists(m_kitPath) == false)
+    {
+        if (fs::create_directories(m_kitPath) == false)
+        {
+            return false;
+        }
+    }
+
+    // Without the disk cache every sample is decoded again
+    m_diskCache.Init(cachePath);
+
+    for (auto &fp : fs::directory_iterator(m_kitPath))
+    {
+        if (fp.is_regular_file() == false || fp.path().extension() != ".mckkit")
+        {
+            continue;
+        }
+        auto kit = std::make_unique<Kit>();
+        if (ConfigFile::Load(fp.path().string(), kit->config) == false)
+        {
+            std::printf("Kit %s is malformed\n", fp.path().c_str());
+            continue;
+        }
+        kit->name = fp.path().stem().string();
+        kit->path = fp.path().string();
+        m_kits.push_back(std::move(kit));
+    }
+
+    // Sort by name
+    std::sort(m_kits.begin(), m_kits.end(), [](const std::unique_ptr<Kit> &a, const std::unique_ptr<Kit> &b) {
+        return a->name < b->name;
+    });
+
+    m_isInitialized = true;
+    return true;
+}
+
+void mck::KitBank::GetKits(std::vector<KitInfo> &kits)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    kits.resize(m_kits.size());
+    for (unsigned i = 0; i < m_kits.size(); i++)
+    {
+        kits[i].name = m_kits[i]->name;
+        kits[i].index = i;
+        kits[i].resident = m_kits[i]->resident;
+        kits[i].active = (int)i == m_activeKit;
+    }
+}
+
+unsigned mck::KitBank::GetNumKits()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    return m_kits.size();
+}
+
+mck::Kit *mck::KitBank::GetKit(unsigned idx)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (m_isInitialized == false || idx >= m_kits.size())
+    {
+        return nullptr;
+    }
+
+    Kit &kit = *m_kits[idx];
+    kit.lastUsed = ++m_useCount;
+    if (kit.resident == false)
+    {
+        MakeResident(kit);
+        EnforceBudget(&kit);
+    }
+    return &kit;
+}
+
+bool mck::KitBank::SaveKit(std::string name, const sampler::Config &config, const std::vector<std::shared_ptr<SampleBuffer>> &samples)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (m_isInitialized == false)
+    {
+        return false;
+    }
+
+    name = std::regex_replace(name, std::regex("[/\\\\]"), "_");
+    if (name == "")
+    {
+        name = "Kit " + std::to_string(m_kits.size() + 1);
+    }
+
+    fs::path kitPath(m_kitPath);
+    kitPath.append(name + ".mckkit");
+    if (ConfigFile::Save(kitPath.string(), config) == false)
+    {
+        return false;
+    }
+
+    auto it = std::find_if(m_kits.begin(), m_kits.end(), [&name](const std::unique_ptr<Kit> &k) {
+        return k->name == name;
+    });
+    if (it == m_kits.end())
+    {
+        m_kits.push_back(std::make_unique<Kit>());
+        it = m_kits.end() - 1;
+    }
+    Kit &kit = **it;
+    kit.name = name;
+    kit.path = kitPath.string();
+    kit.config = config;
+    kit.samples = samples;
+    kit.resident = true;
+    kit.lastUsed = ++m_useCount;
+
+    // Keep the active index pointing to the same kit after sorting
+    Kit *active = m_activeKit >= 0 ? m_kits[m_activeKit].get() : nullptr;
+    std::sort(m_kits.begin(), m_kits.end(), [](const std::unique_ptr<Kit> &a, const std::unique_ptr<Kit> &b) {
+        return a->name < b->name;
+    });
+    for (unsigned i = 0; i < m_kits.size(); i++)
+    {
+        if (m_kits[i].get() == active)
+        {
+            m_activeKit = i;
+        }
+    }
+
+    EnforceBudget(&kit);
+    return true;
+}
+
+void mck::KitBank::SetActiveKit(int idx)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    m_activeKit = idx < (int)m_kits.size() ? idx : -1;
+}
+
+void mck::KitBank::SetCompactStorage(bool compact)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (compact == m_compact)
+    {
+        return;
+    }
+    m_compact = compact;
+    m_sampleCache.clear();
+    for (auto &kit : m_kits)
+    {
+        kit->samples.clear();
+        kit->resident = false;
+    }
+}
+
+bool mck::KitBank::GetCompactStorage()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    return m_compact;
+}
+
+std::shared_ptr<mck::SampleBuffer> mck::KitBank::LoadSample(std::string path, SampleLoader *loader)
+{
+    std::string fullPath = ResolvePath(path);
+    if (auto sample = GetCachedSample(fullPath))
+    {
+        return sample;
+    }
+    bool compact = GetCompactStorage();
+
+    if (fs::is_regular_file(fullPath) == false)
+    {
+        return nullptr;
+    }
+
+    // Decode without holding the lock, so loader threads can work in parallel
+    auto sample = ReadSample(fullPath, loader != nullptr);
+    if (sample == nullptr)
+    {
+        return nullptr;
+    }
+    bool upgrade = sample->quality != SAMPLER_SRC_QUALITY;
+    // Streamed samples only keep a short head, it stays float
+    if (compact && sample->fd < 0)
+    {
+        sample = CompactSample(*sample);
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (compact != m_compact)
+    {
+        // Storage changed while decoding
+        return sample;
+    }
+    auto it = m_sampleCache.find(fullPath);
+    if (it != m_sampleCache.end())
+    {
+        if (auto cached = it->second.lock())
+        {
+            return cached;
+        }
+    }
+    m_sampleCache[fullPath] = sample;
+    if (upgrade)
+    {
+        loader->Upgrade(fullPath);
+    }
+    return sample;
+}
+
+void mck::KitBank::UpgradeSample(std::string path)
+{
+    std::string fullPath = ResolvePath(path);
+    bool compact = GetCompactStorage();
+    auto sample = ReadSample(fullPath, false);
+    if (sample == nullptr)
+    {
+        return;
+    }
+    if (compact && sample->fd < 0)
+    {
+        sample = CompactSample(*sample);
+    }
+
+    UpgradeCallback callback;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_mutex);
+        auto it = m_sampleCache.find(fullPath);
+        if (compact != m_compact || it == m_sampleCache.end())
+        {
+            return;
+        }
+        auto preview = it->second.lock();
+        if (preview == nullptr || preview->quality == SAMPLER_SRC_QUALITY)
+        {
+            return;
+        }
+
+        it->second = sample;
+        for (auto &kit : m_kits)
+        {
+            std::replace(kit->samples.begin(), kit->samples.end(), preview, sample);
+        }
+        EnforceBudget();
+        callback = m_upgradeCallback;
+    }
+
+    // Pads holding the preview are switched by the engine
+    if (callback)
+    {
+        callback(fullPath, sample);
+    }
+}
+
+void mck::KitBank::SetUpgradeCallback(UpgradeCallback callback)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    m_upgradeCallback = callback;
+}
+
+std::shared_ptr<mck::SampleBuffer> mck::KitBank::ReadSample(std::string fullPath, bool preview)
+{
+    auto sample = m_diskCache.Load(fullPath, m_sampleRate, SAMPLER_SRC_QUALITY, SAMPLER_STREAM_THRESHOLD, SAMPLER_STREAM_HEAD_FRAMES);
+    if (sample != nullptr)
+    {
+        return sample;
+    }
+
+    sample = DecodeSample(fullPath, m_sampleRate, preview ? SAMPLER_SRC_PREVIEW_QUALITY : SAMPLER_SRC_QUALITY);
+    if (sample == nullptr || sample->quality != SAMPLER_SRC_QUALITY)
+    {
+        return sample;
+    }
+
+    // Long samples are streamed from their cache entry, the full decode is dropped
+    if (m_diskCache.Store(fullPath, m_sampleRate, SAMPLER_SRC_QUALITY, *sample) && sample->GetMemSize() > SAMPLER_STREAM_THRESHOLD)
+    {
+        if (auto streamed = m_diskCache.Load(fullPath, m_sampleRate, SAMPLER_SRC_QUALITY, SAMPLER_STREAM_THRESHOLD, SAMPLER_STREAM_HEAD_FRAMES))
+        {
+            sample = streamed;
+        }
+    }
+    return sample;
+}
+
+std::shared_ptr<mck::SampleBuffer> mck::KitBank::GetCachedSample(std::string path)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto it = m_sampleCache.find(ResolvePath(path));
+    if (it != m_sampleCache.end())
+    {
+        return it->second.lock();
+    }
+    return nullptr;
+}
+
+void mck::KitBank::Preload(SampleLoader &loader)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    m_loader = &loader;
+    // Samples arrive asynchronously, so the budget is checked against their decoded size up front
+    std::set<std::string> counted;
+    size_t memSize = GetMemSize();
+    for (auto &kit : m_kits)
+    {
+        if (kit->resident)
+        {
+            continue;
+        }
+        size_t kitSize = EstimateMemSize(*kit, counted);
+        if (memSize + kitSize > m_memoryBudget)
+        {
+            std::printf("Kit %s is loaded when selected, it exceeds the memory budget\n", kit->name.c_str());
+            continue;
+        }
+        memSize += kitSize;
+        MakeResident(*kit);
+    }
+}
+
+std::string mck::KitBank::ResolvePath(std::string samplePath)
+{
+    fs::path path(samplePath);
+    if (path.is_absolute() == false)
+    {
+        path = fs::path(m_samplePackPath).append(samplePath);
+    }
+    return path.string();
+}
+
+size_t mck::KitBank::GetMemSize()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    size_t size = 0;
+    for (auto it = m_sampleCache.begin(); it != m_sampleCache.end();)
+    {
+        if (auto sample = it->second.lock())
+        {
+            size += sample->GetMemSize();
+            it++;
+        }
+        else
+        {
+            it = m_sampleCache.erase(it);
+        }
+    }
+    return size;
+}
+
+bool mck::KitBank::MakeResident(Kit &kit)
+{
+    kit.samples.clear();
+    kit.samples.resize(kit.config.pads.size());
+    kit.resident = true;
+    for (unsigned i = 0; i < kit.config.pads.size(); i++)
+    {
+        if (kit.config.pads[i].samplePath == "")
+        {
+            continue;
+        }
+        if (m_loader == nullptr)
+        {
+            kit.samples[i] = LoadSample(kit.config.pads[i].samplePath);
+            continue;
+        }
+
+        // Pads missing when the kit is selected are loaded again by the engine
+        Kit *k = &kit;
+        m_loader->Load(kit.config.pads[i].samplePath, [this, k, i](std::shared_ptr<SampleBuffer> sample) {
+            std::lock_guard<std::recursive_mutex> lock(m_mutex);
+            // Kit may have been evicted in the meantime
+            if (k->resident && i < k->samples.size())
+            {
+                k->samples[i] = sample;
+                EnforceBudget(k);
+            }
+        });
+    }
+    return true;
+}
+
+size_t mck::KitBank::EstimateMemSize(const Kit &kit, std::set<std::string> &counted)
+{
+    size_t size = 0;
+    size_t bytesPerSample = m_compact ? sizeof(int16_t) : sizeof(float);
+    for (auto &pad : kit.config.pads)
+    {
+        if (pad.samplePath == "")
+        {
+            continue;
+        }
+        std::string fullPath = ResolvePath(pad.samplePath);
+        if (counted.insert(fullPath).second == false || GetCachedSample(fullPath) != nullptr)
+        {
+            continue;
+        }
+
+        SF_INFO info;
+        std::memset(&info, 0, sizeof(SF_INFO));
+        SNDFILE *file = sf_open(fullPath.c_str(), SFM_READ, &info);
+        if (file == nullptr)
+        {
+            continue;
+        }
+        sf_close(file);
+        if (info.frames <= 0 || info.channels <= 0 || info.samplerate <= 0)
+        {
+            continue;
+        }
+
+        size_t numChans = std::min(2, info.channels);
+        size_t numFrames = (size_t)std::ceil((double)info.frames * (double)m_sampleRate / (double)info.samplerate);
+        // Decoded size as GetMemSize counts it, long samples only keep their head and tail
+        if (numFrames * numChans * sizeof(float) > SAMPLER_STREAM_THRESHOLD)
+        {
+            size += 2 * SAMPLER_STREAM_HEAD_FRAMES * numChans * sizeof(float);
+        }
+        else
+        {
+            size += numFrames * numChans * bytesPerSample;
+        }
+    }
+    return size;
+}
+
+void mck::KitBank::EnforceBudget(const Kit *keep)
+{
+    // Evict the least recently used kits, the active kit always stays resident
+    while (GetMemSize() > m_memoryBudget)
+    {
+        Kit *lru = nullptr;
+        for (unsigned i = 0; i < m_kits.size(); i++)
+        {
+            if (m_kits[i]->resident == false || (int)i == m_activeKit || m_kits[i].get() == keep)
+            {
+                continue;
+            }
+            if (lru == nullptr || m_kits[i]->lastUsed < lru->lastUsed)
+            {
+                lru = m_kits[i].get();
+            }
+        }
+        if (lru == nullptr)
+        {
+            return;
+        }
+        lru->samples.clear();
+        lru->resident = false;
+    }
+}
+
+std::shared_ptr<mck::SampleBuffer> mck::KitBank::DecodeSample(std::string path, unsigned sampleRate, int quality)
+{
+    SF_INFO info;
+    std::memset(&info, 0, sizeof(SF_INFO));
+    SNDFILE *file = sf_open(path.c_str(), SFM_READ, &info);
+    if (file == nullptr)
+    {
+        std::printf("Unable to open sample %s: %s\n", path.c_str(), sf_strerror(nullptr));
+        return nullptr;
+    }
+    if (info.frames <= 0 || info.channels <= 0 || info.samplerate <= 0)
+    {
+        sf_close(file);
+        return nullptr;
+    }
+
+    std::vector<float> in(info.frames * info.channels);
+    sf_count_t numFrames = sf_readf_float(file, in.data(), info.frames);
+    sf_close(file);
+    if (numFrames <= 0)
+    {
+        return nullptr;
+    }
+
+    // Sample rate Conversion, samples at the engine rate are exact at any quality
+    std::vector<float> out;
+    auto sample = std::make_shared<SampleBuffer>();
+    sample->quality = SAMPLER_SRC_QUALITY;
+    if ((unsigned)info.samplerate != sampleRate)
+    {
+        double ratio = (double)sampleRate / (double)info.samplerate;
+        out.resize((size_t)std::ceil((double)numFrames * ratio + 1.0) * info.channels);
+        SRC_DATA src;
+        std::memset(&src, 0, sizeof(SRC_DATA));
+        src.data_in = in.data();
+        src.data_out = out.data();
+        src.input_frames = numFrames;
+        src.output_frames = out.size() / info.channels;
+        src.src_ratio = ratio;
+        int err = src_simple(&src, quality, info.channels);
+        if (err != 0)
+        {
+            std::printf("Unable to resample %s: %s\n", path.c_str(), src_strerror(err));
+            return nullptr;
+        }
+        numFrames = src.output_frames_gen;
+        sample->quality = quality;
+    }
+    else
+    {
+        out.swap(in);
+    }
+
+    // The mixer plays mono and stereo, further channels are dropped
+    unsigned numChans = std::min(2, info.channels);
+    sample->buffer.resize(numChans);
+    for (unsigned c = 0; c < numChans; c++)
+    {
+        sample->buffer[c].resize(numFrames);
+        for (sf_count_t i = 0; i < numFrames; i++)
+        {
+            sample->buffer[c][i] = out[i * info.channels + c];
+        }
+    }
+    sample->Update();
+    sample->info.valid = true;
+    sample->info.numChans = numChans;
+    sample->info.lengthMs = (unsigned)std::floor((double)numFrames * 1000.0 / (double)sampleRate);
+    return sample;
+}
+
+std::shared_ptr<mck::SampleBuffer> mck::KitBank::CompactSample(const SampleBuffer &sample)
+{
+    // One scale for all channels keeps the stereo image
+    float peak = 0.0f;
+    for (auto &ch : sample.channels)
+    {
+        for (size_t i = 0; i < sample.numFrames; i++)
+        {
+            peak = std::max(peak, std::abs(ch[i]));
+        }
+    }
+
+    auto compact = std::make_shared<SampleBuffer>();
+    compact->info = sample.info;
+    compact->quality = sample.quality;
+    compact->scale = peak > 0.0f ? peak / 32767.0f : 1.0f;
+    compact->compact.resize(sample.channels.size());
+    for (unsigned c = 0; c < sample.channels.size(); c++)
+    {
+        compact->compact[c].resize(sample.numFrames);
+        for (size_t i = 0; i < sample.numFrames; i++)
+        {
+            compact->compact[c][i] = (int16_t)std::lrint(sample.channels[c][i] / compact->scale);
+        }
+    }
+    compact->Update();
+    return compact;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include <samplerate.h>
+
+#include "Types.hpp"
+#include "Config.hpp"
+#include "SampleCache.hpp"
+
+namespace mck
+{
+    class SampleLoader;
+
+    const int SAMPLER_SRC_QUALITY = SRC_SINC_BEST_QUALITY;
+    const int SAMPLER_SRC_PREVIEW_QUALITY = SRC_LINEAR; // Playable right away, replaced in the background
+
+    struct Kit
+    {
+        std::string name;
+        std::string path;
+        sampler::Config config;
+        // Decoded samples per pad, empty while the kit is not resident
+        std::vector<std::shared_ptr<SampleBuffer>> samples;
+        bool resident;
+        unsigned lastUsed;
+        Kit() : name(""), path(""), config(), samples(), resident(false), lastUsed(0) {}
+    };
+
+    class KitBank
+    {
+    public:
+        typedef std::function<void(std::string, std::shared_ptr<SampleBuffer>)> UpgradeCallback;
+
+        KitBank();
+        ~KitBank();
+
+        bool Init(std::string kitPath, std::string samplePackPath, std::string cachePath, unsigned sampleRate, size_t memoryBudget);
+
+        void GetKits(std::vector<KitInfo> &kits);
+        unsigned GetNumKits();
+        // Returns a kit and makes it resident. A kit that did not fit the memory budget or was
+        // evicted is cold, its pads stay silent until the loader delivered their samples. That is a
+        // few ms per sample from the disk cache and a full decode and resample for new samples
+        Kit *GetKit(unsigned idx);
+        bool SaveKit(std::string name, const sampler::Config &config, const std::vector<std::shared_ptr<SampleBuffer>> &samples);
+        void SetActiveKit(int idx);
+
+        // Decodes the kits in the background as long as their estimated size fits the memory budget,
+        // the others stay cold until they are selected
+        void Preload(SampleLoader &loader);
+
+        // Keeps 16 bit samples instead of float, drops all decoded samples when switched
+        void SetCompactStorage(bool compact);
+        bool GetCompactStorage();
+
+        // Decodes a sample at the engine rate, buffers are shared between kits and pads.
+        // With a loader a fast preview conversion is returned and upgraded by the loader later
+        std::shared_ptr<SampleBuffer> LoadSample(std::string path, SampleLoader *loader = nullptr);
+        // Replaces a preview conversion with the full quality one, called by the loader
+        void UpgradeSample(std::string path);
+        // Called from a loader thread with the resolved path once a preview was replaced
+        void SetUpgradeCallback(UpgradeCallback callback);
+        std::shared_ptr<SampleBuffer> GetCachedSample(std::string path);
+        std::string ResolvePath(std::string samplePath);
+        size_t GetMemSize();
+
+    private:
+        bool MakeResident(Kit &kit);
+        // Decoded size of the samples of a kit from their headers, paths already counted are skipped
+        size_t EstimateMemSize(const Kit &kit, std::set<std::string> &counted);
+        std::shared_ptr<SampleBuffer> ReadSample(std::string fullPath, bool preview);
+        static std::shared_ptr<SampleBuffer> DecodeSample(std::string path, unsigned sampleRate, int quality);
+        static std::shared_ptr<SampleBuffer> CompactSample(const SampleBuffer &sample);
+        void EnforceBudget(const Kit *keep = nullptr);
+
+        bool m_isInitialized;
+        std::string m_kitPath;
+        std::string m_samplePackPath;
+        unsigned m_sampleRate;
+        size_t m_memoryBudget;
+        int m_activeKit;
+        unsigned m_useCount;
+        SampleLoader *m_loader;
+        bool m_compact;
+        UpgradeCallback m_upgradeCallback;
+        SampleCache m_diskCache;
+
+        std::vector<std::unique_ptr<Kit>> m_kits;
+        std::map<std::string, std::weak_ptr<SampleBuffer>> m_sampleCache;
+        std::recursive_mutex m_mutex;
+    };
+} // namespace mck
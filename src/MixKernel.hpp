@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace mck
+{
+    // dst[i] += src[i] * gain, widening 16-bit sample data to float
+    inline void MixInt16(float *dst, const int16_t *src, float gain, unsigned len)
+    {
+        unsigned i = 0;
+#if defined(__SSE2__)
+        __m128 g = _mm_set1_ps(gain);
+        for (; i + 8 <= len; i += 8)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+            __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(lo, g)));
+            _mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_mul_ps(hi, g)));
+        }
+#elif defined(__ARM_NEON)
+        float32x4_t g = vdupq_n_f32(gain);
+        for (; i + 8 <= len; i += 8)
+        {
+            int16x8_t s = vld1q_s16(src + i);
+            float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+            float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+            vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i), lo, g));
+            vst1q_f32(dst + i + 4, vmlaq_f32(vld1q_f32(dst + i + 4), hi, g));
+        }
+#endif
+        for (; i < len; i++)
+        {
+            dst[i] += (float)src[i] * gain;
+        }
+    }
+
+    // dst[i] += src[-i] * gain, for reverse playback
+    inline void MixInt16Reverse(float *dst, const int16_t *src, float gain, unsigned len)
+    {
+        unsigned i = 0;
+#if defined(__SSE2__)
+        __m128 g = _mm_set1_ps(gain);
+        for (; i + 8 <= len; i += 8)
+        {
+            __m128i s = _mm_loadu_si128((const __m128i *)(src - i - 7));
+            s = _mm_shuffle_epi32(s, _MM_SHUFFLE(0, 1, 2, 3));
+            s = _mm_shufflelo_epi16(s, _MM_SHUFFLE(2, 3, 0, 1));
+            s = _mm_shufflehi_epi16(s, _MM_SHUFFLE(2, 3, 0, 1));
+            __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+            __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(lo, g)));
+            _mm_storeu_ps(dst + i + 4, _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_mul_ps(hi, g)));
+        }
+#elif defined(__ARM_NEON)
+        float32x4_t g = vdupq_n_f32(gain);
+        for (; i + 8 <= len; i += 8)
+        {
+            int16x8_t s = vrev64q_s16(vld1q_s16(src - i - 7));
+            s = vcombine_s16(vget_high_s16(s), vget_low_s16(s));
+            float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+            float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+            vst1q_f32(dst + i, vmlaq_f32(vld1q_f32(dst + i), lo, g));
+            vst1q_f32(dst + i + 4, vmlaq_f32(vld1q_f32(dst + i + 4), hi, g));
+        }
+#endif
+        for (; i < len; i++)
+        {
+            dst[i] += (float)src[-(int)i] * gain;
+        }
+    }
+} // namespace mck
@@ -0,0 +1,211 @@
+#include "PreviewEngine.hpp"
+#include <algorithm>
+
+mck::PreviewEngine::PreviewEngine()
+    : m_isInitialized(false),
+      m_fadeInStep(1.0f),
+      m_fadeOutStep(1.0f),
+      m_order(0),
+      m_commands(),
+      m_voices(),
+      m_samples()
+{
+}
+
+mck::PreviewEngine::~PreviewEngine()
+{
+}
+
+bool mck::PreviewEngine::Init(unsigned sampleRate)
+{
+    if (m_isInitialized || sampleRate == 0)
+    {
+        return false;
+    }
+
+    m_fadeInStep = 1000.0f / (float)(SAMPLER_PREVIEW_FADE_IN_MS * sampleRate);
+    m_fadeOutStep = 1000.0f / (float)(SAMPLER_PREVIEW_FADE_OUT_MS * sampleRate);
+    m_voices.resize(2 * SAMPLER_NUM_PREVIEWS);
+
+    m_isInitialized = true;
+    return true;
+}
+
+bool mck::PreviewEngine::Play(std::shared_ptr<SampleBuffer> sample, bool sync)
+{
+    if (m_isInitialized == false || sample == nullptr || sample->channels.empty())
+    {
+        return false;
+    }
+    Collect();
+
+    Command cmd;
+    cmd.type = PC_PLAY;
+    cmd.sample = sample.get();
+    cmd.sync = sync;
+    // The RT thread owns this user until the voice ends
+    sample->users.fetch_add(1, std::memory_order_relaxed);
+    if (m_commands.Push(cmd) == false)
+    {
+        sample->users.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (std::find(m_samples.begin(), m_samples.end(), sample) == m_samples.end())
+    {
+        m_samples.push_back(sample);
+    }
+    return true;
+}
+
+void mck::PreviewEngine::Stop()
+{
+    if (m_isInitialized == false)
+    {
+        return;
+    }
+    Collect();
+
+    Command cmd;
+    cmd.type = PC_STOP;
+    m_commands.Push(cmd);
+}
+
+void mck::PreviewEngine::Process(float *outLeft, float *outRight, unsigned nframes, bool running, int beatOffset)
+{
+    if (m_isInitialized == false)
+    {
+        return;
+    }
+
+    Command cmd;
+    while (m_commands.Pop(cmd))
+    {
+        if (cmd.type == PC_STOP)
+        {
+            for (auto &v : m_voices)
+            {
+                FadeOut(v);
+            }
+        }
+        else
+        {
+            StartVoice(cmd, running);
+        }
+    }
+
+    for (auto &v : m_voices)
+    {
+        if (v.state == PV_FREE)
+        {
+            continue;
+        }
+        unsigned offset = 0;
+        if (v.state == PV_WAITING)
+        {
+            if (running && beatOffset < 0)
+            {
+                continue;
+            }
+            // A stopped transport releases waiting auditions right away
+            offset = running ? std::min((unsigned)beatOffset, nframes) : 0;
+            v.state = PV_PLAYING;
+        }
+
+        const SampleBuffer &s = *v.sample;
+        const float *left = s.channels[0];
+        const float *right = s.channels.size() > 1 ? s.channels[1] : s.channels[0];
+        float chanGain = s.channels.size() > 1 ? 1.0f : 0.707f;
+        unsigned len = (unsigned)std::min((size_t)(nframes - offset), s.numFrames - v.pos);
+        for (unsigned i = 0; i < len; i++)
+        {
+            v.gain = std::min(1.0f, std::max(0.0f, v.gain + v.step));
+            float g = v.gain * chanGain;
+            outLeft[offset + i] += left[v.pos + i] * g;
+            outRight[offset + i] += right[v.pos + i] * g;
+        }
+        v.pos += len;
+
+        if (v.pos >= s.numFrames || (v.state == PV_STOPPING && v.gain <= 0.0f))
+        {
+            Release(v);
+        }
+    }
+}
+
+void mck::PreviewEngine::StartVoice(const Command &cmd, bool running)
+{
+    // Older auditions make room with a fade
+    unsigned numActive = 0;
+    Voice *oldest = nullptr;
+    for (auto &v : m_voices)
+    {
+        if (v.state == PV_WAITING || v.state == PV_PLAYING)
+        {
+            numActive++;
+            if (oldest == nullptr || (int)(v.order - oldest->order) < 0)
+            {
+                oldest = &v;
+            }
+        }
+    }
+    if (numActive >= SAMPLER_NUM_PREVIEWS && oldest != nullptr)
+    {
+        FadeOut(*oldest);
+    }
+
+    Voice *voice = nullptr;
+    for (auto &v : m_voices)
+    {
+        if (v.state == PV_FREE)
+        {
+            voice = &v;
+            break;
+        }
+        // Only fading voices are left, the oldest one is cut
+        if (voice == nullptr || (int)(v.order - voice->order) < 0)
+        {
+            voice = &v;
+        }
+    }
+    if (voice->state != PV_FREE)
+    {
+        Release(*voice);
+    }
+
+    voice->sample = cmd.sample;
+    voice->pos = 0;
+    voice->gain = 0.0f;
+    voice->step = m_fadeInStep;
+    voice->order = m_order++;
+    voice->state = cmd.sync && running ? PV_WAITING : PV_PLAYING;
+}
+
+void mck::PreviewEngine::FadeOut(Voice &v)
+{
+    if (v.state == PV_WAITING)
+    {
+        Release(v);
+    }
+    else if (v.state == PV_PLAYING)
+    {
+        v.state = PV_STOPPING;
+        v.step = -m_fadeOutStep;
+    }
+}
+
+void mck::PreviewEngine::Release(Voice &v)
+{
+    v.state = PV_FREE;
+    // Last access, the GUI thread may free the buffer from here on
+    v.sample->users.fetch_sub(1, std::memory_order_release);
+    v.sample = nullptr;
+}
+
+void mck::PreviewEngine::Collect()
+{
+    m_samples.erase(std::remove_if(m_samples.begin(), m_samples.end(),
+                                   [](const std::shared_ptr<SampleBuffer> &s) {
+                                       return s->users.load(std::memory_order_acquire) == 0;
+                                   }),
+                    m_samples.end());
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include "Types.hpp"
+#include "SpscRing.hpp"
+
+namespace mck
+{
+    const unsigned SAMPLER_NUM_PREVIEWS = 4;        // Auditions heard at once, older ones fade out
+    const unsigned SAMPLER_PREVIEW_FADE_IN_MS = 1;  // Declick at the start, short enough to keep transients
+    const unsigned SAMPLER_PREVIEW_FADE_OUT_MS = 5; // Stopped and replaced auditions
+
+    // Sample explorer auditions, the GUI thread sends commands and never waits on the RT thread
+    class PreviewEngine
+    {
+    public:
+        PreviewEngine();
+        ~PreviewEngine();
+
+        bool Init(unsigned sampleRate);
+
+        // GUI thread: sync waits for the next beat while the transport is running
+        bool Play(std::shared_ptr<SampleBuffer> sample, bool sync);
+        // GUI thread: fades out all auditions
+        void Stop();
+
+        // RT thread: beatOffset is the frame a beat starts at in this cycle, -1 if none does
+        void Process(float *outLeft, float *outRight, unsigned nframes, bool running, int beatOffset);
+
+    private:
+        enum PreviewCommandType
+        {
+            PC_PLAY = 0,
+            PC_STOP,
+        };
+        struct Command
+        {
+            int type;
+            SampleBuffer *sample;
+            bool sync;
+            Command() : type(PC_PLAY), sample(nullptr), sync(false) {}
+        };
+
+        enum PreviewVoiceState
+        {
+            PV_FREE = 0,
+            PV_WAITING,
+            PV_PLAYING,
+            PV_STOPPING,
+        };
+        struct Voice
+        {
+            int state;
+            SampleBuffer *sample;
+            size_t pos;
+            float gain;
+            float step;
+            unsigned order;
+            Voice() : state(PV_FREE), sample(nullptr), pos(0), gain(0.0f), step(0.0f), order(0) {}
+        };
+
+        void StartVoice(const Command &cmd, bool running);
+        void FadeOut(Voice &v);
+        void Release(Voice &v);
+        // GUI thread: drops buffers the RT thread is done with
+        void Collect();
+
+        bool m_isInitialized;
+        float m_fadeInStep;
+        float m_fadeOutStep;
+        unsigned m_order;
+        SpscRing<Command, 64> m_commands;
+        // Twice the previews, so replaced auditions can fade out
+        std::vector<Voice> m_voices;
+        // Buffers handed to the RT thread, each command and voice holds one user
+        std::vector<std::shared_ptr<SampleBuffer>> m_samples;
+    };
+} // namespace mck
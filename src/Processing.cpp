@@ -3,9 +3,13 @@
 #include "helper/JackHelper.hpp"
 #include "helper/WaveHelper.hpp"
 #include "SampleExplorer.hpp"
+#include "MixKernel.hpp"
+#include "SampleAnalysis.hpp"
 
 // System
 #include <cstdio>
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <nlohmann/json.hpp>
 
@@ -33,30 +37,41 @@ static int JackProcess(jack_nframes_t nframes, void *arg)
 
 mck::Processing::Processing()
     : m_gui(nullptr),
+      m_guiConfig(),
+      m_guiSynced(false),
       m_isInitialized(false),
       m_done(false),
-      m_isProcessing(false),
-      m_config(),
-      m_curConfig(0),
-      m_newConfig(1),
-      m_updateConfig(false),
+      m_slots(),
+      m_rtSlot(0),
+      m_buildSlot(1),
+      m_latestSlot(0),
+      m_handover(2),
+      m_quantizeUpdate(false),
+      m_updateTick(-1.0),
       m_configFile(),
       m_configPath(""),
+      m_configExportPath(""),
       m_client(nullptr),
       m_midiIn(nullptr),
       m_midiOut(nullptr),
       m_audioOutL(nullptr),
       m_audioOutR(nullptr),
       m_bufferSize(0),
-      m_transportStep(-1),
-      m_transportRate(0),
       m_sampleRate(0),
+      m_stepScheduler(),
+      m_lookahead(),
+      m_sequencerTriggers(),
+      m_learnGroove(false),
+      m_grooveRing(),
+      m_grooveHits(),
+      m_grooveMutex(),
       m_numVoices(0),
       m_voiceIdx(0),
+      m_cycle(0),
+      m_loadStateChanged(false),
       m_triggerActive(false),
       m_samplePackPath(""),
-      m_sampleExplorer(nullptr),
-      m_samplePacks()
+      m_sampleExplorer(nullptr)
 {
 }
 
@@ -81,18 +96,28 @@ bool mck::Processing::Init()
     m_voiceIdx = 0;
 
     m_samples.resize(SAMPLER_NUM_PADS);
+    m_padSamples.resize(SAMPLER_NUM_PADS);
     m_voices.resize(m_numVoices);
 
     // 1 - Load Configuration
     std::string homeDir = ConfigFile::GetHomeDir();
     std::filesystem::path configPath(homeDir);
-    configPath.append(".mck").append("sampler").append("config.json");
+    configPath.append(".mck").append("sampler").append("config.mcks");
     m_configPath = configPath.string();
+    m_configExportPath = fs::path(configPath).replace_extension(".json").string();
     sampler::Config config;
-    if (m_configFile.ReadFile(m_configPath))
+    // The binary snapshot is the live config, the JSON export is imported when it is newer
+    bool importJson = fs::exists(m_configExportPath) &&
+                      (fs::exists(m_configPath) == false || fs::last_write_time(m_configExportPath) > fs::last_write_time(m_configPath));
+    if (importJson == false && m_configFile.ReadFile(m_configPath))
     {
         m_configFile.GetConfig(config);
     }
+    else if (m_configFile.ReadFile(m_configExportPath))
+    {
+        m_configFile.GetConfig(config);
+    }
+    m_configFile.Start(m_configPath, config.saveDelayMs);
 
     // 2 - Init JACK
     if ((m_client = jack_client_open("MckSampler", JackNullOption, NULL)) == 0)
@@ -115,15 +140,25 @@ bool mck::Processing::Init()
 
     m_bufferSize = jack_get_buffer_size(m_client);
     m_sampleRate = jack_get_sample_rate(m_client);
-    m_transportRate = m_sampleRate;
+    m_stepScheduler.Init(m_sampleRate);
+    m_lookahead.Init(m_sampleRate);
 
-    // 2B - Init FX
+    // 2B - Init FX, the slots share the first delay lines until a config replaces them
+    for (auto &slot : m_slots)
+    {
+        slot.samples.resize(SAMPLER_NUM_PADS, nullptr);
+        slot.delays.resize(SAMPLER_NUM_PADS);
+    }
+    for (unsigned i = 0; i < SAMPLER_NUM_PADS; i++)
+    {
+        std::array<q::delay *, 2> delay = {new q::delay(m_sampleRate), new q::delay(m_sampleRate)};
+        for (auto &slot : m_slots)
+        {
+            slot.delays[i] = delay;
+        }
+    }
     for (auto &sample : m_samples)
     {
-        sample.delay[0][0] = new q::delay(m_sampleRate);
-        sample.delay[0][1] = new q::delay(m_sampleRate);
-        sample.delay[1][0] = new q::delay(m_sampleRate);
-        sample.delay[1][1] = new q::delay(m_sampleRate);
         sample.env[0] = new q::fast_rms_envelope_follower(70_ms, m_sampleRate);
         sample.env[1] = new q::fast_rms_envelope_follower(70_ms, m_sampleRate);
         sample.comp[0] = new q::compressor(-10_dB, 0.5);
@@ -138,13 +173,40 @@ bool mck::Processing::Init()
     std::filesystem::path samplePackPath(homeDir);
     samplePackPath.append(".local").append("share").append("mck").append("sampler");
     m_samplePackPath = samplePackPath.string();
+    fs::path cachePath(homeDir);
+    cachePath.append(".cache").append("mck").append("sampler");
     m_sampleExplorer = new SampleExplorer();
-    if (m_sampleExplorer->Init(m_bufferSize, m_sampleRate, m_samplePackPath) == false)
+    if (m_sampleExplorer->Init(m_bufferSize, m_sampleRate, m_samplePackPath, (cachePath / "library.json").string()) == false)
     {
         std::fprintf(stderr, "Failed to init SampleExplorer!\n");
         return false;
     }
-    m_sampleExplorer->RefreshSamples(m_samplePacks);
+    m_sampleExplorer->RefreshSamples();
+
+    // 3B - Load Kit Bank
+    fs::path kitPath(homeDir);
+    kitPath.append(".mck").append("sampler").append("kits");
+    if (m_kitBank.Init(kitPath.string(), m_samplePackPath, cachePath.string(), m_sampleRate, SAMPLER_KIT_MEMORY_BUDGET) == false)
+    {
+        std::fprintf(stderr, "Failed to init KitBank!\n");
+        return false;
+    }
+    m_padLoads.resize(SAMPLER_NUM_PADS);
+    m_kitBank.SetUpgradeCallback([this](std::string path, std::shared_ptr<SampleBuffer> sample) {
+        m_upgradeQueue.enqueue(std::make_pair(path, sample));
+    });
+    if (m_sampleLoader.Init(&m_kitBank) == false)
+    {
+        std::fprintf(stderr, "Failed to init SampleLoader!\n");
+        return false;
+    }
+    m_streamBuffer[0].resize(m_bufferSize, 0.0f);
+    m_streamBuffer[1].resize(m_bufferSize, 0.0f);
+    if (m_streamer.Init() == false)
+    {
+        std::fprintf(stderr, "Failed to init SampleStreamer!\n");
+        return false;
+    }
 
     // 5 - Start JACK Processing
     err = jack_activate(m_client);
@@ -156,14 +218,16 @@ bool mck::Processing::Init()
 
     // 4 - Set Configuration
     SetConfiguration(config, true);
+    // Remaining kits are decoded in the background
+    m_kitBank.Preload(m_sampleLoader);
 
     // 5 - Initialized Transport
 
-    if (m_transport.Init(m_client, m_config[m_curConfig].tempo) == false)
+    if (m_transport.Init(m_client, LatestConfig().tempo) == false)
     {
         return false;
     }
-    m_transportThread = std::thread(&mck::Processing::TransportThread, this);
+    m_statusThread = std::thread(&mck::Processing::StatusThread, this);
 
     m_isInitialized = true;
     return true;
@@ -175,24 +239,30 @@ void mck::Processing::Close()
     if (m_client != nullptr)
     {
         // Save Connections
-        if (m_config[m_curConfig].reconnect)
+        sampler::Config &config = LatestConfig();
+        if (config.reconnect)
         {
-            jack::GetConnections(m_client, m_midiIn, m_config[m_curConfig].midiInConnections);
-            jack::GetConnections(m_client, m_midiOut, m_config[m_curConfig].midiOutConnections);
-            jack::GetConnections(m_client, m_audioOutL, m_config[m_curConfig].audioLeftConnections);
-            jack::GetConnections(m_client, m_audioOutR, m_config[m_curConfig].audioRightConnections);
+            jack::GetConnections(m_client, m_midiIn, config.midiInConnections);
+            jack::GetConnections(m_client, m_midiOut, config.midiOutConnections);
+            jack::GetConnections(m_client, m_audioOutL, config.audioLeftConnections);
+            jack::GetConnections(m_client, m_audioOutR, config.audioRightConnections);
         }
         jack_client_close(m_client);
     }
-
-    // Save File
-    m_configFile.SetConfig(m_config[m_curConfig]);
+    m_sampleLoader.Close();
+    m_streamer.Close();
+    m_lookahead.Close();
+
+    // Save File, flushes pending changes
+    m_configFile.SetConfig(LatestConfig());
+    m_configFile.Stop();
+    // Export JSON first, so the snapshot stays the newer file
+    m_configFile.WriteFile(m_configExportPath);
     m_configFile.WriteFile(m_configPath);
 
-    m_transportCond.notify_all();
-    if (m_transportThread.joinable())
+    if (m_statusThread.joinable())
     {
-        m_transportThread.join();
+        m_statusThread.join();
     }
 
     m_isInitialized = false;
@@ -235,11 +305,14 @@ void mck::Processing::ReceiveMessage(mck::Message &msg)
     {
         if (msg.msgType == "get")
         {
-            m_gui->SendMessage("data", "full", m_config[m_curConfig]);
+            std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+            SendConfiguration(LatestConfig(), true);
         }
         else if (msg.msgType == "patch")
         {
-            auto config = m_config[m_curConfig];
+            // Builds on a kit switch that still waits for its bar, the GUI already shows it
+            std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+            auto config = LatestConfig();
             try
             {
                 nlohmann::json j = config;
@@ -249,18 +322,62 @@ void mck::Processing::ReceiveMessage(mck::Message &msg)
             catch (std::exception &e)
             {
                 std::fprintf(stderr, "Failed to apply data patch: %s\n", e.what());
-                m_gui->SendMessage("data", "full", m_config[m_curConfig]);
+                SendConfiguration(LatestConfig(), true);
                 return;
             }
             SetConfiguration(config);
         }
     }
+    else if (msg.section == "sequencer")
+    {
+        if (msg.msgType == "learn")
+        {
+            try
+            {
+                LearnGroove(nlohmann::json::parse(msg.data).get<bool>());
+            }
+            catch (std::exception &e)
+            {
+                std::fprintf(stderr, "Failed to parse learn message: %s\n", e.what());
+                return;
+            }
+        }
+    }
+    else if (msg.section == "kits")
+    {
+        if (msg.msgType == "get")
+        {
+            std::vector<KitInfo> kits;
+            m_kitBank.GetKits(kits);
+            m_gui->SendMessage("kits", "list", kits);
+        }
+        else if (msg.msgType == "command")
+        {
+            KitCommand cmd;
+            try
+            {
+                cmd = nlohmann::json::parse(msg.data);
+            }
+            catch (std::exception &e)
+            {
+                std::fprintf(stderr, "Failed to parse kit command: %s\n", e.what());
+                return;
+            }
+            if (cmd.type == "select")
+            {
+                SelectKit(cmd.index);
+            }
+            else if (cmd.type == "save")
+            {
+                SaveKit(cmd.name);
+            }
+        }
+    }
     else if (msg.section == "samples")
     {
         if (msg.msgType == "get")
         {
-            m_sampleExplorer->RefreshSamples(m_samplePacks);
-            m_gui->SendMessage("samples", "packs", m_samplePacks);
+            m_gui->SendMessage("samples", "packs", m_sampleExplorer->RefreshSamples());
         }
         else if (msg.msgType == "command")
         {
@@ -281,7 +398,7 @@ void mck::Processing::ReceiveMessage(mck::Message &msg)
             }
             else if (cmd.type == "play")
             {
-                WaveInfoDetail info = m_sampleExplorer->PlaySample(cmd.packIdx, cmd.sampleIdx);
+                WaveInfoDetail info = m_sampleExplorer->PlaySample(cmd.packIdx, cmd.sampleIdx, cmd.sync);
                 m_gui->SendMessage("samples", "info", info);
             }
             else if (cmd.type == "stop")
@@ -292,6 +409,50 @@ void mck::Processing::ReceiveMessage(mck::Message &msg)
             {
                 AssignSample(cmd);
             }
+            else if (cmd.type == "slice")
+            {
+                SliceSample(cmd);
+            }
+            else if (cmd.type == "similar")
+            {
+                SimilarSamples similar;
+                m_sampleExplorer->FindSimilar(cmd.packIdx, cmd.sampleIdx, similar);
+                m_gui->SendMessage("samples", "similar", similar);
+            }
+        }
+        else if (msg.msgType == "peaks")
+        {
+            PeakRequest req;
+            try
+            {
+                req = nlohmann::json::parse(msg.data);
+            }
+            catch (std::exception &e)
+            {
+                std::fprintf(stderr, "Failed to parse peak request: %s\n", e.what());
+                return;
+            }
+            WavePeakRange range;
+            if (m_sampleExplorer->GetPeaks(req, range))
+            {
+                m_gui->SendMessage("samples", "peaks", range);
+            }
+        }
+        else if (msg.msgType == "search")
+        {
+            SearchQuery query;
+            try
+            {
+                query = nlohmann::json::parse(msg.data);
+            }
+            catch (std::exception &e)
+            {
+                std::fprintf(stderr, "Failed to parse search query: %s\n", e.what());
+                return;
+            }
+            SearchResult result;
+            m_sampleExplorer->Search(query, result);
+            m_gui->SendMessage("samples", "search", result);
         }
         else if (msg.msgType == "edit")
         {
@@ -306,8 +467,7 @@ void mck::Processing::ReceiveMessage(mck::Message &msg)
             }
             if (m_sampleExplorer->ApplyEditCommand(cmd, m_gui))
             {
-                m_sampleExplorer->RefreshSamples(m_samplePacks);
-                m_gui->SendMessage("samples", "packs", m_samplePacks);
+                m_gui->SendMessage("samples", "packs", m_sampleExplorer->RefreshSamples());
             }
         }
     }
@@ -325,29 +485,37 @@ int mck::Processing::ProcessAudioMidi(jack_nframes_t nframes)
         return 0;
     }
 
-    m_isProcessing = true;
-
-    if (m_updateConfig.load())
-    {
-        for (unsigned i = 0; i < m_samples.size(); i++)
-        {
-            m_samples[i].curDelay = m_samples[i].newDelay;
-        }
-        m_curConfig = m_newConfig;
-        m_updateConfig = false;
-    }
-
     TransportState ts;
     m_transport.Process(m_midiOut, nframes, ts);
 
-    int stepIdx = -1;
+    int transportTick = -1;
     if (ts.state == TS_RUNNING)
     {
-        stepIdx = ts.beat * 4;
-        stepIdx += (int)std::floor((double)ts.pulse / (double)ts.nPulses * 4.0);
-        stepIdx %= 16;
+        transportTick = ts.beat * SAMPLER_TICKS_PER_BEAT;
+        transportTick += (int)std::floor((double)ts.pulse / (double)ts.nPulses * SAMPLER_TICKS_PER_BEAT);
+        transportTick %= SAMPLER_TICKS_PER_BAR;
+    }
+    // Places the tick grid on the frames of this buffer
+    bool running = m_stepScheduler.Process(ts.state == TS_RUNNING, ts.tempo, transportTick, nframes);
+
+    // Kit switches are held back until the buffer with their bar while the transport is running,
+    // the lookahead switches the patterns on the same bar. A relocation applies them right away
+    bool applyUpdate = true;
+    double updateTick = m_updateTick.load();
+    if (m_quantizeUpdate.load() && running && updateTick >= 0.0 && m_stepScheduler.HasJumped() == false)
+    {
+        applyUpdate = m_stepScheduler.GetFrame(updateTick) < m_stepScheduler.GetBufferEnd();
     }
 
+    // Takes the latest slot over, before any voice is started in this cycle.
+    // Voices still playing a sample of the previous slot hold a reference
+    if (applyUpdate && (m_handover.load(std::memory_order_acquire) & SAMPLER_SLOT_FRESH))
+    {
+        m_rtSlot = m_handover.exchange(m_rtSlot, std::memory_order_acq_rel) & ~SAMPLER_SLOT_FRESH;
+        m_quantizeUpdate = false;
+    }
+    ConfigSlot &slot = m_slots[m_rtSlot];
+
     void *midi_buf = jack_port_get_buffer(m_midiIn, nframes);
 
     jack_nframes_t midiEventCount = jack_midi_get_event_count(midi_buf);
@@ -362,23 +530,23 @@ int mck::Processing::ProcessAudioMidi(jack_nframes_t nframes)
         sysMsg = (midiEvent.buffer[0] & 0xf0) == 0xf0;
         chan = (midiEvent.buffer[0] & 0x0f);
 
-        if (sysMsg == false && chan == m_config[m_curConfig].midiChan)
+        if (sysMsg == false && chan == slot.config.midiChan)
         {
             /*
             if (configMode == CONFIG_PADS)
             {
                 if ((midiEvent.buffer[0] & 0xf0) == 0x90)
                 {
-                    m_config[m_curConfig].pads[configIdx].tone = (midiEvent.buffer[1] & 0x7f);
-                    printf("Saved note %X for pad #%d.\n\n", m_config[m_curConfig].pads[configIdx].tone, configIdx + 1);
+                    slot.config.pads[configIdx].tone = (midiEvent.buffer[1] & 0x7f);
+                    printf("Saved note %X for pad #%d.\n\n", slot.config.pads[configIdx].tone, configIdx + 1);
                     configIdx += 1;
-                    if (configIdx >= m_config[m_curConfig].numPads)
+                    if (configIdx >= slot.config.numPads)
                     {
                         printf("Finished configuration, entering play mode...\n");
                         configMode = false;
                         break;
                     }
-                    printf("Please play note for pad #%d on MIDI channel %d:\n", configIdx + 1, m_config[m_curConfig].midiChan + 1);
+                    printf("Please play note for pad #%d on MIDI channel %d:\n", configIdx + 1, slot.config.midiChan + 1);
                     break;
                 }
             }
@@ -387,53 +555,52 @@ int mck::Processing::ProcessAudioMidi(jack_nframes_t nframes)
                 if ((midiEvent.buffer[0] & 0xf0) == 0xb0)
                 {
 
-                    if (configIdx > 0 && (midiEvent.buffer[1] & 0x7f) == m_config[m_curConfig].pads[configIdx - 1].ctrl)
+                    if (configIdx > 0 && (midiEvent.buffer[1] & 0x7f) == slot.config.pads[configIdx - 1].ctrl)
                     {
                         continue;
                     }
-                    m_config[m_curConfig].pads[configIdx].ctrl = (midiEvent.buffer[1] & 0x7f);
-                    printf("Saved control %X for pad #%d.\n\n", m_config[m_curConfig].pads[configIdx].ctrl, configIdx + 1);
+                    slot.config.pads[configIdx].ctrl = (midiEvent.buffer[1] & 0x7f);
+                    printf("Saved control %X for pad #%d.\n\n", slot.config.pads[configIdx].ctrl, configIdx + 1);
                     configIdx += 1;
-                    if (configIdx >= m_config[m_curConfig].numPads)
+                    if (configIdx >= slot.config.numPads)
                     {
                         printf("Finished configuration, entering play mode...\n");
                         configMode = CONFIG_NONE;
                         break;
                     }
-                    printf("Please turn the controller for pad #%d on MIDI channel %d:\n", configIdx + 1, m_config[m_curConfig].midiChan + 1);
+                    printf("Please turn the controller for pad #%d on MIDI channel %d:\n", configIdx + 1, slot.config.midiChan + 1);
                     break;
                 }
             }
             else
             {*/
-            if ((midiEvent.buffer[0] & 0xf0) == 0x90)
+            if ((midiEvent.buffer[0] & 0xf0) == 0xc0)
+            {
+                // Program Change selects a kit, prepared outside of the RT thread
+                m_programQueue.try_enqueue(midiEvent.buffer[1] & 0x7f);
+            }
+            else if ((midiEvent.buffer[0] & 0xf0) == 0x90)
             {
-                for (unsigned j = 0; j < m_config[m_curConfig].numPads; j++)
+                if (m_learnGroove.load() && running && (midiEvent.buffer[2] & 0x7f) > 0)
+                {
+                    m_grooveRing.Push({m_stepScheduler.GetTick(midiEvent.time), (double)(midiEvent.buffer[2] & 0x7f) / 127.0});
+                }
+                for (unsigned j = 0; j < slot.config.numPads; j++)
                 {
-                    if ((midiEvent.buffer[1] & 0x7f) == m_config[m_curConfig].pads[j].tone && m_config[m_curConfig].pads[j].available)
+                    if ((midiEvent.buffer[1] & 0x7f) == slot.config.pads[j].tone)
                     {
-                        m_voices[m_voiceIdx].playSample = true;
-                        m_voices[m_voiceIdx].padIdx = j;
-                        m_voices[m_voiceIdx].startIdx = midiEvent.time;
-                        m_voices[m_voiceIdx].bufferIdx = 0;
-                        m_voices[m_voiceIdx].bufferLen = m_config[m_curConfig].pads[j].lengthSamps;
-                        m_voices[m_voiceIdx].bufferIdx = m_config[m_curConfig].pads[j].reverse ? m_voices[m_voiceIdx].bufferLen - 1 : 0;
-                        m_voices[m_voiceIdx].gainL = ((float)(midiEvent.buffer[2] & 0x7f) / 127.0f) * m_config[m_curConfig].pads[j].gainLeftLin;
-                        m_voices[m_voiceIdx].gainR = ((float)(midiEvent.buffer[2] & 0x7f) / 127.0f) * m_config[m_curConfig].pads[j].gainRightLin;
-                        m_voices[m_voiceIdx].pitch = m_config[m_curConfig].pads[j].pitch;
-
-                        m_voiceIdx = (m_voiceIdx + 1) % m_numVoices;
+                        TriggerPad(j, midiEvent.time, (double)(midiEvent.buffer[2] & 0x7f) / 127.0);
                     }
                 }
             }
             else if ((midiEvent.buffer[0] & 0xf0) == 0xb0)
             {
-                for (unsigned j = 0; j < m_config[m_curConfig].numPads; j++)
+                for (unsigned j = 0; j < slot.config.numPads; j++)
                 {
-                    if ((midiEvent.buffer[1] & 0x7f) == m_config[m_curConfig].pads[j].ctrl)
+                    if ((midiEvent.buffer[1] & 0x7f) == slot.config.pads[j].ctrl)
                     {
-                        m_config[m_curConfig].pads[j].gain = (float)(midiEvent.buffer[2] & 0x7f) / 127.0f;
-                        //m_config[m_curConfig].pads[j].pitch = ((float)(midiEvent.buffer[2] & 0x7f) / 127.0f) * 1.5f + 0.5;
+                        slot.config.pads[j].gain = (float)(midiEvent.buffer[2] & 0x7f) / 127.0f;
+                        //slot.config.pads[j].pitch = ((float)(midiEvent.buffer[2] & 0x7f) / 127.0f) * 1.5f + 0.5;
                     }
                 }
             }
@@ -448,176 +615,67 @@ int mck::Processing::ProcessAudioMidi(jack_nframes_t nframes)
         unsigned idx = trigger.first;
         double strength = trigger.second;
 
-        if (idx < m_config[m_curConfig].numPads)
+        if (idx < slot.config.numPads)
         {
-            if (m_config[m_curConfig].pads[idx].available)
-            {
-                m_voices[m_voiceIdx].playSample = true;
-                m_voices[m_voiceIdx].padIdx = idx;
-                m_voices[m_voiceIdx].startIdx = 0;
-                m_voices[m_voiceIdx].bufferLen = m_config[m_curConfig].pads[idx].lengthSamps;
-                m_voices[m_voiceIdx].bufferIdx = m_config[m_curConfig].pads[idx].reverse ? m_voices[m_voiceIdx].bufferLen - 1 : 0;
-                m_voices[m_voiceIdx].gainL = m_config[m_curConfig].pads[idx].gainLeftLin * strength;
-                m_voices[m_voiceIdx].gainR = m_config[m_curConfig].pads[idx].gainRightLin * strength;
-                m_voices[m_voiceIdx].pitch = m_config[m_curConfig].pads[idx].pitch;
-
-                m_voiceIdx = (m_voiceIdx + 1) % m_numVoices;
-            }
+            TriggerPad(idx, 0, strength);
         }
     }
 
     // Transport TRIGGER
-    if (stepIdx >= 0 && stepIdx != m_transportStep)
+    int beatOffset = -1;
+    unsigned gridOffset = 0;
+    if (running && m_stepScheduler.FindGrid(SAMPLER_TICKS_PER_BEAT, gridOffset))
     {
-        unsigned padIdx = 0;
-        unsigned patternIdx = (unsigned)std::floor((double)stepIdx / 16.0);
-        for (auto &pad : m_config[m_curConfig].pads)
-        {
-            if (pad.available == false)
-            {
-                padIdx += 1;
-                continue;
-            }
-            if (pad.nPatterns == 0)
-            {
-                padIdx += 1;
-                continue;
-            }
-
-            unsigned curPatIdx = patternIdx % pad.nPatterns;
-            unsigned curStepIdx = stepIdx % pad.patterns[curPatIdx].nSteps;
-
-            if (pad.patterns[curPatIdx].steps[curStepIdx].active)
-            {
-                double strength = (double)pad.patterns[curPatIdx].steps[curStepIdx].velocity / 127.0;
-                m_voices[m_voiceIdx].playSample = true;
-                m_voices[m_voiceIdx].padIdx = padIdx;
-                m_voices[m_voiceIdx].startIdx = ts.pulseIdx % m_bufferSize;
-                m_voices[m_voiceIdx].bufferLen = pad.lengthSamps;
-                m_voices[m_voiceIdx].bufferIdx = pad.reverse ? m_voices[m_voiceIdx].bufferLen - 1 : 0;
-                m_voices[m_voiceIdx].gainL = pad.gainLeftLin * strength;
-                m_voices[m_voiceIdx].gainR = pad.gainRightLin * strength;
-                m_voices[m_voiceIdx].pitch = pad.pitch;
-
-                m_voiceIdx = (m_voiceIdx + 1) % m_numVoices;
-            }
-            padIdx += 1;
-        }
-        m_transportStep = stepIdx;
-        m_transportState = ts;
-        m_transportCond.notify_one();
-        m_transportRate += m_bufferSize;
+        beatOffset = gridOffset;
     }
-    else if (m_transportRate >= m_sampleRate || ts.state != m_transportState.state)
+    // Rendered ahead by the lookahead thread, only the triggers of this buffer are left
+    unsigned numTriggers = m_lookahead.Process(m_stepScheduler, running, m_sequencerTriggers.data(), m_sequencerTriggers.size());
+    for (unsigned i = 0; i < numTriggers; i++)
     {
-        m_transportState = ts;
-        m_transportCond.notify_one();
-        m_transportRate = 0;
-    }
-    else
-    {
-        m_transportRate += m_bufferSize;
+        auto &trigger = m_sequencerTriggers[i];
+        if (trigger.padIdx < slot.config.pads.size() && slot.config.pads[trigger.padIdx].available)
+        {
+            TriggerPad(trigger.padIdx, trigger.offset, trigger.strength);
+        }
     }
 
-    // Update Samples
+    // Clear pad buffers
     for (auto &s : m_samples)
     {
-        if (s.update)
-        {
-            s.update = false;
-            s.curSample = 1 - s.curSample;
-        }
-
         memset(s.dsp[0], 0, m_bufferSize * sizeof(float));
         memset(s.dsp[1], 0, m_bufferSize * sizeof(float));
     }
 
-    // Voices
-    unsigned len = 0;
+    // Voices play the buffer they were started on, even if the pad changed since
+    unsigned activeVoices = 0;
     for (auto &v : m_voices)
     {
         if (v.playSample == false)
         {
             continue;
         }
+        activeVoices += 1;
 
-        mck::WaveInfo &info = m_samples[v.padIdx].info[m_samples[v.padIdx].curSample];
-
-        if (info.valid == false)
+        if (v.sample == nullptr || v.sample->info.valid == false)
         {
             v.playSample = false;
-            continue;
         }
-
-        std::vector<std::vector<float>> &buffer = m_samples[v.padIdx].buffer[m_samples[v.padIdx].curSample];
-
-        if (m_config[m_curConfig].pads[v.padIdx].reverse)
+        else if (v.streamIdx >= 0)
         {
-            len = std::min(m_bufferSize, v.bufferIdx) - v.startIdx;
-
-            if (info.numChans > 1)
-            {
-                // Compensate Mono Panning Law
-                float gainL = std::min(1.0f, v.gainL * std::sqrt(2.0f));
-                float gainR = std::min(1.0f, v.gainR * std::sqrt(2.0f));
-                for (unsigned i = 0; i < len; i++)
-                {
-                    m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][v.bufferIdx - i] * gainL;
-                    m_samples[v.padIdx].dsp[1][i + v.startIdx] += buffer[1][v.bufferIdx - i] * gainR;
-                }
-            }
-            else
-            {
-                for (unsigned i = 0; i < len; i++)
-                {
-                    m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][v.bufferIdx - i] * v.gainL;
-                    m_samples[v.padIdx].dsp[1][i + v.startIdx] += buffer[0][v.bufferIdx - i] * v.gainR;
-                }
-            }
-            int newIdx = (int)v.bufferIdx - (int)len;
-            v.startIdx = 0;
-
-            if (newIdx <= 0)
-            {
-                // Stop Sample
-                v.bufferIdx = 0;
-                v.playSample = false;
-            } else {
-                v.bufferIdx = (unsigned)newIdx;
-            }
-
+            MixStreamVoice(v, *v.sample);
+        }
+        else if (v.sample->channels16.empty() == false)
+        {
+            MixCompactVoice(v, *v.sample);
         }
         else
         {
-            len = std::min(m_bufferSize, v.bufferLen - v.bufferIdx) - v.startIdx;
-
-            if (info.numChans > 1)
-            {
-                // Compensate Mono Panning Law
-                float gainL = std::min(1.0f, v.gainL * std::sqrt(2.0f));
-                float gainR = std::min(1.0f, v.gainR * std::sqrt(2.0f));
-                for (unsigned i = 0; i < len; i++)
-                {
-                    m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][v.bufferIdx + i] * gainL;
-                    m_samples[v.padIdx].dsp[1][i + v.startIdx] += buffer[1][v.bufferIdx + i] * gainR;
-                }
-            }
-            else
-            {
-                for (unsigned i = 0; i < len; i++)
-                {
-                    m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][v.bufferIdx + i] * v.gainL;
-                    m_samples[v.padIdx].dsp[1][i + v.startIdx] += buffer[0][v.bufferIdx + i] * v.gainR;
-                }
-            }
-            v.bufferIdx += len;
-            v.startIdx = 0;
+            MixVoice(v, *v.sample);
+        }
 
-            if (v.bufferIdx >= v.bufferLen)
-            {
-                // Stop Sample
-                v.playSample = false;
-            }
+        if (v.playSample == false)
+        {
+            StopVoice(v);
         }
     }
 
@@ -632,15 +690,16 @@ int mck::Processing::ProcessAudioMidi(jack_nframes_t nframes)
     q::decibel env_l(-60_dB);
     q::decibel env_r(-60_dB);
 
-    for (unsigned i = 0; i < m_samples.size(); i++)
+    for (unsigned i = 0; i < m_samples.size() && i < slot.config.pads.size(); i++)
     {
         auto &s = m_samples[i];
-        auto &p = m_config[m_curConfig].pads[i];
+        auto &p = slot.config.pads[i];
+        auto &delay = slot.delays[i];
 
         for (unsigned j = 0; j < nframes; j++)
         {
-            dly_l = (*s.delay[s.curDelay][0])();
-            dly_r = (*s.delay[s.curDelay][1])();
+            dly_l = (*delay[0])();
+            dly_r = (*delay[1])();
 
             if (p.delay.type == sampler::DLY_ANALOG)
             {
@@ -662,86 +721,563 @@ int mck::Processing::ProcessAudioMidi(jack_nframes_t nframes)
             out_r[j] += (s.dsp[1][j] + (dly_r * p.delay.gainLin)); // * p.gainRightLin));
 
             // Delay
-            s.delay[s.curDelay][0]->push(s.dsp[0][j] * (float)p.delay.active + p.delay.feedback * dly_l);
-            s.delay[s.curDelay][1]->push(s.dsp[1][j] * (float)p.delay.active + p.delay.feedback * dly_r);
+            delay[0]->push(s.dsp[0][j] * (float)p.delay.active + p.delay.feedback * dly_l);
+            delay[1]->push(s.dsp[1][j] * (float)p.delay.active + p.delay.feedback * dly_r);
         }
     }
 
-    m_sampleExplorer->ProcessAudio(out_l, out_r, nframes);
+    m_sampleExplorer->ProcessAudio(out_l, out_r, nframes, ts.state == TS_RUNNING, beatOffset);
+
+    // Status for the GUI, coalesced by the status thread
+    RealtimeStatus status;
+    status.transport = ts;
+    status.voices = activeVoices;
+    status.streams = m_streamer.GetActiveStreams();
+    status.underruns = m_streamer.GetUnderruns();
+    for (unsigned i = 0; i < nframes; i++)
+    {
+        status.peak[0] = std::max(status.peak[0], std::abs(out_l[i]));
+        status.peak[1] = std::max(status.peak[1], std::abs(out_r[i]));
+    }
+    m_statusRing.Push(status);
+    m_cycle.fetch_add(1, std::memory_order_release);
 
-    m_isProcessing = false;
-    m_processCond.notify_all();
     return 0;
 }
 
-void mck::Processing::TransportThread()
+void mck::Processing::StatusThread()
 {
-    std::unique_lock lock(m_transportMutex);
-    while (true)
+    auto period = std::chrono::microseconds(1000000 / SAMPLER_STATUS_RATE);
+    auto next = std::chrono::steady_clock::now();
+    RealtimeStatus lastStatus;
+    bool hasStatus = false;
+
+    while (m_done.load() == false)
     {
-        m_transportCond.wait(lock);
+        next += period;
+        std::this_thread::sleep_until(next);
 
-        if (m_done.load())
+        unsigned program = 0;
+        bool programChange = false;
+        while (m_programQueue.try_dequeue(program))
         {
-            return;
+            programChange = true;
         }
+        if (programChange)
+        {
+            SelectKit(program);
+        }
+
+        ApplyLoadedSamples();
+        CollectSamples();
+        SendImportProgress();
 
-        if (m_gui != nullptr)
+        GrooveHit hit;
+        while (m_grooveRing.Pop(hit))
         {
-            m_gui->SendMessage("transport", "realtime", m_transportState);
+            std::lock_guard<std::mutex> lock(m_grooveMutex);
+            m_grooveHits.push_back(hit);
+        }
+
+        // Coalesce everything the RT thread reported since the last frame
+        RealtimeStatus status;
+        RealtimeStatus tmp;
+        bool update = false;
+        while (m_statusRing.Pop(tmp))
+        {
+            status.transport = tmp.transport;
+            status.voices = tmp.voices;
+            status.streams = tmp.streams;
+            status.underruns += tmp.underruns;
+            status.peak[0] = std::max(status.peak[0], tmp.peak[0]);
+            status.peak[1] = std::max(status.peak[1], tmp.peak[1]);
+            update = true;
+        }
+        if (update == false)
+        {
+            continue;
+        }
+
+        // An idle engine only reports changes
+        bool changed = hasStatus == false ||
+                       status.transport.state == TS_RUNNING ||
+                       status.transport.state != lastStatus.transport.state ||
+                       status.transport.tempo != lastStatus.transport.tempo ||
+                       status.transport.jackTransport != lastStatus.transport.jackTransport ||
+                       status.voices > 0 || lastStatus.voices > 0 ||
+                       status.underruns > 0 ||
+                       status.peak[0] > 0.0f || status.peak[1] > 0.0f;
+        lastStatus = status;
+        hasStatus = true;
+
+        if (changed && m_gui != nullptr)
+        {
+            m_gui->SendMessage("status", "realtime", status);
         }
     }
 }
 
-bool mck::Processing::PrepareSamples()
+void mck::Processing::SendImportProgress()
 {
-    if (m_isInitialized)
+    // Failures are all reported, otherwise only the latest state of each batch
+    std::map<unsigned, ImportProgress> latest;
+    ImportProgress progress;
+    while (m_sampleExplorer->GetImportProgress(progress))
     {
-        return false;
+        if (progress.error != "" && m_gui != nullptr)
+        {
+            m_gui->SendMessage("samples", "import", progress);
+        }
+        latest[progress.batch] = progress;
     }
+    for (auto &p : latest)
+    {
+        if (p.second.error == "" && m_gui != nullptr)
+        {
+            m_gui->SendMessage("samples", "import", p.second);
+        }
+    }
+}
 
-    // Prepare Sound Files and Voices
-    m_numVoices = 4 * m_config[m_curConfig].numPads;
-    m_voiceIdx = 0;
+void mck::Processing::TriggerPad(unsigned padIdx, unsigned offset, double strength)
+{
+    auto &pad = m_slots[m_rtSlot].config.pads[padIdx];
+    SampleBuffer *sample = m_slots[m_rtSlot].samples[padIdx];
 
-    m_samples.resize(m_config[m_curConfig].numPads);
-    m_voices.resize(m_numVoices);
+    // Pads stay silent while their sample is still loading
+    if (pad.available == false || sample == nullptr || sample->info.valid == false || (sample->channels.empty() && sample->channels16.empty()))
+    {
+        return;
+    }
+    // Forward voices skip the leading silence, the length counts from there
+    unsigned start = pad.reverse ? 0 : std::min((size_t)pad.startSamps, sample->numFrames);
+    unsigned bufferLen = std::min((size_t)start + pad.lengthSamps, sample->numFrames);
+    if (bufferLen <= start)
+    {
+        return;
+    }
 
-    std::vector<std::vector<float>> tmpBuffer;
+    AudioVoice &v = m_voices[m_voiceIdx];
+    m_voiceIdx = (m_voiceIdx + 1) % m_numVoices;
+    if (v.playSample)
+    {
+        // Voice stealing
+        StopVoice(v);
+    }
 
-    for (unsigned i = 0; i < m_config[m_curConfig].numPads; i++)
+    // The voice keeps its buffer alive until it stops
+    sample->users.fetch_add(1, std::memory_order_relaxed);
+    v.sample = sample;
+    v.reverse = pad.reverse;
+
+    // Streamed samples only have their head and tail in RAM, forward voices play the head from
+    // there and reverse voices the tail, the stream continues behind them
+    if (bufferLen > sample->headFrames)
     {
-        fs::path samplePath(m_samplePackPath);
-        samplePath.append(m_config[m_curConfig].pads[i].samplePath);
-        if (fs::exists(samplePath) == false)
+        size_t tailStart = sample->numFrames - sample->tailFrames;
+        size_t streamStart = pad.reverse ? std::min((size_t)bufferLen, tailStart) - 1 : std::max((size_t)start, sample->headFrames);
+        size_t length = pad.reverse ? streamStart + 1 : bufferLen - streamStart;
+        v.streamIdx = m_streamer.Start(sample, streamStart, length, pad.reverse);
+        if (v.streamIdx < 0)
         {
-            m_config[m_curConfig].pads[i].available = false;
-            continue;
+            // All streams are busy, only the head is played
+            bufferLen = sample->headFrames;
+            if (bufferLen <= start)
+            {
+                sample->users.fetch_sub(1, std::memory_order_release);
+                v.sample = nullptr;
+                return;
+            }
         }
-        if (fs::is_regular_file(samplePath) == false)
+    }
+
+    v.playSample = true;
+    v.padIdx = padIdx;
+    v.startIdx = offset;
+    v.bufferLen = bufferLen;
+    v.bufferIdx = pad.reverse ? bufferLen - 1 : start;
+    v.gainL = pad.gainLeftLin * strength;
+    v.gainR = pad.gainRightLin * strength;
+    v.pitch = pad.pitch;
+}
+
+void mck::Processing::StopVoice(AudioVoice &v)
+{
+    v.playSample = false;
+    m_streamer.Release(v.streamIdx);
+    v.streamIdx = -1;
+    if (v.sample != nullptr)
+    {
+        // Lets the status thread reclaim a retired buffer
+        v.sample->users.fetch_sub(1, std::memory_order_release);
+        v.sample = nullptr;
+    }
+}
+
+void mck::Processing::CollectSamples()
+{
+    std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+
+    uint64_t cycle = m_cycle.load(std::memory_order_acquire);
+    for (auto it = m_retiredSamples.begin(); it != m_retiredSamples.end();)
+    {
+        SampleBuffer *sample = it->sample.get();
+        bool attached = false;
+        for (auto &slot : m_slots)
         {
-            m_config[m_curConfig].pads[i].available = false;
-            continue;
+            attached = attached || std::find(slot.samples.begin(), slot.samples.end(), sample) != slot.samples.end();
+        }
+
+        if (sample == nullptr)
+        {
+            it = m_retiredSamples.erase(it);
         }
-        char newSample = 1 - m_samples[i].curSample;
-        m_samples[i].info[newSample] = helper::ImportWaveFile(samplePath.string(), m_sampleRate, m_samples[i].buffer[newSample]);
-        if (m_samples[i].info[newSample].valid == false)
+        else if (attached)
+        {
+            it->cycle = 0;
+            it++;
+        }
+        else if (it->cycle == 0)
+        {
+            // A cycle running right now may still pick the buffer up
+            it->cycle = cycle + 2;
+            it++;
+        }
+        else if (cycle >= it->cycle && sample->users.load(std::memory_order_acquire) == 0)
+        {
+            // Freed here, unless a kit still holds it
+            it = m_retiredSamples.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    for (auto it = m_retiredDelays.begin(); it != m_retiredDelays.end();)
+    {
+        bool attached = false;
+        for (auto &slot : m_slots)
+        {
+            attached = attached || std::find(slot.delays.begin(), slot.delays.end(), it->delay) != slot.delays.end();
+        }
+
+        if (attached)
+        {
+            it->cycle = 0;
+            it++;
+        }
+        else if (it->cycle == 0)
+        {
+            it->cycle = cycle + 2;
+            it++;
+        }
+        else if (cycle >= it->cycle)
+        {
+            delete it->delay[0];
+            delete it->delay[1];
+            it = m_retiredDelays.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+
+void mck::Processing::MixVoice(AudioVoice &v, const SampleBuffer &sample)
+{
+    const mck::WaveInfo &info = sample.info;
+    const std::vector<const float *> &buffer = sample.channels;
+    unsigned len = 0;
+
+    if (v.reverse)
+    {
+        len = std::min(m_bufferSize - v.startIdx, v.bufferIdx);
+
+        if (info.numChans > 1)
+        {
+            // Compensate Mono Panning Law
+            float gainL = std::min(1.0f, v.gainL * std::sqrt(2.0f));
+            float gainR = std::min(1.0f, v.gainR * std::sqrt(2.0f));
+            for (unsigned i = 0; i < len; i++)
+            {
+                m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][v.bufferIdx - i] * gainL;
+                m_samples[v.padIdx].dsp[1][i + v.startIdx] += buffer[1][v.bufferIdx - i] * gainR;
+            }
+        }
+        else
+        {
+            for (unsigned i = 0; i < len; i++)
+            {
+                m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][v.bufferIdx - i] * v.gainL;
+                m_samples[v.padIdx].dsp[1][i + v.startIdx] += buffer[0][v.bufferIdx - i] * v.gainR;
+            }
+        }
+        int newIdx = (int)v.bufferIdx - (int)len;
+        v.startIdx = 0;
+
+        if (newIdx <= 0)
+        {
+            // Stop Sample
+            v.bufferIdx = 0;
+            v.playSample = false;
+        } else {
+            v.bufferIdx = (unsigned)newIdx;
+        }
+
+    }
+    else
+    {
+        len = std::min(m_bufferSize - v.startIdx, v.bufferLen - v.bufferIdx);
+
+        if (info.numChans > 1)
+        {
+            // Compensate Mono Panning Law
+            float gainL = std::min(1.0f, v.gainL * std::sqrt(2.0f));
+            float gainR = std::min(1.0f, v.gainR * std::sqrt(2.0f));
+            for (unsigned i = 0; i < len; i++)
+            {
+                m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][v.bufferIdx + i] * gainL;
+                m_samples[v.padIdx].dsp[1][i + v.startIdx] += buffer[1][v.bufferIdx + i] * gainR;
+            }
+        }
+        else
+        {
+            for (unsigned i = 0; i < len; i++)
+            {
+                m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][v.bufferIdx + i] * v.gainL;
+                m_samples[v.padIdx].dsp[1][i + v.startIdx] += buffer[0][v.bufferIdx + i] * v.gainR;
+            }
+        }
+        v.bufferIdx += len;
+        v.startIdx = 0;
+
+        if (v.bufferIdx >= v.bufferLen)
+        {
+            // Stop Sample
+            v.playSample = false;
+        }
+    }
+}
+
+void mck::Processing::MixStreamVoice(AudioVoice &v, const SampleBuffer &sample)
+{
+    bool reverse = v.reverse;
+    unsigned remaining = reverse ? v.bufferIdx : v.bufferLen - v.bufferIdx;
+    unsigned len = std::min(m_bufferSize - v.startIdx, remaining);
+    unsigned numChans = std::min((size_t)2, sample.channels.size());
+    float *buffer[2] = {m_streamBuffer[0].data(), m_streamBuffer[1].data()};
+
+    size_t tailStart = sample.numFrames - sample.tailFrames;
+    if (reverse && v.bufferIdx + 1 == v.bufferLen && v.bufferIdx < tailStart && m_streamer.IsReady(v.streamIdx) == false)
+    {
+        // A shortened reverse pad starts below the tail, it waits for the first read-ahead
+        v.startIdx = 0;
+        return;
+    }
+
+    // The head or tail is played from RAM, the stream continues behind it
+    unsigned done = 0;
+    if (reverse == false)
+    {
+        for (unsigned c = 0; c < numChans; c++)
+        {
+            for (unsigned i = 0; i < len && v.bufferIdx + i < sample.headFrames; i++)
+            {
+                buffer[c][i] = sample.channels[c][v.bufferIdx + i];
+            }
+        }
+        done = std::min((size_t)len, sample.headFrames - std::min(sample.headFrames, (size_t)v.bufferIdx));
+    }
+    else if (v.bufferIdx >= tailStart)
+    {
+        for (unsigned c = 0; c < numChans; c++)
+        {
+            for (unsigned i = 0; i < len && v.bufferIdx - i >= tailStart; i++)
+            {
+                buffer[c][i] = sample.tail[c][v.bufferIdx - i - tailStart];
+            }
+        }
+        done = std::min((size_t)len, v.bufferIdx - tailStart + 1);
+    }
+    done += m_streamer.Read(v.streamIdx, buffer, done, len - done);
+    for (unsigned c = 0; c < numChans; c++)
+    {
+        std::fill(buffer[c] + done, buffer[c] + len, 0.0f);
+    }
+
+    float gainL = v.gainL;
+    float gainR = v.gainR;
+    const float *right = buffer[0];
+    if (numChans > 1)
+    {
+        // Compensate Mono Panning Law
+        gainL = std::min(1.0f, v.gainL * std::sqrt(2.0f));
+        gainR = std::min(1.0f, v.gainR * std::sqrt(2.0f));
+        right = buffer[1];
+    }
+    for (unsigned i = 0; i < len; i++)
+    {
+        m_samples[v.padIdx].dsp[0][i + v.startIdx] += buffer[0][i] * gainL;
+        m_samples[v.padIdx].dsp[1][i + v.startIdx] += right[i] * gainR;
+    }
+    v.startIdx = 0;
+
+    bool stop = false;
+    if (reverse)
+    {
+        stop = v.bufferIdx <= len;
+        v.bufferIdx = stop ? 0 : v.bufferIdx - len;
+    }
+    else
+    {
+        v.bufferIdx += len;
+        stop = v.bufferIdx >= v.bufferLen;
+    }
+    if (stop)
+    {
+        // Stop Sample
+        v.playSample = false;
+    }
+}
+
+void mck::Processing::MixCompactVoice(AudioVoice &v, const SampleBuffer &sample)
+{
+    bool reverse = v.reverse;
+    unsigned remaining = reverse ? v.bufferIdx : v.bufferLen - v.bufferIdx;
+    unsigned len = std::min(m_bufferSize - v.startIdx, remaining);
+
+    float gainL = v.gainL;
+    float gainR = v.gainR;
+    const int16_t *left = sample.channels16[0] + v.bufferIdx;
+    const int16_t *right = left;
+    if (sample.channels16.size() > 1)
+    {
+        // Compensate Mono Panning Law
+        gainL = std::min(1.0f, v.gainL * std::sqrt(2.0f));
+        gainR = std::min(1.0f, v.gainR * std::sqrt(2.0f));
+        right = sample.channels16[1] + v.bufferIdx;
+    }
+
+    // The sample scale is folded into the gain, the kernels widen to float
+    float *dspL = m_samples[v.padIdx].dsp[0] + v.startIdx;
+    float *dspR = m_samples[v.padIdx].dsp[1] + v.startIdx;
+    if (reverse)
+    {
+        MixInt16Reverse(dspL, left, gainL * sample.scale, len);
+        MixInt16Reverse(dspR, right, gainR * sample.scale, len);
+    }
+    else
+    {
+        MixInt16(dspL, left, gainL * sample.scale, len);
+        MixInt16(dspR, right, gainR * sample.scale, len);
+    }
+    v.startIdx = 0;
+
+    if (reverse)
+    {
+        v.playSample = v.bufferIdx > len;
+        v.bufferIdx = v.playSample ? v.bufferIdx - len : 0;
+    }
+    else
+    {
+        v.bufferIdx += len;
+        v.playSample = v.bufferIdx < v.bufferLen;
+    }
+}
+
+void mck::Processing::LoadPadSample(unsigned padIdx, std::string path)
+{
+    PadLoad &load = m_padLoads[padIdx];
+    load.generation += 1;
+    load.state = PLS_LOADING;
+    load.path = path;
+    load.sample = nullptr;
+    m_loadStateChanged = true;
+
+    // Results of a replaced request are dropped by their generation
+    unsigned generation = load.generation;
+    m_sampleLoader.Load(path, [this, padIdx, generation](std::shared_ptr<SampleBuffer> sample) {
+        m_loadQueue.enqueue(LoadResult{padIdx, generation, sample});
+    });
+}
+
+void mck::Processing::ApplyLoadedSamples()
+{
+    std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+
+    bool update = false;
+    LoadResult result;
+    while (m_loadQueue.try_dequeue(result))
+    {
+        if (result.padIdx >= m_padLoads.size() || result.generation != m_padLoads[result.padIdx].generation)
         {
-            m_config[m_curConfig].pads[i].available = false;
             continue;
         }
-        m_config[m_curConfig].pads[i].available = true;
-        m_samples[i].update = true;
-        // init pitcher
-        //m_samples[i].pitcher = new RubberBand::RubberBandStretcher(sampleRate, m_samples[i].numChans, RubberBand::RubberBandStretcher::OptionProcessRealTime, 1.0, 1.0);
-        //m_samples[i].pitcher->setMaxProcessSize(bufferSize);
+        PadLoad &load = m_padLoads[result.padIdx];
+        load.state = result.sample != nullptr ? PLS_READY : PLS_FAILED;
+        load.sample = result.sample;
+        // The upgrade may have finished before the preview arrived here
+        auto cached = m_kitBank.GetCachedSample(load.path);
+        if (result.sample != nullptr && cached != nullptr)
+        {
+            load.sample = cached;
+        }
+        update = true;
     }
-    return true;
+    std::pair<std::string, std::shared_ptr<SampleBuffer>> upgrade;
+    while (m_upgradeQueue.try_dequeue(upgrade))
+    {
+        // Pads still playing the preview switch with the next config flip
+        for (auto &load : m_padLoads)
+        {
+            if (load.state == PLS_READY && load.path == upgrade.first)
+            {
+                load.sample = upgrade.second;
+                update = true;
+            }
+        }
+    }
+
+    if (update)
+    {
+        // Hands the new buffers to the RT thread with the next config flip
+        sampler::Config config = LatestConfig();
+        SetConfiguration(config);
+        m_loadStateChanged = true;
+    }
+    if (m_loadStateChanged)
+    {
+        SendLoadState();
+    }
+}
+
+void mck::Processing::SendLoadState()
+{
+    m_loadStateChanged = false;
+    if (m_gui == nullptr)
+    {
+        return;
+    }
+    std::vector<unsigned> states;
+    for (auto &load : m_padLoads)
+    {
+        states.push_back(load.state);
+    }
+    m_gui->SendMessage("samples", "loading", states);
+}
+
+mck::sampler::Config &mck::Processing::LatestConfig()
+{
+    return m_slots[m_latestSlot].config;
 }
 
 bool mck::Processing::AssignSample(SampleCommand cmd)
 {
-    sampler::Config config = m_config[m_curConfig];
+    std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+    sampler::Config config = LatestConfig();
     if (cmd.padIdx >= config.numPads)
     {
         return false;
@@ -754,74 +1290,217 @@ bool mck::Processing::AssignSample(SampleCommand cmd)
     }
     config.pads[cmd.padIdx].sampleName = m_sampleExplorer->GetSampleName(cmd.packIdx, cmd.sampleIdx);
 
+    // Analysed samples start at their onset with a loudness matched gain, otherwise from the top
+    SamplePackSample sample;
+    config.pads[cmd.padIdx].startMs = 0.0;
+    if (m_sampleExplorer->GetPackSample(cmd.packIdx, cmd.sampleIdx, sample) && sample.analysed)
+    {
+        config.pads[cmd.padIdx].startMs = sample.onsetMs;
+        config.pads[cmd.padIdx].gain = GetMatchedGain(sample);
+    }
+
+    SetConfiguration(config);
+
+    return true;
+}
+
+void mck::Processing::LearnGroove(bool start)
+{
+    if (start)
+    {
+        std::lock_guard<std::mutex> lock(m_grooveMutex);
+        m_grooveHits.clear();
+        m_learnGroove = true;
+        return;
+    }
+
+    m_learnGroove = false;
+    std::vector<GrooveHit> hits;
+    {
+        std::lock_guard<std::mutex> lock(m_grooveMutex);
+        hits.swap(m_grooveHits);
+    }
+
+    std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+    sampler::Config config = LatestConfig();
+    if (ExtractGroove(hits, config.groove) == false)
+    {
+        std::fprintf(stderr, "Not enough notes to learn a groove: %zu\n", hits.size());
+        return;
+    }
+    SetConfiguration(config);
+}
+
+bool mck::Processing::SliceSample(SampleCommand cmd)
+{
+    if (cmd.padIdx >= SAMPLER_NUM_PADS)
+    {
+        return false;
+    }
+
+    // Slicing reads the sample, the config is only locked afterwards
+    std::string samplePath = m_sampleExplorer->GetSamplePath(cmd.packIdx, cmd.sampleIdx);
+    std::string sampleName = m_sampleExplorer->GetSampleName(cmd.packIdx, cmd.sampleIdx);
+    std::vector<double> startsMs;
+    double lengthMs = 0.0;
+    if (samplePath == "" || m_sampleExplorer->SliceSample(cmd.packIdx, cmd.sampleIdx, SAMPLER_NUM_PADS - cmd.padIdx, startsMs, lengthMs) == false)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+    sampler::Config config = LatestConfig();
+    if (cmd.padIdx + startsMs.size() > config.pads.size())
+    {
+        return false;
+    }
+
+    // Pads with the same path share the decoded sample, a slice is only its start and length
+    for (unsigned i = 0; i < startsMs.size(); i++)
+    {
+        auto &pad = config.pads[cmd.padIdx + i];
+        double endMs = i + 1 < startsMs.size() ? startsMs[i + 1] : lengthMs;
+        pad.samplePath = samplePath;
+        pad.sampleName = sampleName + " " + std::to_string(i + 1);
+        pad.startMs = startsMs[i];
+        pad.lengthMs = (unsigned)std::ceil(endMs - startsMs[i]);
+        pad.reverse = false;
+    }
+
     SetConfiguration(config);
 
     return true;
 }
 
-void mck::Processing::SetConfiguration(sampler::Config &config, bool connect)
+void mck::Processing::SetConfiguration(sampler::Config &config, bool connect, Kit *kit)
 {
+    std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+
     if (config.pads.size() != SAMPLER_NUM_PADS)
     {
         config.pads.resize(SAMPLER_NUM_PADS);
     }
     config.numPads = config.pads.size();
+    // Compared against the last published config, the RT thread may still play an older one
+    const ConfigSlot &latest = m_slots[m_latestSlot];
     std::vector<bool> updateSamples;
     updateSamples.resize(config.numPads, false);
+    std::vector<std::shared_ptr<SampleBuffer>> newSamples;
+    newSamples.resize(config.numPads);
+
+    // Switching the sample storage reloads every pad
+    bool reloadSamples = config.compactSamples != m_kitBank.GetCompactStorage();
+    if (reloadSamples)
+    {
+        m_kitBank.SetCompactStorage(config.compactSamples);
+        for (auto &load : m_padLoads)
+        {
+            load.generation += 1;
+            load.state = PLS_EMPTY;
+            load.path = "";
+            load.sample = nullptr;
+        }
+        m_loadStateChanged = true;
+    }
+
     for (unsigned i = 0; i < config.numPads; i++)
     {
         config.pads[i].available = false;
 
-        fs::path samplePath(config.pads[i].samplePath);
-        if (samplePath.is_absolute() == false)
-        {
-            samplePath = fs::path(m_samplePackPath).append(config.pads[i].samplePath);
-        }
-        if (fs::exists(samplePath))
+        fs::path samplePath(m_kitBank.ResolvePath(config.pads[i].samplePath));
+        if (fs::is_regular_file(samplePath))
         {
             config.pads[i].available = true;
         }
         else
         {
+            if (m_padLoads[i].state != PLS_EMPTY)
+            {
+                // Drops a pending load of the previous sample
+                m_padLoads[i].generation += 1;
+                m_padLoads[i].state = PLS_EMPTY;
+                m_padLoads[i].path = "";
+                m_padLoads[i].sample = nullptr;
+                m_loadStateChanged = true;
+            }
             continue;
         }
 
-        bool updateWave = false;
-        if (m_config[m_curConfig].numPads < config.numPads)
+        bool updateWave = reloadSamples;
+        if (latest.config.numPads < config.numPads)
+        {
+            updateWave = true;
+        }
+        else if (config.pads[i].samplePath != latest.config.pads[i].samplePath)
+        {
+            updateWave = true;
+        }
+        else if (m_padSamples[i] == nullptr)
         {
             updateWave = true;
         }
-        else if (config.pads[i].samplePath != m_config[m_curConfig].pads[i].samplePath)
+        else if (kit != nullptr && i < kit->samples.size() && kit->samples[i] != m_padSamples[i])
         {
             updateWave = true;
         }
-        else if (config.pads[i].available == false)
+        else if (m_padLoads[i].state == PLS_READY && m_padLoads[i].path == samplePath.string() && m_padLoads[i].sample != nullptr && m_padLoads[i].sample != m_padSamples[i])
         {
             updateWave = true;
         }
 
         if (updateWave)
         {
-            char newSample = 1 - m_samples[i].curSample;
-            WaveInfo info = helper::ImportWaveFile(samplePath.string(), m_sampleRate, m_samples[i].buffer[newSample]);
-            if (info.valid)
+            // Resident kits bring their decoded samples along, everything else is decoded by the loader
+            std::shared_ptr<SampleBuffer> sample;
+            PadLoad &load = m_padLoads[i];
+            bool loading = false;
+            if (kit != nullptr && i < kit->samples.size() && kit->samples[i] != nullptr)
+            {
+                sample = kit->samples[i];
+            }
+            else if (load.path == samplePath.string() && (load.state == PLS_READY || load.state == PLS_FAILED))
+            {
+                sample = load.sample;
+            }
+            else if ((sample = m_kitBank.GetCachedSample(samplePath.string())) == nullptr)
+            {
+                if (load.state != PLS_LOADING || load.path != samplePath.string())
+                {
+                    LoadPadSample(i, samplePath.string());
+                }
+                loading = true;
+            }
+
+            if (sample != nullptr)
             {
                 config.pads[i].available = true;
-                config.pads[i].maxLengthMs = info.lengthMs;
-                m_samples[i].info[newSample] = info;
+                config.pads[i].maxLengthMs = sample->info.lengthMs;
+                newSamples[i] = sample;
                 updateSamples[i] = true;
+                if (load.path != samplePath.string())
+                {
+                    load.path = samplePath.string();
+                    load.state = PLS_READY;
+                    load.sample = sample;
+                    m_loadStateChanged = true;
+                }
             }
             else
             {
+                // Silence the pad until the new sample arrived, its length is only known then
                 config.pads[i].available = false;
+                config.pads[i].maxLengthMs = std::max(config.pads[i].maxLengthMs, config.pads[i].lengthMs);
+                updateSamples[i] = loading;
             }
         }
         else if (config.pads[i].available)
         {
-            config.pads[i].maxLengthMs = m_samples[i].info[m_samples[i].curSample].lengthMs;
+            config.pads[i].maxLengthMs = m_padSamples[i]->info.lengthMs;
         }
         config.pads[i].lengthMs = std::min(config.pads[i].lengthMs, config.pads[i].maxLengthMs);
         config.pads[i].lengthSamps = (unsigned)std::floor((double)config.pads[i].lengthMs * (double)m_sampleRate / 1000.0);
+        config.pads[i].startMs = std::max(0.0, config.pads[i].startMs);
+        config.pads[i].startSamps = (unsigned)std::floor(config.pads[i].startMs * (double)m_sampleRate / 1000.0);
 
         config.pads[i].gain = std::min(6.0, std::max(-200.0, config.pads[i].gain));
         config.pads[i].pan = std::min(100.0, std::max(-100.0, config.pads[i].pan));
@@ -836,38 +1515,33 @@ void mck::Processing::SetConfiguration(sampler::Config &config, bool connect)
         config.pads[i].comp.makeupLin = DbToLin(config.pads[i].comp.makeup);
     }
 
-    if (m_isProcessing.load())
-    {
-        // Wait
-        std::mutex mutex;
-        std::unique_lock<std::mutex> lock(mutex);
-        m_processCond.wait(lock);
-    }
-
+    // The build slot is neither read by the RT thread nor handed over, it starts from the latest one
+    ConfigSlot &build = m_slots[m_buildSlot];
+    build.samples = latest.samples;
+    build.delays = latest.delays;
     for (unsigned i = 0; i < config.numPads; i++)
     {
         if (updateSamples[i])
         {
-            m_samples[i].update = true;
+            build.samples[i] = newSamples[i].get();
+            m_retiredSamples.push_back(RetiredSample{m_padSamples[i], 0});
+            m_padSamples[i] = newSamples[i];
         }
 
-        bool updateDsp = (i >= m_config[m_curConfig].pads.size());
+        bool updateDsp = (i >= latest.config.pads.size());
 
-        if (updateDsp || (config.pads[i].delay.timeSamps != m_config[m_curConfig].pads[i].delay.timeSamps))
+        if (updateDsp || (config.pads[i].delay.timeSamps != latest.config.pads[i].delay.timeSamps))
         {
-            m_samples[i].newDelay = 1 - m_samples[i].curDelay;
-            delete m_samples[i].delay[m_samples[i].newDelay][0];
-            delete m_samples[i].delay[m_samples[i].newDelay][1];
-            m_samples[i].delay[m_samples[i].newDelay][0] = new q::delay(config.pads[i].delay.timeSamps);
-            m_samples[i].delay[m_samples[i].newDelay][1] = new q::delay(config.pads[i].delay.timeSamps);
+            m_retiredDelays.push_back(RetiredDelay{build.delays[i], 0});
+            build.delays[i] = {new q::delay(config.pads[i].delay.timeSamps), new q::delay(config.pads[i].delay.timeSamps)};
         }
         /*
-        if (updateDsp || (config.pads[i].comp.attackMs != m_config[m_curConfig].pads[i].comp.attackMs) || (config.pads[i].comp.releaseMs != m_config[m_curConfig].pads[i].comp.releaseMs))
+        if (updateDsp || (config.pads[i].comp.attackMs != latest.config.pads[i].comp.attackMs) || (config.pads[i].comp.releaseMs != latest.config.pads[i].comp.releaseMs))
         {
             m_samples[i].env[0]->hold(config.pads[i].comp.attackMs, m_sampleRate);
             m_samples[i].env[1]->threshold(config.pads[i].comp.releaseMs, m_sampleRate);
         }*/
-        if (updateDsp || (config.pads[i].comp.threshold != m_config[m_curConfig].pads[i].comp.threshold) || (config.pads[i].comp.ratio != m_config[m_curConfig].pads[i].comp.ratio))
+        if (updateDsp || (config.pads[i].comp.threshold != latest.config.pads[i].comp.threshold) || (config.pads[i].comp.ratio != latest.config.pads[i].comp.ratio))
         {
             m_samples[i].comp[0]->threshold(q::decibel(config.pads[i].comp.threshold, q::decibel::direct));
             m_samples[i].comp[0]->ratio(1.0f / config.pads[i].comp.ratio);
@@ -876,16 +1550,23 @@ void mck::Processing::SetConfiguration(sampler::Config &config, bool connect)
         }
     }
 
-    m_newConfig = 1 - m_curConfig;
-    m_config[m_newConfig] = config;
-    m_updateConfig = true;
+    SequencerTimeline timeline;
+    CompileTimeline(config, timeline);
+    m_lookahead.SetTimeline(timeline, m_quantizeUpdate.load() ? m_updateTick.load() : -1.0);
 
-    if (m_gui != nullptr)
+    build.config = config;
+    unsigned prevSlot = m_handover.exchange(m_buildSlot | SAMPLER_SLOT_FRESH, std::memory_order_acq_rel);
+    m_latestSlot = m_buildSlot;
+    // Either the slot the RT thread let go of or a newer one it never took
+    m_buildSlot = prevSlot & ~SAMPLER_SLOT_FRESH;
+
+    SendConfiguration(config);
+    // Persisted by the background thread of m_configFile
+    m_configFile.SetConfig(config);
+    if (m_loadStateChanged)
     {
-        m_gui->SendMessage("data", "full", config);
+        SendLoadState();
     }
-    m_configFile.SetConfig(config);
-    m_configFile.WriteFile(m_configPath);
 
     if (connect)
     {
@@ -910,4 +1591,77 @@ void mck::Processing::SetConfiguration(sampler::Config &config, bool connect)
             }
         }
     }
-}
\ No newline at end of file
+}
+
+void mck::Processing::SendConfiguration(const sampler::Config &config, bool full)
+{
+    if (m_gui == nullptr)
+    {
+        return;
+    }
+
+    // Only the difference to the last sent state is transferred, unless a resync is requested
+    if (full || m_guiSynced == false)
+    {
+        m_gui->SendMessage("data", "full", config);
+    }
+    else
+    {
+        nlohmann::json patch = nlohmann::json::array();
+        sampler::DiffConfig(m_guiConfig, config, patch);
+        if (patch.empty() == false)
+        {
+            m_gui->SendMessage("data", "patch", patch);
+        }
+    }
+    m_guiConfig = config;
+    m_guiSynced = true;
+}
+
+bool mck::Processing::SelectKit(unsigned idx)
+{
+    std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+
+    Kit *kit = m_kitBank.GetKit(idx);
+    if (kit == nullptr)
+    {
+        return false;
+    }
+
+    // Only the pads are part of a kit, MIDI and JACK settings stay with the session
+    sampler::Config config = LatestConfig();
+    config.pads = kit->config.pads;
+
+    // The bar goes first, the RT thread holds the update back as soon as it sees the flag
+    m_updateTick = m_lookahead.GetNextBar();
+    m_quantizeUpdate = true;
+    SetConfiguration(config, false, kit);
+    m_kitBank.SetActiveKit(idx);
+
+    if (m_gui != nullptr)
+    {
+        std::vector<KitInfo> kits;
+        m_kitBank.GetKits(kits);
+        m_gui->SendMessage("kits", "list", kits);
+    }
+    return true;
+}
+
+bool mck::Processing::SaveKit(std::string name)
+{
+    std::lock_guard<std::recursive_mutex> configLock(m_configMutex);
+
+    sampler::Config config = LatestConfig();
+    if (m_kitBank.SaveKit(name, config, m_padSamples) == false)
+    {
+        return false;
+    }
+
+    if (m_gui != nullptr)
+    {
+        std::vector<KitInfo> kits;
+        m_kitBank.GetKits(kits);
+        m_gui->SendMessage("kits", "list", kits);
+    }
+    return true;
+}
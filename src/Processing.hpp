@@ -1,7 +1,9 @@
 #pragma once
 
 #include <vector>
+#include <array>
 #include <deque>
+#include <map>
 #include <string>
 #include <thread>
 #include <atomic>
@@ -16,12 +18,22 @@
 #include "Types.hpp"
 #include "Config.hpp"
 #include "ConfigFile.hpp"
+#include "KitBank.hpp"
+#include "SampleLoader.hpp"
+#include "SampleStreamer.hpp"
+#include "SpscRing.hpp"
+#include "StepScheduler.hpp"
+#include "SequencerLookahead.hpp"
+#include "Groove.hpp"
 
 namespace mck
 {
 
     const unsigned SAMPLER_NUM_PADS = 16;
     const unsigned SAMPLER_VOICES_PER_PAD = 4;
+    const size_t SAMPLER_KIT_MEMORY_BUDGET = 512 * 1024 * 1024;
+    const unsigned SAMPLER_STATUS_RATE = 30; // GUI updates per second
+    const unsigned SAMPLER_SLOT_FRESH = 4;   // Flag of a config slot the RT thread did not take yet
 
     class SampleExplorer;
 
@@ -41,26 +53,59 @@ namespace mck
         void SetGuiPtr(GuiWindow *gui);
 
     private:
-        void TransportThread();
-        bool PrepareSamples();
+        void StatusThread();
+        void TriggerPad(unsigned padIdx, unsigned offset, double strength);
+        void MixStreamVoice(AudioVoice &v, const SampleBuffer &sample);
+        void MixCompactVoice(AudioVoice &v, const SampleBuffer &sample);
+        void MixVoice(AudioVoice &v, const SampleBuffer &sample);
+        void StopVoice(AudioVoice &v);
+        void CollectSamples();
+        void LoadPadSample(unsigned padIdx, std::string path);
+        void ApplyLoadedSamples();
+        void SendLoadState();
+        // Status thread: forwards import progress to the GUI
+        void SendImportProgress();
+        sampler::Config &LatestConfig();
         bool AssignSample(SampleCommand cmd);
-        void SetConfiguration(sampler::Config &config, bool connect = false);
+        // Spreads the onsets of a sample over the pads from padIdx on, every slice plays from the same buffer
+        bool SliceSample(SampleCommand cmd);
+        // Records the notes played from now on, stopping turns them into the groove of the config
+        void LearnGroove(bool start);
+        void SetConfiguration(sampler::Config &config, bool connect = false, Kit *kit = nullptr);
+        void SendConfiguration(const sampler::Config &config, bool full = false);
+        bool SelectKit(unsigned idx);
+        bool SaveKit(std::string name);
 
         // GUI Pointer
         GuiWindow *m_gui;
+        sampler::Config m_guiConfig; // Last state sent to the GUI
+        bool m_guiSynced;
 
         // INIT Members
         bool m_isInitialized;
         std::atomic<bool> m_done;
-        std::atomic<bool> m_isProcessing;
 
         // DATA Members
-        sampler::Config m_config[2];
-        char m_curConfig;
-        char m_newConfig;
-        std::atomic<bool> m_updateConfig;
+        // Everything the RT thread takes over at once when a config is applied
+        struct ConfigSlot
+        {
+            sampler::Config config;
+            std::vector<SampleBuffer *> samples; // Per pad, owned by m_padSamples or m_retiredSamples
+            std::vector<std::array<cycfi::q::delay *, 2>> delays;
+        };
+        // Triple buffer: the RT thread reads one slot, SetConfiguration builds in another
+        // and the third is handed over, so no slot is written while the RT thread may take it
+        ConfigSlot m_slots[3];
+        unsigned m_rtSlot;     // RT thread
+        unsigned m_buildSlot;  // Guarded by m_configMutex
+        unsigned m_latestSlot; // Guarded by m_configMutex, the last one published
+        std::atomic<unsigned> m_handover; // Slot index, SLOT_FRESH until the RT thread took it
+        std::atomic<bool> m_quantizeUpdate;
+        std::atomic<double> m_updateTick; // Bar of a quantised update, -1 for the next buffer
+        std::recursive_mutex m_configMutex;
         ConfigFile m_configFile;
         std::string m_configPath;
+        std::string m_configExportPath;
 
         // JACK Members
         jack_client_t *m_client;
@@ -73,12 +118,18 @@ namespace mck
 
         // Transport Members
         Transport m_transport;
-        TransportState m_transportState;
-        std::thread m_transportThread;
-        std::mutex m_transportMutex;
-        std::condition_variable m_transportCond;
-        int m_transportStep;
-        unsigned m_transportRate;
+        StepScheduler m_stepScheduler;
+        SequencerLookahead m_lookahead;
+        std::array<SequencerTrigger, SAMPLER_MAX_TRIGGERS> m_sequencerTriggers;
+        // Notes played while a groove is learned, gathered by the status thread
+        std::atomic<bool> m_learnGroove;
+        SpscRing<GrooveHit, 1024> m_grooveRing;
+        std::vector<GrooveHit> m_grooveHits;
+        std::mutex m_grooveMutex;
+
+        // Realtime Status
+        SpscRing<RealtimeStatus, 256> m_statusRing;
+        std::thread m_statusThread;
 
         // Wav Files
         //std::string m_samplePath;
@@ -87,6 +138,52 @@ namespace mck
         unsigned m_numVoices;
         unsigned m_voiceIdx;
 
+        // Disk Streaming of long samples
+        SampleStreamer m_streamer;
+        std::vector<float> m_streamBuffer[2];
+
+        // Kit Bank, owns the decoded samples referenced by m_samples
+        KitBank m_kitBank;
+        std::vector<std::shared_ptr<SampleBuffer>> m_padSamples;
+        // Replaced samples wait here until the RT thread let go of them
+        struct RetiredSample
+        {
+            std::shared_ptr<SampleBuffer> sample;
+            uint64_t cycle; // RT cycle after which the buffer is unreachable, 0 while attached
+        };
+        std::vector<RetiredSample> m_retiredSamples;
+        // Replaced delay lines, freed by the same rule
+        struct RetiredDelay
+        {
+            std::array<cycfi::q::delay *, 2> delay;
+            uint64_t cycle;
+        };
+        std::vector<RetiredDelay> m_retiredDelays;
+        std::atomic<uint64_t> m_cycle; // Completed RT cycles
+        moodycamel::ConcurrentQueue<unsigned> m_programQueue;
+
+        // Async Sample Loading, results are applied by the status thread
+        struct PadLoad
+        {
+            unsigned generation;
+            unsigned state; // PadLoadState
+            std::string path;
+            std::shared_ptr<SampleBuffer> sample;
+            PadLoad() : generation(0), state(PLS_EMPTY), path(""), sample(nullptr) {}
+        };
+        struct LoadResult
+        {
+            unsigned padIdx;
+            unsigned generation;
+            std::shared_ptr<SampleBuffer> sample;
+        };
+        SampleLoader m_sampleLoader;
+        std::vector<PadLoad> m_padLoads;
+        bool m_loadStateChanged;
+        moodycamel::ConcurrentQueue<LoadResult> m_loadQueue;
+        // Full quality replacements of preview conversions, by resolved path
+        moodycamel::ConcurrentQueue<std::pair<std::string, std::shared_ptr<SampleBuffer>>> m_upgradeQueue;
+
         // Pad Trigger
         std::deque<std::pair<unsigned, double>> m_trigger;
         std::mutex m_triggerMutex;
@@ -98,8 +195,5 @@ namespace mck
         // Sample Explorer
         std::string m_samplePackPath;
         SampleExplorer *m_sampleExplorer;
-        std::vector<SamplePack> m_samplePacks;
-
-        std::condition_variable m_processCond;
     };
 } // namespace mck
\ No newline at end of file
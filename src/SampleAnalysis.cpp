@@ -0,0 +1,411 @@
+#include "SampleAnalysis.hpp"
+#include "SampleFeatures.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <sndfile.h>
+
+namespace
+{
+    struct Biquad
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    // K weighting of ITU-R BS.1770 at any rate, derived from the analog prototype of its 48 kHz coefficients
+    void GetKWeighting(unsigned sampleRate, Biquad &shelf, Biquad &highPass)
+    {
+        double f0 = 1681.974450955533;
+        double Q = 0.7071752369554196;
+        double K = std::tan(M_PI * f0 / sampleRate);
+        double Vh = std::pow(10.0, 3.999843853973347 / 20.0);
+        double Vb = std::pow(Vh, 0.4996667741545416);
+        double a0 = 1.0 + K / Q + K * K;
+        shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+        shelf.b1 = 2.0 * (K * K - Vh) / a0;
+        shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+        shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+        shelf.a2 = (1.0 - K / Q + K * K) / a0;
+
+        f0 = 38.13547087602444;
+        Q = 0.5003270373238773;
+        K = std::tan(M_PI * f0 / sampleRate);
+        a0 = 1.0 + K / Q + K * K;
+        highPass.b0 = 1.0;
+        highPass.b1 = -2.0;
+        highPass.b2 = 1.0;
+        highPass.a1 = 2.0 * (K * K - 1.0) / a0;
+        highPass.a2 = (1.0 - K / Q + K * K) / a0;
+    }
+
+    double ToLoudness(double meanSquare)
+    {
+        return -0.691 + 10.0 * std::log10(std::max(meanSquare, 1e-20));
+    }
+
+    // Steps back from pos by the preroll and on to the last zero crossing of the first channel
+    size_t ToZeroCrossing(const float *data, size_t pos, unsigned sampleRate)
+    {
+        size_t preroll = (size_t)(mck::SAMPLER_ONSET_PREROLL_MS * sampleRate / 1000.0);
+        pos = pos > preroll ? pos - preroll : 0;
+        size_t minPos = pos > preroll ? pos - preroll : 0;
+        while (pos > minPos && data[pos] != 0.0f && (data[pos - 1] > 0.0f) == (data[pos] > 0.0f))
+        {
+            pos--;
+        }
+        return pos;
+    }
+} // namespace
+
+bool mck::AnalyseSample(const std::vector<const float *> &channels, size_t numFrames, unsigned sampleRate, SamplePackSample &sample)
+{
+    sample.analysed = false;
+    if (channels.empty() || numFrames == 0 || sampleRate == 0)
+    {
+        return false;
+    }
+
+    // Peak, a plain max reduction per channel
+    float peak = 0.0f;
+    for (auto ch : channels)
+    {
+        float chPeak = 0.0f;
+        for (size_t i = 0; i < numFrames; i++)
+        {
+            chPeak = std::max(chPeak, std::abs(ch[i]));
+        }
+        peak = std::max(peak, chPeak);
+    }
+    if (peak <= 0.0f)
+    {
+        return false;
+    }
+
+    // Onset, the first frame any channel gets loud enough
+    float threshold = peak * (float)std::pow(10.0, SAMPLER_ONSET_THRESHOLD_DB / 20.0);
+    size_t onset = numFrames;
+    for (auto ch : channels)
+    {
+        for (size_t i = 0; i < std::min(onset, numFrames); i++)
+        {
+            if (std::abs(ch[i]) >= threshold)
+            {
+                onset = i;
+                break;
+            }
+        }
+    }
+    // The preroll keeps the rise of the transient, a zero crossing before it avoids a click
+    onset = ToZeroCrossing(channels[0], onset, sampleRate);
+
+    // Integrated loudness: 400 ms blocks, 75 % overlap, absolute and relative gate
+    Biquad shelf;
+    Biquad highPass;
+    GetKWeighting(sampleRate, shelf, highPass);
+    size_t step = std::max((size_t)1, (size_t)sampleRate / 10);
+    size_t numSteps = (numFrames + step - 1) / step;
+    // Squared K weighted signal per 100 ms, summed over the channels
+    std::vector<double> energy(numSteps, 0.0);
+    for (auto ch : channels)
+    {
+        double s1 = 0.0, s2 = 0.0, h1 = 0.0, h2 = 0.0;
+        for (size_t i = 0; i < numFrames; i++)
+        {
+            // Transposed direct form II
+            double x = ch[i];
+            double y = shelf.b0 * x + s1;
+            s1 = shelf.b1 * x - shelf.a1 * y + s2;
+            s2 = shelf.b2 * x - shelf.a2 * y;
+            double z = highPass.b0 * y + h1;
+            h1 = highPass.b1 * y - highPass.a1 * z + h2;
+            h2 = highPass.b2 * y - highPass.a2 * z;
+            energy[i / step] += z * z;
+        }
+    }
+
+    // One shots shorter than a block count as a single one
+    std::vector<double> blocks;
+    if (numSteps < 4)
+    {
+        double sum = 0.0;
+        for (auto e : energy)
+        {
+            sum += e;
+        }
+        blocks.push_back(sum / numFrames);
+    }
+    else
+    {
+        for (size_t b = 0; b + 4 <= numSteps; b++)
+        {
+            size_t len = std::min(numFrames, (b + 4) * step) - b * step;
+            blocks.push_back((energy[b] + energy[b + 1] + energy[b + 2] + energy[b + 3]) / len);
+        }
+    }
+
+    double sum = 0.0;
+    unsigned count = 0;
+    for (auto z : blocks)
+    {
+        if (ToLoudness(z) > -70.0)
+        {
+            sum += z;
+            count++;
+        }
+    }
+    double loudness = -70.0;
+    if (count > 0)
+    {
+        double relGate = ToLoudness(sum / count) - 10.0;
+        double gatedSum = 0.0;
+        unsigned gatedCount = 0;
+        for (auto z : blocks)
+        {
+            double l = ToLoudness(z);
+            if (l > -70.0 && l > relGate)
+            {
+                gatedSum += z;
+                gatedCount++;
+            }
+        }
+        loudness = ToLoudness(gatedSum / gatedCount);
+    }
+
+    sample.onsetMs = onset * 1000.0 / sampleRate;
+    sample.peakDb = 20.0 * std::log10(peak);
+    sample.loudness = loudness;
+    sample.analysed = true;
+    return true;
+}
+
+bool mck::AnalyseSample(std::string path, SamplePackSample &sample)
+{
+    sample.analysed = false;
+    SF_INFO info;
+    std::memset(&info, 0, sizeof(SF_INFO));
+    SNDFILE *file = sf_open(path.c_str(), SFM_READ, &info);
+    if (file == nullptr)
+    {
+        return false;
+    }
+    if (info.frames <= 0 || info.channels <= 0 || info.samplerate <= 0)
+    {
+        sf_close(file);
+        return false;
+    }
+
+    std::vector<float> in(info.frames * info.channels);
+    sf_count_t numFrames = sf_readf_float(file, in.data(), info.frames);
+    sf_close(file);
+    if (numFrames <= 0)
+    {
+        return false;
+    }
+
+    // Loudness weights the front channels only, like the mixer plays them
+    unsigned numChans = std::min(2, info.channels);
+    std::vector<std::vector<float>> buffer(numChans, std::vector<float>(numFrames));
+    std::vector<const float *> channels(numChans);
+    for (unsigned c = 0; c < numChans; c++)
+    {
+        for (sf_count_t i = 0; i < numFrames; i++)
+        {
+            buffer[c][i] = in[i * info.channels + c];
+        }
+        channels[c] = buffer[c].data();
+    }
+    return AnalyseSample(channels, numFrames, info.samplerate, sample);
+}
+
+bool mck::DetectOnsets(const std::vector<const float *> &channels, size_t numFrames, unsigned sampleRate, unsigned maxOnsets, std::vector<size_t> &onsets)
+{
+    onsets.clear();
+    if (channels.empty() || numFrames == 0 || sampleRate == 0 || maxOnsets == 0)
+    {
+        return false;
+    }
+
+    const unsigned n = SAMPLER_SLICE_FFT_SIZE;
+    const unsigned hop = SAMPLER_SLICE_HOP;
+    const unsigned numBins = n / 2 + 1;
+    Fft fft(n);
+    std::vector<float> window(n);
+    for (unsigned i = 0; i < n; i++)
+    {
+        window[i] = 0.5f - 0.5f * std::cos(2.0 * M_PI * i / n);
+    }
+    std::vector<float> re(n);
+    std::vector<float> im(n);
+    std::vector<float> mag[2] = {std::vector<float>(numBins), std::vector<float>(numBins)};
+    std::vector<float> lastMag(numBins, 0.0f);
+
+    // Windowed mono frame f, centered on frame f * hop of the sample
+    size_t numHops = numFrames / hop + 1;
+    auto fillFrame = [&](size_t f, float *out) {
+        std::fill(out, out + n, 0.0f);
+        if (f >= numHops)
+        {
+            return;
+        }
+        long offset = (long)(f * hop) - (long)(n / 2);
+        unsigned begin = offset < 0 ? -offset : 0;
+        unsigned end = (unsigned)std::min((long)n, (long)numFrames - offset);
+        for (auto ch : channels)
+        {
+            const float *in = ch + offset;
+            for (unsigned i = begin; i < end; i++)
+            {
+                out[i] += in[i];
+            }
+        }
+        for (unsigned i = 0; i < n; i++)
+        {
+            out[i] *= window[i];
+        }
+    };
+
+    // Flux: summed rise of the log magnitudes. Two real frames share one complex transform
+    std::vector<float> flux(numHops);
+    for (size_t f = 0; f < numHops; f += 2)
+    {
+        fillFrame(f, re.data());
+        fillFrame(f + 1, im.data());
+        fft.Forward(re.data(), im.data());
+
+        // Z[k] = X[k] + i Y[k], both halves are recovered from Z[k] and Z[n - k]
+        for (unsigned k = 0; k < numBins; k++)
+        {
+            unsigned nk = (n - k) & (n - 1);
+            float sr = re[k] + re[nk];
+            float di = im[k] - im[nk];
+            float si = im[k] + im[nk];
+            float dr = re[k] - re[nk];
+            mag[0][k] = std::log(1.0f + 50.0f * std::sqrt(sr * sr + di * di));
+            mag[1][k] = std::log(1.0f + 50.0f * std::sqrt(si * si + dr * dr));
+        }
+        for (unsigned h = 0; h < 2 && f + h < numHops; h++)
+        {
+            float sum = 0.0f;
+            for (unsigned k = 0; k < numBins; k++)
+            {
+                sum += std::max(0.0f, mag[h][k] - lastMag[k]);
+            }
+            flux[f + h] = sum;
+            lastMag.swap(mag[h]);
+        }
+    }
+
+    // Peaks above the local mean, spaced at least the minimum slice apart
+    double meanFlux = 0.0;
+    for (auto v : flux)
+    {
+        meanFlux += v;
+    }
+    meanFlux /= numHops;
+    if (meanFlux <= 0.0)
+    {
+        return false;
+    }
+    const long range = 8;
+    long minDist = std::max(1l, (long)(SAMPLER_SLICE_MIN_MS * sampleRate / 1000.0 / hop));
+    std::vector<std::pair<float, size_t>> peaks;
+    for (long f = 0; f < (long)numHops; f++)
+    {
+        float localSum = 0.0f;
+        bool isMax = true;
+        for (long g = std::max(0l, f - range); g <= std::min((long)numHops - 1, f + range); g++)
+        {
+            localSum += flux[g];
+            isMax = isMax && (flux[g] < flux[f] || (flux[g] == flux[f] && g >= f));
+        }
+        float localMean = localSum / (std::min((long)numHops - 1, f + range) - std::max(0l, f - range) + 1);
+        float strength = flux[f] - localMean;
+        if (isMax && strength > SAMPLER_SLICE_THRESHOLD * meanFlux)
+        {
+            peaks.push_back({strength, f});
+        }
+    }
+    std::sort(peaks.begin(), peaks.end(), [](const std::pair<float, size_t> &a, const std::pair<float, size_t> &b) {
+        return a.first > b.first;
+    });
+    std::vector<size_t> frames;
+    for (auto &p : peaks)
+    {
+        if (frames.size() >= maxOnsets)
+        {
+            break;
+        }
+        bool free = std::none_of(frames.begin(), frames.end(), [&p, minDist](size_t f) {
+            return std::abs((long)f - (long)p.second) < minDist;
+        });
+        if (free)
+        {
+            frames.push_back(p.second);
+        }
+    }
+    std::sort(frames.begin(), frames.end());
+
+    // The transient is the steepest rise of a 1 ms envelope around the flux peak
+    size_t block = std::max(1u, sampleRate / 1000);
+    for (auto f : frames)
+    {
+        size_t start = f * hop > n / 2 ? f * hop - n / 2 : 0;
+        size_t end = std::min(numFrames, f * hop + n / 2);
+        float lastEnv = 0.0f;
+        float maxRise = -1.0f;
+        float base = 0.0f;
+        size_t onset = start;
+        for (size_t b = start; b < end; b += block)
+        {
+            float env = 0.0f;
+            for (auto ch : channels)
+            {
+                for (size_t i = b; i < std::min(end, b + block); i++)
+                {
+                    env = std::max(env, std::abs(ch[i]));
+                }
+            }
+            if (b > start && env - lastEnv > maxRise)
+            {
+                maxRise = env - lastEnv;
+                base = lastEnv;
+                onset = b;
+            }
+            lastEnv = env;
+        }
+        // First frame of the rising block that clearly leaves the level before it
+        float threshold = base + 0.25f * maxRise;
+        for (size_t i = onset; i < std::min(end, onset + block); i++)
+        {
+            bool above = false;
+            for (auto ch : channels)
+            {
+                above = above || std::abs(ch[i]) > threshold;
+            }
+            if (above)
+            {
+                onset = i;
+                break;
+            }
+        }
+        onset = ToZeroCrossing(channels[0], onset, sampleRate);
+        if (onsets.empty() || onset > onsets.back())
+        {
+            onsets.push_back(onset);
+        }
+    }
+    return onsets.empty() == false;
+}
+
+double mck::GetMatchedGain(const SamplePackSample &sample)
+{
+    if (sample.analysed == false)
+    {
+        return 0.0;
+    }
+    double gain = SAMPLER_TARGET_LOUDNESS - sample.loudness;
+    gain = std::min(gain, SAMPLER_MAX_MATCH_GAIN);
+    // Never pushes the peak above full scale
+    gain = std::min(gain, -sample.peakDb);
+    return std::max(-60.0, gain);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+
+namespace mck
+{
+    const double SAMPLER_ONSET_THRESHOLD_DB = -48.0; // Below the peak, quieter starts count as silence
+    const double SAMPLER_ONSET_PREROLL_MS = 1.0;     // Kept before the onset, back to the last zero crossing
+    const double SAMPLER_TARGET_LOUDNESS = -18.0;    // LUFS, default pad gains aim for it
+    const double SAMPLER_MAX_MATCH_GAIN = 6.0;       // dB, quiet samples are not lifted beyond this
+    const unsigned SAMPLER_SLICE_FFT_SIZE = 1024;
+    const unsigned SAMPLER_SLICE_HOP = 512;
+    const double SAMPLER_SLICE_MIN_MS = 50.0;   // Closer onsets are one hit
+    const double SAMPLER_SLICE_THRESHOLD = 1.5; // Flux above its local mean, in units of the mean flux of the sample
+
+    // Onset, sample peak and integrated loudness (ITU-R BS.1770) of a sample,
+    // channels are non interleaved. Returns false for silent or empty audio
+    bool AnalyseSample(const std::vector<const float *> &channels, size_t numFrames, unsigned sampleRate, SamplePackSample &sample);
+    // Decodes the file at its own rate
+    bool AnalyseSample(std::string path, SamplePackSample &sample);
+    // Onsets by spectral flux, the strongest maxOnsets in frames and in order. Each one
+    // sits on a zero crossing shortly before its transient
+    bool DetectOnsets(const std::vector<const float *> &channels, size_t numFrames, unsigned sampleRate, unsigned maxOnsets, std::vector<size_t> &onsets);
+    // Gain in dB that brings the sample to the target loudness without clipping
+    double GetMatchedGain(const SamplePackSample &sample);
+} // namespace mck
@@ -0,0 +1,224 @@
+#include "SampleCache.hpp"
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+mck::SampleCache::SampleCache()
+    : m_isInitialized(false),
+      m_cachePath("")
+{
+}
+
+mck::SampleCache::~SampleCache()
+{
+}
+
+bool mck::SampleCache::Init(std::string cachePath)
+{
+    if (m_isInitialized)
+    {
+        return false;
+    }
+
+    std::error_code ec;
+    if (fs::exists(cachePath) == false && fs::create_directories(cachePath, ec) == false)
+    {
+        std::fprintf(stderr, "Unable to create sample cache %s\n", cachePath.c_str());
+        return false;
+    }
+
+    m_cachePath = cachePath;
+    m_isInitialized = true;
+    return true;
+}
+
+std::shared_ptr<mck::SampleBuffer> mck::SampleCache::Load(std::string path, unsigned sampleRate, int quality, size_t streamThreshold, size_t headFrames)
+{
+    Header key;
+    if (m_isInitialized == false || GetKey(path, sampleRate, quality, key) == false)
+    {
+        return nullptr;
+    }
+
+    int fd = open(GetEntryPath(path, key).c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    Header header;
+    std::string storedPath(path.size(), '\0');
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        pread(fd, &header, sizeof(Header), 0) != sizeof(Header) ||
+        std::memcmp(header.magic, key.magic, sizeof(key.magic)) != 0 ||
+        header.version != key.version ||
+        header.fileSize != key.fileSize ||
+        header.mtime != key.mtime ||
+        header.sampleRate != key.sampleRate ||
+        header.quality != key.quality ||
+        header.pathLength != key.pathLength ||
+        header.numChans == 0 ||
+        header.dataOffset < sizeof(Header) + header.pathLength ||
+        header.dataOffset % sizeof(float) != 0 ||
+        header.dataOffset + header.numChans * header.numFrames * sizeof(float) > (size_t)st.st_size ||
+        pread(fd, &storedPath[0], path.size(), sizeof(Header)) != (ssize_t)path.size() ||
+        storedPath != path)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    auto sample = std::make_shared<SampleBuffer>();
+    sample->info.valid = true;
+    sample->info.numChans = header.numChans;
+    sample->info.lengthMs = header.lengthMs;
+    sample->quality = quality;
+
+    size_t dataSize = header.numChans * header.numFrames * sizeof(float);
+    if (streamThreshold > 0 && dataSize > streamThreshold)
+    {
+        // Only the head and the tail are kept in RAM, the rest is read ahead while playing
+        size_t head = std::min((size_t)header.numFrames, headFrames);
+        sample->buffer.resize(header.numChans);
+        sample->tail.resize(header.numChans);
+        for (unsigned c = 0; c < header.numChans; c++)
+        {
+            sample->buffer[c].resize(head);
+            sample->tail[c].resize(head);
+            off_t pos = header.dataOffset + (off_t)c * header.numFrames * sizeof(float);
+            off_t tailPos = pos + (off_t)(header.numFrames - head) * sizeof(float);
+            if (pread(fd, sample->buffer[c].data(), head * sizeof(float), pos) != (ssize_t)(head * sizeof(float)) ||
+                pread(fd, sample->tail[c].data(), head * sizeof(float), tailPos) != (ssize_t)(head * sizeof(float)))
+            {
+                close(fd);
+                return nullptr;
+            }
+        }
+        sample->Update();
+        sample->tailFrames = head;
+        sample->numFrames = header.numFrames;
+        sample->fd = fd;
+        sample->dataOffset = header.dataOffset;
+        return sample;
+    }
+
+    // Pages are populated now, so the RT thread never faults on them
+    size_t size = st.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    // Failing is fine, the pages were populated already
+    mlock(mapping, size);
+
+    sample->mapping = mapping;
+    sample->mappingSize = size;
+    sample->numFrames = header.numFrames;
+    sample->headFrames = header.numFrames;
+    for (unsigned c = 0; c < header.numChans; c++)
+    {
+        sample->channels.push_back((const float *)((const char *)mapping + header.dataOffset) + c * header.numFrames);
+    }
+    return sample;
+}
+
+bool mck::SampleCache::Store(std::string path, unsigned sampleRate, int quality, const SampleBuffer &sample)
+{
+    Header header;
+    if (m_isInitialized == false || sample.info.valid == false || GetKey(path, sampleRate, quality, header) == false)
+    {
+        return false;
+    }
+    header.numChans = sample.channels.size();
+    header.lengthMs = sample.info.lengthMs;
+    header.numFrames = sample.numFrames;
+
+    std::string entryPath = GetEntryPath(path, header);
+    // Loader threads may store the same sample at once, each writes its own temp file
+    std::string tmpPath = entryPath + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    FILE *file = std::fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    std::string padding(header.dataOffset - sizeof(Header) - path.size(), '\0');
+    bool ok = std::fwrite(&header, sizeof(Header), 1, file) == 1;
+    ok = ok && std::fwrite(path.data(), 1, path.size(), file) == path.size();
+    ok = ok && std::fwrite(padding.data(), 1, padding.size(), file) == padding.size();
+    for (unsigned c = 0; c < header.numChans && ok; c++)
+    {
+        ok = std::fwrite(sample.channels[c], sizeof(float), header.numFrames, file) == header.numFrames;
+    }
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (ok == false || std::rename(tmpPath.c_str(), entryPath.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        std::fprintf(stderr, "Failed to write sample cache entry for %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool mck::SampleCache::GetKey(std::string path, unsigned sampleRate, int quality, Header &key)
+{
+    std::error_code ec;
+    uintmax_t fileSize = fs::file_size(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    std::memset(&key, 0, sizeof(Header));
+    std::memcpy(key.magic, SAMPLE_CACHE_MAGIC, sizeof(key.magic));
+    key.version = SAMPLE_CACHE_VERSION;
+    key.fileSize = fileSize;
+    key.mtime = mtime.time_since_epoch().count();
+    key.sampleRate = sampleRate;
+    key.quality = quality;
+    key.pathLength = path.size();
+    // PCM starts cache line aligned behind the header and the source path
+    key.dataOffset = (sizeof(Header) + path.size() + 63) & ~63;
+    return true;
+}
+
+std::string mck::SampleCache::GetEntryPath(const std::string &path, const Header &key)
+{
+    // FNV-1a over the source path and the key fields
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *data, size_t size) {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= ((const unsigned char *)data)[i];
+            hash *= 1099511628211ull;
+        }
+    };
+    add(path.data(), path.size());
+    add(&key.fileSize, sizeof(key.fileSize));
+    add(&key.mtime, sizeof(key.mtime));
+    add(&key.sampleRate, sizeof(key.sampleRate));
+    add(&key.quality, sizeof(key.quality));
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.mckpcm", (unsigned long long)hash);
+    return (fs::path(m_cachePath) / name).string();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include "Types.hpp"
+
+namespace mck
+{
+    const char SAMPLE_CACHE_MAGIC[4] = {'M', 'C', 'K', 'P'};
+    const unsigned SAMPLE_CACHE_VERSION = 1;
+
+    // On-disk cache of decoded and resampled PCM, entries are mapped without parsing
+    class SampleCache
+    {
+    public:
+        SampleCache();
+        ~SampleCache();
+
+        bool Init(std::string cachePath);
+
+        // Entries are keyed by path, file size, mtime, target rate and converter quality,
+        // entries larger than streamThreshold are opened for streaming with headFrames in RAM
+        std::shared_ptr<SampleBuffer> Load(std::string path, unsigned sampleRate, int quality, size_t streamThreshold = 0, size_t headFrames = 0);
+        bool Store(std::string path, unsigned sampleRate, int quality, const SampleBuffer &sample);
+
+    private:
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t fileSize;
+            int64_t mtime;
+            uint32_t sampleRate;
+            int32_t quality;
+            uint32_t numChans;
+            uint32_t lengthMs;
+            uint64_t numFrames;
+            uint32_t pathLength;
+            uint32_t dataOffset;
+        };
+
+        bool GetKey(std::string path, unsigned sampleRate, int quality, Header &key);
+        std::string GetEntryPath(const std::string &path, const Header &key);
+
+        bool m_isInitialized;
+        std::string m_cachePath;
+    };
+} // namespace mck
@@ -1,11 +1,13 @@
 #include "SampleExplorer.hpp"
 #include "gui/GuiWindow.hpp"
+#include "SampleAnalysis.hpp"
 #include <filesystem>
 #include <nlohmann/json.hpp>
 #include <cstdio>
 #include <fstream>
 #include <algorithm>
-#include <regex>
+#include <cstring>
+#include <cmath>
 #include <sndfile.h>
 #include <samplerate.h>
 
@@ -16,17 +18,58 @@ mck::SampleExplorer::SampleExplorer()
       m_bufferSize(0),
       m_sampleRate(0),
       m_samplePath(""),
-      m_packs(),
-      m_packPaths(),
-      m_curWave(0)
+      m_library(),
+      m_packs(m_library.GetPacks()),
+      m_packPaths(m_library.GetPackPaths()),
+      m_packsChanged(false),
+      m_preview(),
+      m_importer(),
+      m_importIndex(),
+      m_cache(),
+      m_cacheOrder(),
+      m_cacheSize(0),
+      m_prefetchDone(false),
+      m_prefetchJobs(),
+      m_peakDone(false),
+      m_peakJobs(),
+      m_peaks(),
+      m_peakOrder(),
+      m_newFeatures(),
+      m_extractor(),
+      m_search(),
+      m_searchDirty(true),
+      m_featureIndex(),
+      m_featureSamples(),
+      m_featureIndexDirty(true)
 {
 }
 
 mck::SampleExplorer::~SampleExplorer()
 {
+    m_importer.Close();
+    {
+        std::lock_guard<std::mutex> lock(m_peakMutex);
+        m_peakDone = true;
+        m_peakJobs.clear();
+    }
+    m_peakCond.notify_all();
+    if (m_peakThread.joinable())
+    {
+        m_peakThread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        m_prefetchDone = true;
+        m_prefetchJobs.clear();
+    }
+    m_prefetchCond.notify_all();
+    if (m_prefetchThread.joinable())
+    {
+        m_prefetchThread.join();
+    }
 }
 
-bool mck::SampleExplorer::Init(unsigned bufferSize, unsigned sampleRate, std::string samplePath)
+bool mck::SampleExplorer::Init(unsigned bufferSize, unsigned sampleRate, std::string samplePath, std::string indexPath)
 {
     if (m_isInitialized)
     {
@@ -51,78 +94,70 @@ bool mck::SampleExplorer::Init(unsigned bufferSize, unsigned sampleRate, std::st
     }
     m_samplePath = sp.string();
 
-    // Malloc buffers etc...
+    if (m_library.Init(m_samplePath, indexPath) == false)
+    {
+        return false;
+    }
+    m_packsChanged = true;
+
+    if (m_preview.Init(sampleRate) == false)
+    {
+        return false;
+    }
+    if (m_importer.Init() == false)
+    {
+        return false;
+    }
+    m_peakThread = std::thread(&mck::SampleExplorer::PeakThread, this);
+    m_prefetchThread = std::thread(&mck::SampleExplorer::PrefetchThread, this);
 
     m_isInitialized = true;
     return true;
 }
 
-void mck::SampleExplorer::RefreshSamples(std::vector<SamplePack> &packs)
+const std::vector<mck::SamplePack> &mck::SampleExplorer::RefreshSamples()
 {
     if (m_isInitialized == false)
     {
-        packs.clear();
-        return;
+        return m_packs;
     }
 
-    fs::path sp(m_samplePath);
-    std::vector<std::pair<SamplePack, std::string>> tmpPacks;
+    ApplyImports();
+    ApplyFeatures();
 
-    for (auto &dp : fs::directory_iterator(sp))
+    // Only packs touched since the last refresh are parsed again
+    if (m_library.Update() == false && m_packsChanged == false)
     {
-        if (dp.is_directory())
+        return m_packs;
+    }
+    m_packsChanged = false;
+    m_featureIndexDirty = true;
+    m_searchDirty = true;
+
+    // Queue the changed packs, the thread skips samples with an up to date peak file
+    auto &changed = m_library.GetChangedPacks();
+    {
+        std::lock_guard<std::mutex> lock(m_peakMutex);
+        for (unsigned p = 0; p < m_packs.size(); p++)
         {
-            for (auto &cfp : fs::directory_iterator(dp.path()))
+            if (changed.find(m_packPaths[p]) == changed.end())
             {
-                if (cfp.is_regular_file() && cfp.path().has_extension())
-                {
-                    if (cfp.path().extension() == ".mcksp")
-                    {
-                        std::pair<SamplePack, std::string> pack;
-                        std::ifstream spFile(cfp.path());
-                        nlohmann::json j;
-                        spFile >> j;
-                        spFile.close();
-                        try
-                        {
-                            pack.first = j.get<SamplePack>();
-                        }
-                        catch (std::exception &e)
-                        {
-                            std::printf("File %s is malformed: %s\n", cfp.path().c_str(), e.what());
-                            continue;
-                        }
-                        if (dp.path().is_absolute())
-                        {
-                            pack.second = dp.path();
-                        }
-                        else
-                        {
-                            pack.second = fs::absolute(dp.path());
-                        }
-
-                        tmpPacks.push_back(pack);
-                    }
-                }
+                continue;
+            }
+            for (unsigned s = 0; s < m_packs[p].samples.size(); s++)
+            {
+                fs::path sndPath(m_packPaths[p]);
+                sndPath.append(m_packs[p].samples[s].path);
+                PeakJob job;
+                job.path = sndPath.string();
+                job.peakPath = GetPeakPath(p, s);
+                job.features = m_library.HasFeatures(job.path) == false;
+                m_peakJobs.push_back(job);
             }
         }
     }
-    // Sort by name
-    std::sort(tmpPacks.begin(), tmpPacks.end(),
-              [](const std::pair<SamplePack, std::string> &a, const std::pair<SamplePack, std::string> &b) -> bool {
-                  return a.first.name < b.first.name;
-              });
-
-    m_packPaths.resize(tmpPacks.size());
-    m_packs.resize(tmpPacks.size());
-    for (unsigned i = 0; i < tmpPacks.size(); i++)
-    {
-        m_packs[i] = tmpPacks[i].first;
-        m_packPaths[i] = tmpPacks[i].second;
-    }
-
-    packs = m_packs;
-    return;
+    m_peakCond.notify_one();
+    return m_packs;
 }
 
 mck::WaveInfoDetail mck::SampleExplorer::LoadSample(unsigned packIdx, unsigned sampleIdx)
@@ -155,72 +190,182 @@ mck::WaveInfoDetail mck::SampleExplorer::LoadSample(unsigned packIdx, unsigned s
         return info;
     }
 
-    info = helper::ImportWaveForm(sndPath.string(), m_sampleRate, m_waveBuffer[1 - m_curWave]);
-    info.path = sndPath.string();
-    info.relPath = relPath.string();
-    info.name = m_packs[packIdx].samples[sampleIdx].name;
-    info.packIdx = packIdx;
-    info.sampleIdx = sampleIdx;
+    SF_INFO sfInfo;
+    std::memset(&sfInfo, 0, sizeof(SF_INFO));
+    SNDFILE *file = sf_open(sndPath.c_str(), SFM_READ, &sfInfo);
+    if (file == nullptr)
+    {
+        return info;
+    }
+    sf_close(file);
+    if (sfInfo.samplerate <= 0 || sfInfo.channels <= 0)
+    {
+        return info;
+    }
+
+    // Lengths at the engine rate, as the decoded sample has them
+    info.valid = true;
+    info.numChans = std::min(2, sfInfo.channels);
+    info.lengthSamps = (unsigned)((double)sfInfo.frames * (double)m_sampleRate / (double)sfInfo.samplerate);
+    info.lengthMs = (unsigned)((double)sfInfo.frames * 1000.0 / (double)sfInfo.samplerate);
 
-    m_waveInfo[1 - m_curWave] = info;
+    // The next click is likely a neighbour
+    Prefetch(packIdx, sampleIdx);
     return info;
 }
 
-mck::WaveInfoDetail mck::SampleExplorer::PlaySample(unsigned packIdx, unsigned sampleIdx)
+
+std::shared_ptr<mck::SampleBuffer> mck::SampleExplorer::DecodeSample(unsigned packIdx, unsigned sampleIdx, WaveInfoDetail &info)
 {
-    WaveInfoDetail ret;
-    if (m_isInitialized == false)
+    if (packIdx >= m_packs.size() || sampleIdx >= m_packs[packIdx].samples.size())
     {
-        return ret;
+        info.valid = false;
+        return nullptr;
     }
+    fs::path sndPath(m_packPaths[packIdx]);
+    sndPath.append(m_packs[packIdx].samples[sampleIdx].path);
 
-    StopSample();
+    // A miss decodes right away, the decoder reads the header itself. Prefetching is up to the
+    // callers, this runs on the GUI thread
+    auto sample = GetCachedSample(sndPath.string(), info);
+    if (sample == nullptr)
+    {
+        sample = ReadSample(sndPath.string(), info);
+        if (sample != nullptr)
+        {
+            sample = CacheSample(sndPath.string(), info, sample);
+        }
+    }
+    // Cached by path, the indices may have moved since
+    info.name = m_packs[packIdx].samples[sampleIdx].name;
+    info.packIdx = packIdx;
+    info.sampleIdx = sampleIdx;
+    return sample;
+}
 
-    char newWave = 1 - m_curWave;
+std::shared_ptr<mck::SampleBuffer> mck::SampleExplorer::ReadSample(std::string path, WaveInfoDetail &info)
+{
+    auto sample = std::make_shared<SampleBuffer>();
+    info = helper::ImportWaveForm(path, m_sampleRate, sample->buffer);
+    info.path = path;
+    info.relPath = fs::relative(fs::path(path), fs::path(m_samplePath)).string();
+    // The GUI draws peaks instead
+    info.waveForm.clear();
+    if (info.valid == false)
+    {
+        return nullptr;
+    }
+    sample->info.valid = true;
+    sample->info.numChans = info.numChans;
+    sample->info.lengthMs = info.lengthMs;
+    sample->Update();
+    return sample;
+}
 
-    if (packIdx != m_waveInfo[newWave].packIdx || sampleIdx != m_waveInfo[newWave].sampleIdx || m_waveInfo[newWave].valid == false)
+std::shared_ptr<mck::SampleBuffer> mck::SampleExplorer::GetCachedSample(std::string path, WaveInfoDetail &info)
+{
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    auto it = m_cache.find(path);
+    if (it == m_cache.end())
     {
-        m_waveInfo[newWave] = LoadSample(packIdx, sampleIdx);
+        return nullptr;
     }
+    m_cacheOrder.splice(m_cacheOrder.begin(), m_cacheOrder, it->second.order);
+    info = it->second.info;
+    return it->second.sample;
+}
 
-    ret = m_waveInfo[newWave];
+std::shared_ptr<mck::SampleBuffer> mck::SampleExplorer::CacheSample(std::string path, const WaveInfoDetail &info, std::shared_ptr<SampleBuffer> sample)
+{
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    auto it = m_cache.find(path);
+    if (it != m_cache.end())
+    {
+        return it->second.sample;
+    }
 
-    if (ret.valid == false)
+    m_cacheOrder.push_front(path);
+    m_cache[path] = {info, sample, m_cacheOrder.begin()};
+    m_cacheSize += sample->GetMemSize();
+    // Auditions still playing keep their buffer through the preview engine
+    while (m_cacheSize > SAMPLER_PREVIEW_CACHE_BYTES && m_cacheOrder.size() > 1)
     {
-        return ret;
+        auto last = m_cache.find(m_cacheOrder.back());
+        m_cacheSize -= last->second.sample->GetMemSize();
+        m_cache.erase(last);
+        m_cacheOrder.pop_back();
     }
+    return sample;
+}
 
-    PlayState state;
-    state.active = true;
-    state.stop = false;
-    state.idx = 0;
-    state.len = m_waveInfo[newWave].lengthSamps;
+void mck::SampleExplorer::Prefetch(unsigned packIdx, unsigned sampleIdx)
+{
+    if (packIdx >= m_packs.size() || sampleIdx >= m_packs[packIdx].samples.size())
+    {
+        return;
+    }
 
-    if (m_isProcessing.load())
+    // Samples of the category in the order the GUI lists them
+    const auto &samples = m_packs[packIdx].samples;
+    std::vector<unsigned> category;
+    int pos = 0;
+    for (unsigned i = 0; i < samples.size(); i++)
     {
-        std::mutex tmpMutex;
-        std::unique_lock lock(tmpMutex);
-        m_processCond.wait(lock);
+        if (samples[i].type == samples[sampleIdx].type)
+        {
+            if (i == sampleIdx)
+            {
+                pos = category.size();
+            }
+            category.push_back(i);
+        }
     }
 
-    m_state = state;
-    m_curWave = newWave;
+    // Nearest first, a new selection replaces what is still queued
+    std::deque<std::string> jobs;
+    for (int d = 1; d <= (int)SAMPLER_PREFETCH_RANGE; d++)
+    {
+        for (int idx : {pos + d, pos - d})
+        {
+            if (idx >= 0 && idx < (int)category.size())
+            {
+                fs::path sndPath(m_packPaths[packIdx]);
+                sndPath.append(samples[category[idx]].path);
+                jobs.push_back(sndPath.string());
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        m_prefetchJobs = jobs;
+    }
+    m_prefetchCond.notify_one();
+}
+
+mck::WaveInfoDetail mck::SampleExplorer::PlaySample(unsigned packIdx, unsigned sampleIdx, bool sync)
+{
+    WaveInfoDetail ret;
+    if (m_isInitialized == false)
+    {
+        return ret;
+    }
 
+    auto sample = DecodeSample(packIdx, sampleIdx, ret);
+    if (sample != nullptr)
+    {
+        m_preview.Play(sample, sync);
+        Prefetch(packIdx, sampleIdx);
+    }
     return ret;
 }
+
 void mck::SampleExplorer::StopSample()
 {
     if (m_isInitialized == false)
     {
         return;
     }
-    if (m_isProcessing.load())
-    {
-        std::mutex tmpMutex;
-        std::unique_lock lock(tmpMutex);
-        m_processCond.wait(lock);
-    }
-    m_state.stop = true;
+    m_preview.Stop();
 }
 
 mck::WaveInfoDetail mck::SampleExplorer::GetSample(unsigned packIdx, unsigned sampleIdx, std::vector<std::vector<float>> &buffer)
@@ -231,19 +376,12 @@ mck::WaveInfoDetail mck::SampleExplorer::GetSample(unsigned packIdx, unsigned sa
         return ret;
     }
 
-    char newWave = 1 - m_curWave;
-
-    if (packIdx != m_waveInfo[m_curWave].packIdx || sampleIdx != m_waveInfo[m_curWave].sampleIdx || m_waveInfo[m_curWave].valid == false)
+    auto sample = DecodeSample(packIdx, sampleIdx, ret);
+    if (sample != nullptr)
     {
-        m_waveInfo[newWave] = LoadSample(packIdx, sampleIdx);
-        buffer = m_waveBuffer[newWave];
-        return m_waveInfo[newWave];
-    }
-    else
-    {
-        buffer = m_waveBuffer[m_curWave];
-        return m_waveInfo[m_curWave];
+        buffer = sample->buffer;
     }
+    return ret;
 }
 
 std::string mck::SampleExplorer::GetSamplePath(unsigned packIdx, unsigned sampleIdx, bool relativePath)
@@ -287,6 +425,61 @@ std::string mck::SampleExplorer::GetSampleName(unsigned packIdx, unsigned sample
     return m_packs[packIdx].samples[sampleIdx].name;
 }
 
+bool mck::SampleExplorer::GetPackSample(unsigned packIdx, unsigned sampleIdx, SamplePackSample &sample)
+{
+    if (m_isInitialized == false)
+    {
+        return false;
+    }
+    if (packIdx >= m_packs.size())
+    {
+        return false;
+    }
+    if (sampleIdx >= m_packs[packIdx].samples.size())
+    {
+        return false;
+    }
+    sample = m_packs[packIdx].samples[sampleIdx];
+    return true;
+}
+
+bool mck::SampleExplorer::GetPeaks(PeakRequest &req, WavePeakRange &range)
+{
+    if (m_isInitialized == false)
+    {
+        return false;
+    }
+    if (req.packIdx >= m_packs.size())
+    {
+        return false;
+    }
+    if (req.sampleIdx >= m_packs[req.packIdx].samples.size())
+    {
+        return false;
+    }
+    fs::path sndPath(m_packPaths[req.packIdx]);
+    sndPath.append(m_packs[req.packIdx].samples[req.sampleIdx].path);
+
+    auto peaks = LoadPeaks(sndPath.string(), GetPeakPath(req.packIdx, req.sampleIdx));
+    if (peaks == nullptr)
+    {
+        return false;
+    }
+
+    // Peaks are kept at the file rate
+    double ratio = (double)peaks->GetSampleRate() / (double)m_sampleRate;
+    if (peaks->GetRange((size_t)(req.start * ratio), (size_t)(req.end * ratio), req.width, range) == false)
+    {
+        return false;
+    }
+    range.packIdx = req.packIdx;
+    range.sampleIdx = req.sampleIdx;
+    range.framesPerPeak = (size_t)std::ceil(range.framesPerPeak / ratio);
+    range.start = req.start;
+    range.end = (size_t)(range.end / ratio);
+    return true;
+}
+
 bool mck::SampleExplorer::ApplyEditCommand(SampleEdit &cmd, GuiWindow *gui)
 {
     if (m_isInitialized == false)
@@ -316,6 +509,13 @@ bool mck::SampleExplorer::ApplyEditCommand(SampleEdit &cmd, GuiWindow *gui)
             return false;
         };
         break;
+    case SCMD_ANALYSE:
+        if (cmd.classType != SEC_PACK)
+        {
+            return false;
+        }
+        AnalysePack(cmd.packIdx);
+        break;
     default:
         break;
     };
@@ -323,54 +523,18 @@ bool mck::SampleExplorer::ApplyEditCommand(SampleEdit &cmd, GuiWindow *gui)
     return true;
 }
 
-void mck::SampleExplorer::ProcessAudio(float *outLeft, float *outRight, unsigned nframes)
+void mck::SampleExplorer::ProcessAudio(float *outLeft, float *outRight, unsigned nframes, bool running, int beatOffset)
 {
     if (m_isInitialized == false)
     {
-        m_isProcessing = false;
-        m_processCond.notify_all();
-        return;
-    }
-    m_isProcessing = true;
-
-    if (m_state.stop)
-    {
-        m_state.active = false;
-        m_state.stop = false;
         return;
     }
+    m_preview.Process(outLeft, outRight, nframes, running, beatOffset);
+}
 
-    if (m_state.active)
-    {
-        unsigned samplesLeft = m_state.len - m_state.idx;
-        if (samplesLeft <= nframes)
-        {
-            m_state.active = false;
-        }
-        if (m_waveBuffer[m_curWave].size() == 1)
-        {
-            for (unsigned s = 0; s < std::min(samplesLeft, nframes); s++)
-            {
-                outLeft[s] += m_waveBuffer[m_curWave][0][s + m_state.idx] * 0.707;
-                outRight[s] += m_waveBuffer[m_curWave][0][s + m_state.idx] * 0.707;
-            }
-        }
-        else
-        {
-            for (unsigned s = 0; s < std::min(samplesLeft, nframes); s++)
-            {
-                outLeft[s] += m_waveBuffer[m_curWave][0][s + m_state.idx];
-            }
-            for (unsigned s = 0; s < std::min(samplesLeft, nframes); s++)
-            {
-                outRight[s] += m_waveBuffer[m_curWave][1][s + m_state.idx];
-            }
-        }
-        m_state.idx += nframes;
-    }
-
-    m_isProcessing = false;
-    m_processCond.notify_all();
+bool mck::SampleExplorer::GetImportProgress(ImportProgress &progress)
+{
+    return m_importer.GetProgress(progress);
 }
 
 bool mck::SampleExplorer::WritePack(std::string path, SamplePack &pack)
@@ -495,43 +659,319 @@ bool mck::SampleExplorer::ImportSample(std::string path, unsigned packIdx, unsig
 
     std::vector<std::string> files;
     gui->ShowOpenFileDialog("Import one or more sample files", "audio/wav", files, true);
+    if (files.empty())
+    {
+        return false;
+    }
 
-    fs::path catPath(m_samplePath);
-    catPath.append(m_packPaths[packIdx]).append(m_packs[packIdx].categories[categoryIdx]);
+    fs::path catPath(m_packPaths[packIdx]);
+    catPath.append(m_packs[packIdx].categories[categoryIdx]);
+    fs::create_directories(catPath);
 
+    // Indices handed to running imports are not in the pack yet
     unsigned sampleIndex = 1 + std::count_if(m_packs[packIdx].samples.begin(),
                                              m_packs[packIdx].samples.end(),
                                              [&categoryIdx](const SamplePackSample &s) { return s.type == categoryIdx; });
+    auto it = m_importIndex.find(catPath.string());
+    if (it != m_importIndex.end())
+    {
+        sampleIndex = std::max(sampleIndex, it->second);
+    }
+
+    // Converted in the background, the pack is updated once all files are done
+    unsigned numFiles = 0;
+    if (m_importer.Import(files, m_packPaths[packIdx], catPath.string(), categoryIdx, sampleIndex, m_packs[packIdx], numFiles) == false)
+    {
+        return false;
+    }
+    m_importIndex[catPath.string()] = sampleIndex + numFiles;
+    return true;
+}
 
-    for (auto &f : files)
+bool mck::SampleExplorer::AnalysePack(unsigned packIdx)
+{
+    if (m_isInitialized == false)
     {
-        // Check file
-        fs::path oldPath(f);
-        if (fs::exists(oldPath) == false)
+        return false;
+    }
+    if (packIdx >= m_packs.size())
+    {
+        return false;
+    }
+
+    std::vector<SamplePackSample> samples;
+    for (auto &s : m_packs[packIdx].samples)
+    {
+        if (s.analysed == false)
         {
-            continue;
+            samples.push_back(s);
         }
+    }
+    return m_importer.Analyse(m_packPaths[packIdx], samples);
+}
 
-        // Copy file into category folder
-        fs::path newPath(catPath);
-        std::string idxStr = std::to_string(sampleIndex);
-        idxStr.insert(idxStr.begin(), 3 - idxStr.size(), '0');
-        newPath.append(idxStr + "_" + oldPath.filename().string());
-        if (fs::copy_file(oldPath, newPath) == false)
+void mck::SampleExplorer::ApplyImports()
+{
+    std::string packPath;
+    std::vector<SamplePackSample> samples;
+    std::map<std::string, std::vector<float>> features;
+    while (m_importer.GetFinished(packPath, samples, features))
+    {
+        for (auto &f : features)
+        {
+            m_library.SetFeatures(f.first, f.second);
+        }
+        auto it = std::find(m_packPaths.begin(), m_packPaths.end(), packPath);
+        if (it == m_packPaths.end() || samples.empty())
         {
             continue;
         }
+        unsigned packIdx = it - m_packPaths.begin();
+        auto &packSamples = m_packs[packIdx].samples;
+        for (auto &s : samples)
+        {
+            auto ps = std::find_if(packSamples.begin(), packSamples.end(), [&s](const SamplePackSample &p) { return p.path == s.path; });
+            if (ps == packSamples.end())
+            {
+                packSamples.push_back(s);
+                continue;
+            }
+            // The sample may have been renamed meanwhile, only the analysis is taken over
+            ps->analysed = s.analysed;
+            ps->onsetMs = s.onsetMs;
+            ps->peakDb = s.peakDb;
+            ps->loudness = s.loudness;
+        }
+        UpdatePack(packIdx);
+    }
+}
+
+void mck::SampleExplorer::ApplyFeatures()
+{
+    std::deque<std::pair<std::string, std::vector<float>>> features;
+    {
+        std::lock_guard<std::mutex> lock(m_peakMutex);
+        features.swap(m_newFeatures);
+    }
+    for (auto &f : features)
+    {
+        m_library.SetFeatures(f.first, f.second);
+    }
+}
+
+void mck::SampleExplorer::Search(const SearchQuery &query, SearchResult &result)
+{
+    if (m_isInitialized == false)
+    {
+        result = SearchResult();
+        result.id = query.id;
+        return;
+    }
+    if (m_searchDirty)
+    {
+        m_search.Build(m_packs);
+        m_searchDirty = false;
+    }
+    m_search.Query(query, result);
+}
+
+bool mck::SampleExplorer::SliceSample(unsigned packIdx, unsigned sampleIdx, unsigned maxSlices, std::vector<double> &startsMs, double &lengthMs)
+{
+    startsMs.clear();
+    lengthMs = 0.0;
+    if (m_isInitialized == false)
+    {
+        return false;
+    }
+
+    // The audition buffer is at the engine rate already, the positions fit the pads as they are
+    WaveInfoDetail info;
+    auto sample = DecodeSample(packIdx, sampleIdx, info);
+    if (sample == nullptr || sample->buffer.empty())
+    {
+        return false;
+    }
+    std::vector<const float *> channels;
+    for (auto &c : sample->buffer)
+    {
+        channels.push_back(c.data());
+    }
+    size_t numFrames = sample->buffer[0].size();
+
+    std::vector<size_t> onsets;
+    if (DetectOnsets(channels, numFrames, m_sampleRate, maxSlices, onsets) == false)
+    {
+        return false;
+    }
+    for (auto o : onsets)
+    {
+        startsMs.push_back((double)o * 1000.0 / (double)m_sampleRate);
+    }
+    lengthMs = (double)numFrames * 1000.0 / (double)m_sampleRate;
+    return true;
+}
+
+bool mck::SampleExplorer::FindSimilar(unsigned packIdx, unsigned sampleIdx, SimilarSamples &similar)
+{
+    similar.packIdx = packIdx;
+    similar.sampleIdx = sampleIdx;
+    similar.samples.clear();
+    if (m_isInitialized == false)
+    {
+        return false;
+    }
+    if (packIdx >= m_packs.size() || sampleIdx >= m_packs[packIdx].samples.size())
+    {
+        return false;
+    }
+
+    ApplyFeatures();
+    if (m_library.FeaturesChanged() || m_featureIndexDirty)
+    {
+        m_featureIndex.Clear();
+        m_featureSamples.clear();
+        std::vector<float> features;
+        for (unsigned p = 0; p < m_packs.size(); p++)
+        {
+            for (unsigned s = 0; s < m_packs[p].samples.size(); s++)
+            {
+                fs::path sndPath(m_packPaths[p]);
+                sndPath.append(m_packs[p].samples[s].path);
+                if (m_library.GetFeatures(sndPath.string(), features))
+                {
+                    m_featureIndex.Add(m_featureSamples.size(), features);
+                    m_featureSamples.push_back(std::make_pair(p, s));
+                }
+            }
+        }
+        m_featureIndex.Build();
+        m_featureIndexDirty = false;
+    }
 
-        // Update m_packs
-        fs::path relPath = fs::relative(newPath, fs::path(m_samplePath).append(m_packPaths[packIdx]));
-        SamplePackSample sample;
-        sample.path = relPath.string();
-        sample.name = oldPath.stem().string();
-        sample.name = std::regex_replace(sample.name, std::regex("_"), " ");
-        sample.type = categoryIdx;
-        sample.index = sampleIndex++;
-        m_packs[packIdx].samples.push_back(sample);
+    auto it = std::find(m_featureSamples.begin(), m_featureSamples.end(), std::make_pair(packIdx, sampleIdx));
+    if (it == m_featureSamples.end())
+    {
+        return false;
+    }
+    std::vector<std::pair<unsigned, float>> results;
+    if (m_featureIndex.Query(it - m_featureSamples.begin(), SAMPLER_SIMILAR_COUNT, results) == false)
+    {
+        return false;
+    }
+    for (auto &r : results)
+    {
+        SimilarSample sample;
+        sample.packIdx = m_featureSamples[r.first].first;
+        sample.sampleIdx = m_featureSamples[r.first].second;
+        sample.distance = r.second;
+        similar.samples.push_back(sample);
     }
+    return true;
+}
 
-    return UpdatePack(packIdx);
+std::string mck::SampleExplorer::GetPeakPath(unsigned packIdx, unsigned sampleIdx)
+{
+    return WavePeaks::GetEntryPath(m_packPaths[packIdx], m_packs[packIdx].samples[sampleIdx].path);
+}
+
+std::shared_ptr<mck::WavePeaks> mck::SampleExplorer::LoadPeaks(std::string path, std::string peakPath)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_peakMutex);
+        auto it = m_peaks.find(path);
+        if (it != m_peaks.end())
+        {
+            m_peakOrder.splice(m_peakOrder.begin(), m_peakOrder, it->second.order);
+            return it->second.peaks;
+        }
+    }
+
+    auto peaks = std::make_shared<WavePeaks>();
+    if (peaks->Load(peakPath, path) == false)
+    {
+        // Not scanned yet
+        if (peaks->Build(path) == false)
+        {
+            return nullptr;
+        }
+        peaks->Store(peakPath, path);
+    }
+
+    std::lock_guard<std::mutex> lock(m_peakMutex);
+    auto it = m_peaks.find(path);
+    if (it != m_peaks.end())
+    {
+        // Loaded by another thread in the meantime
+        return it->second.peaks;
+    }
+    m_peakOrder.push_front(path);
+    m_peaks[path] = {peaks, m_peakOrder.begin()};
+    while (m_peaks.size() > SAMPLER_PEAK_CACHE_SIZE)
+    {
+        m_peaks.erase(m_peakOrder.back());
+        m_peakOrder.pop_back();
+    }
+    return peaks;
+}
+
+void mck::SampleExplorer::PeakThread()
+{
+    while (true)
+    {
+        PeakJob job;
+        {
+            std::unique_lock<std::mutex> lock(m_peakMutex);
+            m_peakCond.wait(lock, [this] { return m_peakDone || m_peakJobs.empty() == false; });
+            if (m_peakDone)
+            {
+                return;
+            }
+            job = m_peakJobs.front();
+            m_peakJobs.pop_front();
+        }
+
+        if (WavePeaks::IsValid(job.peakPath, job.path) == false)
+        {
+            WavePeaks peaks;
+            if (peaks.Build(job.path))
+            {
+                peaks.Store(job.peakPath, job.path);
+            }
+        }
+
+        std::vector<float> features;
+        if (job.features && m_extractor.Compute(job.path, features))
+        {
+            std::lock_guard<std::mutex> lock(m_peakMutex);
+            m_newFeatures.push_back(std::make_pair(job.path, features));
+        }
+    }
+}
+
+void mck::SampleExplorer::PrefetchThread()
+{
+    while (true)
+    {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(m_cacheMutex);
+            m_prefetchCond.wait(lock, [this] { return m_prefetchDone || m_prefetchJobs.empty() == false; });
+            if (m_prefetchDone)
+            {
+                return;
+            }
+            path = m_prefetchJobs.front();
+            m_prefetchJobs.pop_front();
+            if (m_cache.find(path) != m_cache.end())
+            {
+                continue;
+            }
+        }
+
+        WaveInfoDetail info;
+        if (auto sample = ReadSample(path, info))
+        {
+            CacheSample(path, info, sample);
+        }
+    }
 }
@@ -2,40 +2,60 @@
 #include "Types.hpp"
 #include <vector>
 #include <string>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <thread>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include "helper/WaveHelper.hpp"
+#include "WavePeaks.hpp"
+#include "SampleLibrary.hpp"
+#include "PreviewEngine.hpp"
+#include "SampleImporter.hpp"
+#include "SampleSearch.hpp"
 
 namespace mck
 {
     class GuiWindow;
 
+    const unsigned SAMPLER_PEAK_CACHE_SIZE = 32;                   // Peak pyramids kept in RAM
+    const size_t SAMPLER_PREVIEW_CACHE_BYTES = 64 * 1024 * 1024; // Decoded auditions kept in RAM
+    const unsigned SAMPLER_PREFETCH_RANGE = 4;                    // Neighbours decoded ahead in each direction
+    const unsigned SAMPLER_SIMILAR_COUNT = 20;                    // Results of a similarity query
+
     class SampleExplorer
     {
-        struct PlayState
-        {
-            bool active;
-            bool stop;
-            unsigned idx;
-            unsigned len;
-            PlayState() : active(false), stop(false), idx(0), len(0) {}
-        };
-
     public:
         SampleExplorer();
         ~SampleExplorer();
-        bool Init(unsigned bufferSize, unsigned sampleRate, std::string samplePath);
+        bool Init(unsigned bufferSize, unsigned sampleRate, std::string samplePath, std::string indexPath);
 
-        void RefreshSamples(std::vector<SamplePack> &packs);
+        // Applies the changes of the library since the last call, the packs are the library's own
+        const std::vector<SamplePack> &RefreshSamples();
+        // Header only, the waveform is requested with GetPeaks. Neighbours are decoded ahead
         WaveInfoDetail LoadSample(unsigned packIdx, unsigned sampleIdx);
-        WaveInfoDetail PlaySample(unsigned packIdx, unsigned sampleIdx);
+        // Never waits for the RT thread, sync starts on the next beat of a running transport
+        WaveInfoDetail PlaySample(unsigned packIdx, unsigned sampleIdx, bool sync = false);
         WaveInfoDetail GetSample(unsigned packIdx, unsigned sampleIdx, std::vector<std::vector<float>> &buffer);
         std::string GetSamplePath(unsigned packIdx, unsigned sampleIdx, bool relativePath = true);
         std::string GetSampleName(unsigned packIdx, unsigned sampleIdx);
+        bool GetPackSample(unsigned packIdx, unsigned sampleIdx, SamplePackSample &sample);
+        // Peaks of a range in engine rate frames, pyramids missing on disk are built on the spot
+        bool GetPeaks(PeakRequest &req, WavePeakRange &range);
         bool ApplyEditCommand(SampleEdit &cmd, GuiWindow *gui);
         void StopSample();
-        void ProcessAudio(float *outLeft, float *outRight, unsigned nframes);
+        void ProcessAudio(float *outLeft, float *outRight, unsigned nframes, bool running, int beatOffset);
+        // Paged name search, the index is rebuilt on the first query after the packs changed
+        void Search(const SearchQuery &query, SearchResult &result);
+        // Samples of all packs that sound closest, empty until the background analysis reached them
+        bool FindSimilar(unsigned packIdx, unsigned sampleIdx, SimilarSamples &similar);
+        // Onsets of a sample as slice starts in ms, at most maxSlices. lengthMs is the length of the whole sample
+        bool SliceSample(unsigned packIdx, unsigned sampleIdx, unsigned maxSlices, std::vector<double> &startsMs, double &lengthMs);
+        // Any thread: progress of running imports
+        bool GetImportProgress(ImportProgress &progress);
 
     private:
         bool WritePack(std::string path, SamplePack &pack);
@@ -43,19 +63,82 @@ namespace mck
         bool CreatePack(std::string name);
         bool CreateCategory(std::string name, unsigned packIdx);
         bool ImportSample(std::string path, unsigned packIdx, unsigned categoryIdx, GuiWindow *gui);
+        // Queues every sample of the pack without onset, peak and loudness
+        bool AnalysePack(unsigned packIdx);
+        // Adds the samples of finished imports to their packs, analysed ones are updated in place
+        void ApplyImports();
+        std::shared_ptr<SampleBuffer> DecodeSample(unsigned packIdx, unsigned sampleIdx, WaveInfoDetail &info);
+        std::shared_ptr<SampleBuffer> ReadSample(std::string path, WaveInfoDetail &info);
+        std::shared_ptr<SampleBuffer> GetCachedSample(std::string path, WaveInfoDetail &info);
+        // Returns the cached buffer if another thread was faster
+        std::shared_ptr<SampleBuffer> CacheSample(std::string path, const WaveInfoDetail &info, std::shared_ptr<SampleBuffer> sample);
+        void Prefetch(unsigned packIdx, unsigned sampleIdx);
+        void PrefetchThread();
+        std::string GetPeakPath(unsigned packIdx, unsigned sampleIdx);
+        std::shared_ptr<WavePeaks> LoadPeaks(std::string path, std::string peakPath);
+        // Hands features computed in the background to the library
+        void ApplyFeatures();
+        void PeakThread();
 
         bool m_isInitialized;
         unsigned m_bufferSize;
         unsigned m_sampleRate;
         std::string m_samplePath;
-        std::vector<SamplePack> m_packs;
-        std::vector<std::string> m_packPaths;
-        WaveInfoDetail m_waveInfo[2];
-        std::vector<std::vector<float>> m_waveBuffer[2];
-        char m_curWave;
-        PlayState m_state;
-
-        std::atomic<bool> m_isProcessing;
-        std::condition_variable m_processCond;
+        SampleLibrary m_library;
+        // Owned by the library, packs are edited in place before their file is written
+        std::vector<SamplePack> &m_packs;
+        const std::vector<std::string> &m_packPaths;
+        bool m_packsChanged;
+        PreviewEngine m_preview;
+        SampleImporter m_importer;
+        std::map<std::string, unsigned> m_importIndex; // Next free sample index by category folder
+
+        // Decoded auditions by path, the least recently used are dropped first
+        struct CachedSample
+        {
+            WaveInfoDetail info;
+            std::shared_ptr<SampleBuffer> sample;
+            std::list<std::string>::iterator order;
+        };
+        std::mutex m_cacheMutex;
+        std::map<std::string, CachedSample> m_cache;
+        std::list<std::string> m_cacheOrder; // Most recent first
+        size_t m_cacheSize;
+        // Neighbours of the selected sample, guarded by m_cacheMutex
+        std::thread m_prefetchThread;
+        std::condition_variable m_prefetchCond;
+        bool m_prefetchDone;
+        std::deque<std::string> m_prefetchJobs;
+
+        // Peak pyramids and similarity features of all packs are computed in the background after a scan
+        struct PeakJob
+        {
+            std::string path;
+            std::string peakPath;
+            bool features;
+        };
+        std::thread m_peakThread;
+        std::mutex m_peakMutex;
+        std::condition_variable m_peakCond;
+        bool m_peakDone;
+        std::deque<PeakJob> m_peakJobs;
+        // Loaded pyramids by path, the least recently used are dropped first
+        struct CachedPeaks
+        {
+            std::shared_ptr<WavePeaks> peaks;
+            std::list<std::string>::iterator order;
+        };
+        std::map<std::string, CachedPeaks> m_peaks;
+        std::list<std::string> m_peakOrder; // Most recent first
+        std::deque<std::pair<std::string, std::vector<float>>> m_newFeatures; // By sample path
+        FeatureExtractor m_extractor; // Peak thread only
+
+        SampleSearch m_search;
+        bool m_searchDirty;
+
+        // Rebuilt on the first query after packs or features changed
+        FeatureIndex m_featureIndex;
+        std::vector<std::pair<unsigned, unsigned>> m_featureSamples; // Pack and sample of each id
+        bool m_featureIndexDirty;
     };
 };
\ No newline at end of file
@@ -0,0 +1,462 @@
+#include "SampleFeatures.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <sndfile.h>
+
+namespace
+{
+    // Upper edges of all bands but the last in Hz, one octave each
+    const float BAND_EDGES[mck::SAMPLE_FEATURES_BANDS - 1] = {100.0f, 200.0f, 400.0f, 800.0f, 1600.0f, 3200.0f, 6400.0f};
+    const float MEL_MIN_HZ = 20.0f;
+    const float MEL_MAX_HZ = 16000.0f;
+    const float SILENCE = 1e-6f; // Frames 60 dB below the loudest one are ignored
+
+    float HzToMel(float hz)
+    {
+        return 2595.0f * std::log10(1.0f + hz / 700.0f);
+    }
+    float MelToHz(float mel)
+    {
+        return 700.0f * (std::pow(10.0f, mel / 2595.0f) - 1.0f);
+    }
+} // namespace
+
+mck::Fft::Fft(unsigned size)
+    : m_size(size),
+      m_cos(size - 1),
+      m_sin(size - 1),
+      m_bitrev(size)
+{
+    const unsigned n = size;
+
+    unsigned bits = 0;
+    while ((1u << bits) < n)
+    {
+        bits++;
+    }
+    for (unsigned i = 0; i < n; i++)
+    {
+        unsigned r = 0;
+        for (unsigned b = 0; b < bits; b++)
+        {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        m_bitrev[i] = r;
+    }
+
+    // Contiguous per stage, so the butterflies run over plain arrays
+    for (unsigned half = 1; half < n; half *= 2)
+    {
+        for (unsigned k = 0; k < half; k++)
+        {
+            m_cos[half - 1 + k] = std::cos(M_PI * k / half);
+            m_sin[half - 1 + k] = -std::sin(M_PI * k / half);
+        }
+    }
+}
+
+mck::Fft::~Fft()
+{
+}
+
+void mck::Fft::Forward(float *re, float *im) const
+{
+    const unsigned n = m_size;
+    for (unsigned i = 0; i < n; i++)
+    {
+        unsigned j = m_bitrev[i];
+        if (j > i)
+        {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+
+    // Radix 2, split real and imaginary arrays keep the inner loop free of shuffles
+    for (unsigned half = 1; half < n; half *= 2)
+    {
+        const float *wr = &m_cos[half - 1];
+        const float *wi = &m_sin[half - 1];
+        for (unsigned start = 0; start < n; start += 2 * half)
+        {
+            float *ar = re + start;
+            float *ai = im + start;
+            float *br = ar + half;
+            float *bi = ai + half;
+            for (unsigned k = 0; k < half; k++)
+            {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+mck::FeatureExtractor::FeatureExtractor()
+    : m_fft(SAMPLE_FEATURES_FFT_SIZE),
+      m_window(SAMPLE_FEATURES_FFT_SIZE),
+      m_re(SAMPLE_FEATURES_FFT_SIZE),
+      m_im(SAMPLE_FEATURES_FFT_SIZE),
+      m_dct(SAMPLE_FEATURES_MFCCS * SAMPLE_FEATURES_MELS),
+      m_sampleRate(0),
+      m_bandBins(),
+      m_melStart(),
+      m_melWeights()
+{
+    const unsigned n = SAMPLE_FEATURES_FFT_SIZE;
+    for (unsigned i = 0; i < n; i++)
+    {
+        m_window[i] = 0.5f - 0.5f * std::cos(2.0 * M_PI * i / n);
+    }
+
+    for (unsigned c = 0; c < SAMPLE_FEATURES_MFCCS; c++)
+    {
+        for (unsigned m = 0; m < SAMPLE_FEATURES_MELS; m++)
+        {
+            // c0 is the loudness, skipped so level does not decide similarity
+            m_dct[c * SAMPLE_FEATURES_MELS + m] = std::cos(M_PI * (c + 1) * (m + 0.5) / SAMPLE_FEATURES_MELS);
+        }
+    }
+}
+
+mck::FeatureExtractor::~FeatureExtractor()
+{
+}
+
+bool mck::FeatureExtractor::Compute(std::string path, std::vector<float> &features)
+{
+    SF_INFO info;
+    std::memset(&info, 0, sizeof(SF_INFO));
+    SNDFILE *file = sf_open(path.c_str(), SFM_READ, &info);
+    if (file == nullptr)
+    {
+        return false;
+    }
+    if (info.frames <= 0 || info.channels <= 0 || info.samplerate <= 0)
+    {
+        sf_close(file);
+        return false;
+    }
+
+    sf_count_t numFrames = std::min(info.frames, (sf_count_t)info.samplerate * SAMPLE_FEATURES_MAX_MS / 1000);
+    std::vector<float> in(numFrames * info.channels);
+    numFrames = sf_readf_float(file, in.data(), numFrames);
+    sf_close(file);
+    if (numFrames <= 0)
+    {
+        return false;
+    }
+
+    std::vector<float> mono(numFrames);
+    float gain = 1.0f / info.channels;
+    for (sf_count_t i = 0; i < numFrames; i++)
+    {
+        float sum = 0.0f;
+        for (int c = 0; c < info.channels; c++)
+        {
+            sum += in[i * info.channels + c];
+        }
+        mono[i] = sum * gain;
+    }
+    return Compute(mono.data(), numFrames, info.samplerate, features);
+}
+
+bool mck::FeatureExtractor::Compute(const float *data, size_t numFrames, unsigned sampleRate, std::vector<float> &features)
+{
+    if (data == nullptr || numFrames == 0 || sampleRate == 0)
+    {
+        return false;
+    }
+    SetSampleRate(sampleRate);
+    numFrames = std::min(numFrames, (size_t)sampleRate * SAMPLE_FEATURES_MAX_MS / 1000);
+
+    // Attack: time until the 1 ms envelope peaks
+    size_t block = std::max(1u, sampleRate / 1000);
+    float envMax = 0.0f;
+    size_t attack = 0;
+    for (size_t b = 0; b * block < numFrames; b++)
+    {
+        float env = 0.0f;
+        for (size_t i = b * block; i < std::min(numFrames, (b + 1) * block); i++)
+        {
+            env = std::max(env, std::abs(data[i]));
+        }
+        if (env > envMax)
+        {
+            envMax = env;
+            attack = b;
+        }
+    }
+    if (envMax <= 0.0f)
+    {
+        return false;
+    }
+
+    const unsigned n = SAMPLE_FEATURES_FFT_SIZE;
+    const unsigned numBins = n / 2 + 1;
+    struct Frame
+    {
+        float energy;
+        float centroid;
+        float bands[SAMPLE_FEATURES_BANDS];
+        float mfcc[SAMPLE_FEATURES_MFCCS];
+    };
+    std::vector<Frame> frames;
+    std::vector<float> power(numBins);
+    float mel[SAMPLE_FEATURES_MELS];
+    float binHz = (float)sampleRate / n;
+
+    for (size_t pos = 0; pos < numFrames; pos += SAMPLE_FEATURES_HOP)
+    {
+        unsigned len = (unsigned)std::min((size_t)n, numFrames - pos);
+        for (unsigned i = 0; i < len; i++)
+        {
+            m_re[i] = data[pos + i] * m_window[i];
+        }
+        std::fill(m_re.begin() + len, m_re.end(), 0.0f);
+        std::fill(m_im.begin(), m_im.end(), 0.0f);
+        m_fft.Forward(m_re.data(), m_im.data());
+
+        Frame frame;
+        std::memset(&frame, 0, sizeof(Frame));
+        float weighted = 0.0f;
+        for (unsigned k = 0; k < numBins; k++)
+        {
+            power[k] = m_re[k] * m_re[k] + m_im[k] * m_im[k];
+            frame.energy += power[k];
+            weighted += power[k] * k * binHz;
+        }
+        frame.centroid = frame.energy > 0.0f ? weighted / frame.energy : 0.0f;
+
+        for (unsigned b = 0; b < SAMPLE_FEATURES_BANDS; b++)
+        {
+            unsigned end = b + 1 < SAMPLE_FEATURES_BANDS ? m_bandBins[b + 1] : numBins;
+            for (unsigned k = m_bandBins[b]; k < end; k++)
+            {
+                frame.bands[b] += power[k];
+            }
+        }
+
+        for (unsigned m = 0; m < SAMPLE_FEATURES_MELS; m++)
+        {
+            float sum = 0.0f;
+            const float *w = m_melWeights[m].data();
+            const float *p = power.data() + m_melStart[m];
+            for (unsigned k = 0; k < m_melWeights[m].size(); k++)
+            {
+                sum += w[k] * p[k];
+            }
+            mel[m] = std::log10(sum + 1e-10f);
+        }
+        for (unsigned c = 0; c < SAMPLE_FEATURES_MFCCS; c++)
+        {
+            const float *d = &m_dct[c * SAMPLE_FEATURES_MELS];
+            for (unsigned m = 0; m < SAMPLE_FEATURES_MELS; m++)
+            {
+                frame.mfcc[c] += d[m] * mel[m];
+            }
+        }
+        frames.push_back(frame);
+    }
+
+    float maxEnergy = 0.0f;
+    for (auto &f : frames)
+    {
+        maxEnergy = std::max(maxEnergy, f.energy);
+    }
+
+    // Averages over the audible frames, the centroid is weighted by energy
+    float energy = 0.0f;
+    float centroid = 0.0f;
+    float bands[SAMPLE_FEATURES_BANDS] = {0.0f};
+    float mfcc[SAMPLE_FEATURES_MFCCS] = {0.0f};
+    unsigned numUsed = 0;
+    for (auto &f : frames)
+    {
+        if (f.energy < maxEnergy * SILENCE)
+        {
+            continue;
+        }
+        energy += f.energy;
+        centroid += f.centroid * f.energy;
+        for (unsigned b = 0; b < SAMPLE_FEATURES_BANDS; b++)
+        {
+            bands[b] += f.bands[b];
+        }
+        for (unsigned c = 0; c < SAMPLE_FEATURES_MFCCS; c++)
+        {
+            mfcc[c] += f.mfcc[c];
+        }
+        numUsed++;
+    }
+    if (numUsed == 0 || energy <= 0.0f)
+    {
+        return false;
+    }
+
+    features.resize(SAMPLE_FEATURES_SIZE);
+    unsigned idx = 0;
+    // Pitch and time are perceived on a log scale
+    features[idx++] = std::log2(std::max(1.0f, centroid / energy));
+    features[idx++] = std::log2(1.0f + attack);
+    for (unsigned b = 0; b < SAMPLE_FEATURES_BANDS; b++)
+    {
+        features[idx++] = std::log10(bands[b] / energy + 1e-6f);
+    }
+    for (unsigned c = 0; c < SAMPLE_FEATURES_MFCCS; c++)
+    {
+        features[idx++] = mfcc[c] / numUsed;
+    }
+    return true;
+}
+
+void mck::FeatureExtractor::SetSampleRate(unsigned sampleRate)
+{
+    if (sampleRate == m_sampleRate)
+    {
+        return;
+    }
+    m_sampleRate = sampleRate;
+
+    const unsigned n = SAMPLE_FEATURES_FFT_SIZE;
+    const unsigned numBins = n / 2 + 1;
+    float binHz = (float)sampleRate / n;
+
+    m_bandBins.resize(SAMPLE_FEATURES_BANDS);
+    m_bandBins[0] = 0;
+    for (unsigned b = 1; b < SAMPLE_FEATURES_BANDS; b++)
+    {
+        m_bandBins[b] = std::min(numBins, (unsigned)std::ceil(BAND_EDGES[b - 1] / binHz));
+    }
+
+    // Triangular filters, evenly spaced on the mel scale
+    float melMin = HzToMel(MEL_MIN_HZ);
+    float melMax = HzToMel(std::min(MEL_MAX_HZ, 0.5f * sampleRate));
+    float points[SAMPLE_FEATURES_MELS + 2];
+    for (unsigned i = 0; i < SAMPLE_FEATURES_MELS + 2; i++)
+    {
+        points[i] = MelToHz(melMin + (melMax - melMin) * i / (SAMPLE_FEATURES_MELS + 1)) / binHz;
+    }
+    m_melStart.resize(SAMPLE_FEATURES_MELS);
+    m_melWeights.resize(SAMPLE_FEATURES_MELS);
+    for (unsigned m = 0; m < SAMPLE_FEATURES_MELS; m++)
+    {
+        float lo = points[m];
+        float mid = points[m + 1];
+        float hi = points[m + 2];
+        unsigned start = std::min(numBins - 1, (unsigned)std::ceil(lo));
+        unsigned end = std::min(numBins - 1, (unsigned)std::floor(hi));
+        m_melStart[m] = start;
+        m_melWeights[m].clear();
+        for (unsigned k = start; k <= end; k++)
+        {
+            float w = k <= mid ? (k - lo) / (mid - lo) : (hi - k) / (hi - mid);
+            m_melWeights[m].push_back(std::max(0.0f, w));
+        }
+        // Low filters can be narrower than a bin
+        if (m_melWeights[m].empty() || *std::max_element(m_melWeights[m].begin(), m_melWeights[m].end()) <= 0.0f)
+        {
+            m_melStart[m] = std::min(numBins - 1, (unsigned)std::round(mid));
+            m_melWeights[m].assign(1, 1.0f);
+        }
+    }
+}
+
+mck::FeatureIndex::FeatureIndex()
+    : m_rows(),
+      m_ids(),
+      m_rowOf()
+{
+}
+
+mck::FeatureIndex::~FeatureIndex()
+{
+}
+
+void mck::FeatureIndex::Clear()
+{
+    m_rows.clear();
+    m_ids.clear();
+    m_rowOf.clear();
+}
+
+void mck::FeatureIndex::Add(unsigned id, const std::vector<float> &features)
+{
+    if (features.size() != SAMPLE_FEATURES_SIZE || m_rowOf.find(id) != m_rowOf.end())
+    {
+        return;
+    }
+    m_rowOf[id] = m_ids.size();
+    m_ids.push_back(id);
+    m_rows.insert(m_rows.end(), features.begin(), features.end());
+}
+
+void mck::FeatureIndex::Build()
+{
+    const size_t numRows = m_ids.size();
+    if (numRows == 0)
+    {
+        return;
+    }
+
+    // Dimensions have different units, each one counts the same after scaling
+    for (unsigned d = 0; d < SAMPLE_FEATURES_SIZE; d++)
+    {
+        double sum = 0.0;
+        double sumSq = 0.0;
+        for (size_t r = 0; r < numRows; r++)
+        {
+            double v = m_rows[r * SAMPLE_FEATURES_SIZE + d];
+            sum += v;
+            sumSq += v * v;
+        }
+        double mean = sum / numRows;
+        double dev = std::sqrt(std::max(0.0, sumSq / numRows - mean * mean));
+        float scale = dev > 1e-9 ? (float)(1.0 / dev) : 0.0f;
+        for (size_t r = 0; r < numRows; r++)
+        {
+            float &v = m_rows[r * SAMPLE_FEATURES_SIZE + d];
+            v = (v - (float)mean) * scale;
+        }
+    }
+}
+
+bool mck::FeatureIndex::Query(unsigned id, unsigned count, std::vector<std::pair<unsigned, float>> &results)
+{
+    results.clear();
+    auto it = m_rowOf.find(id);
+    if (it == m_rowOf.end())
+    {
+        return false;
+    }
+
+    const size_t numRows = m_ids.size();
+    const float *query = &m_rows[it->second * SAMPLE_FEATURES_SIZE];
+    std::vector<std::pair<float, size_t>> dist(numRows);
+    for (size_t r = 0; r < numRows; r++)
+    {
+        // Fixed length, the compiler unrolls and vectorises it
+        const float *row = &m_rows[r * SAMPLE_FEATURES_SIZE];
+        float sum = 0.0f;
+        for (unsigned d = 0; d < SAMPLE_FEATURES_SIZE; d++)
+        {
+            float diff = row[d] - query[d];
+            sum += diff * diff;
+        }
+        dist[r] = std::make_pair(sum, r);
+    }
+    dist[it->second].first = INFINITY;
+
+    count = (unsigned)std::min((size_t)count, numRows - 1);
+    std::partial_sort(dist.begin(), dist.begin() + count, dist.end());
+    for (unsigned i = 0; i < count; i++)
+    {
+        results.push_back(std::make_pair(m_ids[dist[i].second], std::sqrt(dist[i].first)));
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+namespace mck
+{
+    const unsigned SAMPLE_FEATURES_VERSION = 1;
+    const unsigned SAMPLE_FEATURES_FFT_SIZE = 1024;
+    const unsigned SAMPLE_FEATURES_HOP = 512;
+    const unsigned SAMPLE_FEATURES_MAX_MS = 2000; // One shots are told apart by their start
+    const unsigned SAMPLE_FEATURES_BANDS = 8;
+    const unsigned SAMPLE_FEATURES_MELS = 26;
+    const unsigned SAMPLE_FEATURES_MFCCS = 12;
+    // Spectral centroid, attack time, band energies, cepstral coefficients
+    const unsigned SAMPLE_FEATURES_SIZE = 2 + SAMPLE_FEATURES_BANDS + SAMPLE_FEATURES_MFCCS;
+
+    // Radix 2 FFT of a power of two size, twiddles of all stages back to back
+    class Fft
+    {
+    public:
+        Fft(unsigned size);
+        ~Fft();
+
+        // In place, split real and imaginary arrays of the full size
+        void Forward(float *re, float *im) const;
+        unsigned GetSize() const { return m_size; }
+
+    private:
+        unsigned m_size;
+        // A stage of half size h starts at h - 1
+        std::vector<float> m_cos;
+        std::vector<float> m_sin;
+        std::vector<unsigned> m_bitrev;
+    };
+
+    // Computes a compact description of how a sample sounds, similar samples have close vectors
+    class FeatureExtractor
+    {
+    public:
+        FeatureExtractor();
+        ~FeatureExtractor();
+
+        // Mono signal at its own rate, only the first SAMPLE_FEATURES_MAX_MS are analysed
+        bool Compute(const float *data, size_t numFrames, unsigned sampleRate, std::vector<float> &features);
+        // Decodes the start of the file and mixes it down
+        bool Compute(std::string path, std::vector<float> &features);
+
+    private:
+        void SetSampleRate(unsigned sampleRate);
+
+        Fft m_fft;
+        std::vector<float> m_window;
+        std::vector<float> m_re;
+        std::vector<float> m_im;
+        std::vector<float> m_dct; // Mfcc by mel band
+        unsigned m_sampleRate;
+        std::vector<unsigned> m_bandBins; // First bin of each band
+        std::vector<unsigned> m_melStart;
+        std::vector<std::vector<float>> m_melWeights;
+    };
+
+    // Brute force nearest neighbours, a flat scan of a few ten thousand vectors takes well below a millisecond
+    class FeatureIndex
+    {
+    public:
+        FeatureIndex();
+        ~FeatureIndex();
+
+        void Clear();
+        // Vectors of the wrong size are skipped
+        void Add(unsigned id, const std::vector<float> &features);
+        // Scales every dimension to unit variance, call once after adding
+        void Build();
+        // Closest first, the queried entry is left out
+        bool Query(unsigned id, unsigned count, std::vector<std::pair<unsigned, float>> &results);
+
+        size_t GetSize() { return m_ids.size(); }
+
+    private:
+        std::vector<float> m_rows; // SAMPLE_FEATURES_SIZE values per entry
+        std::vector<unsigned> m_ids;
+        std::map<unsigned, size_t> m_rowOf;
+    };
+} // namespace mck
@@ -0,0 +1,467 @@
+#include "SampleImporter.hpp"
+#include "KitBank.hpp"
+#include "WavePeaks.hpp"
+#include "SampleAnalysis.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <regex>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <sndfile.h>
+#include <samplerate.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // Searched for in imported folders, single files are tried whatever their extension
+    const char *IMPORT_EXTENSIONS[] = {".wav", ".flac", ".aif", ".aiff", ".ogg"};
+
+    bool IsAudioFile(const fs::path &path)
+    {
+        std::string ext = path.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return std::find(std::begin(IMPORT_EXTENSIONS), std::end(IMPORT_EXTENSIONS), ext) != std::end(IMPORT_EXTENSIONS);
+    }
+} // namespace
+
+mck::SampleImporter::SampleImporter()
+    : m_isInitialized(false),
+      m_threads(),
+      m_done(false),
+      m_jobs(),
+      m_numBatches(0),
+      m_finished(),
+      m_progress()
+{
+}
+
+mck::SampleImporter::~SampleImporter()
+{
+    Close();
+}
+
+bool mck::SampleImporter::Init(unsigned numThreads)
+{
+    if (m_isInitialized)
+    {
+        return false;
+    }
+
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    m_done = false;
+    for (unsigned i = 0; i < numThreads; i++)
+    {
+        m_threads.push_back(std::thread(&mck::SampleImporter::WorkerThread, this));
+    }
+
+    m_isInitialized = true;
+    return true;
+}
+
+void mck::SampleImporter::Close()
+{
+    if (m_isInitialized == false)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+        m_jobs.clear();
+    }
+    m_cond.notify_all();
+    for (auto &t : m_threads)
+    {
+        if (t.joinable())
+        {
+            t.join();
+        }
+    }
+    m_threads.clear();
+    m_isInitialized = false;
+}
+
+bool mck::SampleImporter::Import(std::vector<std::string> files, std::string packPath, std::string catPath, unsigned categoryIdx, unsigned firstIndex, const SamplePack &format, unsigned &numFiles)
+{
+    numFiles = 0;
+    if (m_isInitialized == false)
+    {
+        return false;
+    }
+
+    // Folders are expanded here, file names are cheap compared to decoding
+    std::vector<std::string> paths;
+    for (auto &f : files)
+    {
+        std::error_code ec;
+        if (fs::is_directory(f, ec))
+        {
+            std::vector<std::string> dirFiles;
+            for (auto &dp : fs::recursive_directory_iterator(f, fs::directory_options::skip_permission_denied, ec))
+            {
+                if (dp.is_regular_file() && IsAudioFile(dp.path()))
+                {
+                    dirFiles.push_back(dp.path().string());
+                }
+            }
+            std::sort(dirFiles.begin(), dirFiles.end());
+            paths.insert(paths.end(), dirFiles.begin(), dirFiles.end());
+        }
+        else if (fs::exists(f, ec))
+        {
+            paths.push_back(f);
+        }
+    }
+    if (paths.empty())
+    {
+        return false;
+    }
+
+    auto batch = std::make_shared<Batch>();
+    batch->packPath = packPath;
+    batch->catPath = catPath;
+    batch->categoryIdx = categoryIdx;
+    batch->sampleRate = format.sampleRate;
+    batch->numBits = format.numBits;
+    batch->numChannels = format.numChannels;
+    batch->analyseOnly = false;
+    batch->total = paths.size();
+    batch->done = 0;
+    batch->failed = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        batch->id = m_numBatches++;
+        for (unsigned i = 0; i < paths.size(); i++)
+        {
+            m_jobs.push_back({batch, paths[i], firstIndex + i, SamplePackSample()});
+        }
+    }
+    m_cond.notify_all();
+
+    numFiles = paths.size();
+    return true;
+}
+
+bool mck::SampleImporter::Analyse(std::string packPath, const std::vector<SamplePackSample> &samples)
+{
+    if (m_isInitialized == false || samples.empty())
+    {
+        return false;
+    }
+
+    auto batch = std::make_shared<Batch>();
+    batch->packPath = packPath;
+    batch->catPath = "";
+    batch->categoryIdx = 0;
+    batch->sampleRate = 0;
+    batch->numBits = 0;
+    batch->numChannels = 0;
+    batch->analyseOnly = true;
+    batch->total = samples.size();
+    batch->done = 0;
+    batch->failed = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        batch->id = m_numBatches++;
+        for (auto &s : samples)
+        {
+            m_jobs.push_back({batch, (fs::path(packPath) / s.path).string(), s.index, s});
+        }
+    }
+    m_cond.notify_all();
+    return true;
+}
+
+bool mck::SampleImporter::GetProgress(ImportProgress &progress)
+{
+    return m_progress.try_dequeue(progress);
+}
+
+bool mck::SampleImporter::GetFinished(std::string &packPath, std::vector<SamplePackSample> &samples, std::map<std::string, std::vector<float>> &features)
+{
+    std::shared_ptr<Batch> batch;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_finished.empty())
+        {
+            return false;
+        }
+        batch = m_finished.front();
+        m_finished.pop_front();
+    }
+
+    packPath = batch->packPath;
+    // Workers finish in any order, the pack lists samples by their index
+    samples = std::move(batch->samples);
+    features = std::move(batch->features);
+    std::sort(samples.begin(), samples.end(), [](const SamplePackSample &a, const SamplePackSample &b) {
+        return a.index < b.index;
+    });
+    return true;
+}
+
+void mck::SampleImporter::WorkerThread()
+{
+    FeatureExtractor extractor;
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_done || m_jobs.empty() == false; });
+            if (m_done)
+            {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        Batch &batch = *job.batch;
+        SamplePackSample sample;
+        std::vector<float> features;
+        ImportProgress progress;
+        progress.batch = batch.id;
+        progress.total = batch.total;
+        progress.file = fs::path(job.path).filename().string();
+        if (batch.analyseOnly)
+        {
+            sample = job.sample;
+            progress.error = AnalyseSample(job.path, sample) ? "" : "Unable to analyse the file";
+        }
+        else
+        {
+            progress.error = ConvertFile(job, extractor, sample, features);
+        }
+        if (progress.error == "")
+        {
+            std::lock_guard<std::mutex> lock(batch.mutex);
+            if (features.empty() == false)
+            {
+                batch.features[(fs::path(batch.packPath) / sample.path).string()] = features;
+            }
+            batch.samples.push_back(sample);
+        }
+        else
+        {
+            std::fprintf(stderr, "Failed to process %s: %s\n", job.path.c_str(), progress.error.c_str());
+            batch.failed += 1;
+        }
+        progress.failed = batch.failed.load();
+        progress.done = batch.done.fetch_add(1) + 1;
+        progress.finished = progress.done == batch.total;
+
+        if (progress.finished)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished.push_back(job.batch);
+        }
+        m_progress.enqueue(progress);
+    }
+}
+
+std::string mck::SampleImporter::ConvertFile(const Job &job, FeatureExtractor &extractor, SamplePackSample &sample, std::vector<float> &features)
+{
+    const Batch &batch = *job.batch;
+
+    // Validate
+    SF_INFO info;
+    std::memset(&info, 0, sizeof(SF_INFO));
+    SNDFILE *file = sf_open(job.path.c_str(), SFM_READ, &info);
+    if (file == nullptr)
+    {
+        return sf_strerror(nullptr);
+    }
+    if (info.frames <= 0 || info.channels <= 0 || info.samplerate <= 0)
+    {
+        sf_close(file);
+        return "File contains no audio";
+    }
+
+    std::vector<float> in(info.frames * info.channels);
+    sf_count_t numFrames = sf_readf_float(file, in.data(), info.frames);
+    int srcFormat = info.format;
+    sf_close(file);
+    if (numFrames <= 0)
+    {
+        return "Unable to read audio data";
+    }
+
+    // Channels: mono is duplicated, stereo is averaged down, further channels are dropped
+    unsigned inChans = info.channels;
+    unsigned outChans = batch.numChannels > 0 ? batch.numChannels : std::min(2u, inChans);
+    if (outChans > 2)
+    {
+        return "Packs hold mono or stereo samples only";
+    }
+    std::vector<float> mixed(numFrames * outChans);
+    for (sf_count_t i = 0; i < numFrames; i++)
+    {
+        const float *frame = &in[i * inChans];
+        if (outChans == 1)
+        {
+            mixed[i] = inChans == 1 ? frame[0] : 0.5f * (frame[0] + frame[1]);
+        }
+        else
+        {
+            mixed[i * 2] = frame[0];
+            mixed[i * 2 + 1] = inChans == 1 ? frame[0] : frame[1];
+        }
+    }
+    in.clear();
+    in.shrink_to_fit();
+
+    // Sample rate
+    unsigned sampleRate = batch.sampleRate > 0 ? batch.sampleRate : info.samplerate;
+    std::vector<float> out;
+    if (sampleRate != (unsigned)info.samplerate)
+    {
+        double ratio = (double)sampleRate / (double)info.samplerate;
+        out.resize((size_t)std::ceil((double)numFrames * ratio + 1.0) * outChans);
+        SRC_DATA src;
+        std::memset(&src, 0, sizeof(SRC_DATA));
+        src.data_in = mixed.data();
+        src.data_out = out.data();
+        src.input_frames = numFrames;
+        src.output_frames = out.size() / outChans;
+        src.src_ratio = ratio;
+        int err = src_simple(&src, SAMPLER_SRC_QUALITY, outChans);
+        if (err != 0)
+        {
+            return src_strerror(err);
+        }
+        numFrames = src.output_frames_gen;
+        out.resize(numFrames * outChans);
+    }
+    else
+    {
+        out.swap(mixed);
+    }
+
+    // Integer formats would wrap, resampling can overshoot
+    for (auto &s : out)
+    {
+        s = std::min(1.0f, std::max(-1.0f, s));
+    }
+
+    // Bit depth, an undeclared one keeps PCM sources as they are
+    int subType = SF_FORMAT_PCM_24;
+    unsigned numBits = batch.numBits;
+    if (numBits == 0)
+    {
+        switch (srcFormat & SF_FORMAT_SUBMASK)
+        {
+        case SF_FORMAT_PCM_16:
+            numBits = 16;
+            break;
+        case SF_FORMAT_FLOAT:
+        case SF_FORMAT_DOUBLE:
+            numBits = 32;
+            break;
+        default:
+            numBits = SAMPLER_IMPORT_BITS;
+            break;
+        }
+    }
+    switch (numBits)
+    {
+    case 16:
+        subType = SF_FORMAT_PCM_16;
+        break;
+    case 24:
+        subType = SF_FORMAT_PCM_24;
+        break;
+    case 32:
+        subType = SF_FORMAT_FLOAT;
+        break;
+    default:
+        return "Unsupported bit depth " + std::to_string(numBits);
+    }
+
+    // Write, the temporary name keeps half written files out of the pack
+    std::string idxStr = std::to_string(job.index);
+    idxStr.insert(idxStr.begin(), idxStr.size() < 3 ? 3 - idxStr.size() : 0, '0');
+    std::string stem = fs::path(job.path).stem().string();
+    fs::path newPath(batch.catPath);
+    newPath.append(idxStr + "_" + stem + ".wav");
+    std::string tmpPath = newPath.string() + ".tmp";
+
+    SF_INFO outInfo;
+    std::memset(&outInfo, 0, sizeof(SF_INFO));
+    outInfo.samplerate = sampleRate;
+    outInfo.channels = outChans;
+    outInfo.format = SF_FORMAT_WAV | subType;
+    SNDFILE *outFile = sf_open(tmpPath.c_str(), SFM_WRITE, &outInfo);
+    if (outFile == nullptr)
+    {
+        return sf_strerror(nullptr);
+    }
+    sf_count_t written = sf_writef_float(outFile, out.data(), numFrames);
+    sf_close(outFile);
+    if (written != numFrames)
+    {
+        std::remove(tmpPath.c_str());
+        return "Unable to write " + newPath.string();
+    }
+    std::error_code ec;
+    fs::rename(tmpPath, newPath, ec);
+    if (ec)
+    {
+        std::remove(tmpPath.c_str());
+        return ec.message();
+    }
+
+    sample.path = newPath.lexically_relative(batch.packPath).string();
+    sample.name = std::regex_replace(stem, std::regex("_"), " ");
+    sample.type = batch.categoryIdx;
+    sample.index = job.index;
+
+    // The converted audio is still at hand, similarity features come almost for free
+    size_t numMono = std::min((size_t)numFrames, (size_t)sampleRate * SAMPLE_FEATURES_MAX_MS / 1000);
+    std::vector<float> mono(numMono);
+    for (size_t i = 0; i < numMono; i++)
+    {
+        mono[i] = outChans == 1 ? out[i] : 0.5f * (out[2 * i] + out[2 * i + 1]);
+    }
+    if (extractor.Compute(mono.data(), numMono, sampleRate, features) == false)
+    {
+        features.clear();
+    }
+
+    // Onset, peak and loudness for the pad defaults
+    std::vector<const float *> channels(outChans);
+    std::vector<std::vector<float>> planar(outChans);
+    for (unsigned c = 0; c < outChans; c++)
+    {
+        if (outChans == 1)
+        {
+            channels[c] = out.data();
+            continue;
+        }
+        planar[c].resize(numFrames);
+        for (sf_count_t i = 0; i < numFrames; i++)
+        {
+            planar[c][i] = out[i * outChans + c];
+        }
+        channels[c] = planar[c].data();
+    }
+    AnalyseSample(channels, numFrames, sampleRate, sample);
+
+    // The explorer finds the waveform ready, a failure only costs a rebuild later
+    WavePeaks peaks;
+    if (peaks.Build(newPath.string()))
+    {
+        peaks.Store(WavePeaks::GetEntryPath(batch.packPath, sample.path), newPath.string());
+    }
+
+    return "";
+}
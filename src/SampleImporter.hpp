@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "Types.hpp"
+#include "SampleFeatures.hpp"
+#include <concurrentqueue.h>
+
+namespace mck
+{
+    const unsigned SAMPLER_IMPORT_BITS = 24; // Packs without a declared bit depth
+
+    // Validates and converts imported files to the format of their pack, several files at once
+    class SampleImporter
+    {
+    public:
+        SampleImporter();
+        ~SampleImporter();
+
+        bool Init(unsigned numThreads = 0);
+        void Close();
+
+        // Folders are searched for audio files. Samples are written to catPath and numbered from firstIndex,
+        // a zero rate, depth or channel count in format keeps the one of the source. numFiles counts the queued files
+        bool Import(std::vector<std::string> files, std::string packPath, std::string catPath, unsigned categoryIdx, unsigned firstIndex, const SamplePack &format, unsigned &numFiles);
+        // Fills onset, peak and loudness of existing samples, finished like an import of the same files
+        bool Analyse(std::string packPath, const std::vector<SamplePackSample> &samples);
+        // Any thread: one entry per handled file
+        bool GetProgress(ImportProgress &progress);
+        // Samples of a batch where every file was handled, paths are relative to the pack.
+        // Features are keyed by the absolute path of the written file
+        bool GetFinished(std::string &packPath, std::vector<SamplePackSample> &samples, std::map<std::string, std::vector<float>> &features);
+
+    private:
+        struct Batch
+        {
+            unsigned id;
+            std::string packPath;
+            std::string catPath;
+            unsigned categoryIdx;
+            unsigned sampleRate;
+            unsigned numBits;
+            unsigned numChannels;
+            bool analyseOnly;
+            unsigned total;
+            std::atomic<unsigned> done;
+            std::atomic<unsigned> failed;
+            std::mutex mutex;
+            std::vector<SamplePackSample> samples;
+            std::map<std::string, std::vector<float>> features;
+        };
+        struct Job
+        {
+            std::shared_ptr<Batch> batch;
+            std::string path;
+            unsigned index;
+            SamplePackSample sample; // Analysis only
+        };
+
+        void WorkerThread();
+        // Returns an error message, empty on success
+        std::string ConvertFile(const Job &job, FeatureExtractor &extractor, SamplePackSample &sample, std::vector<float> &features);
+
+        bool m_isInitialized;
+        std::vector<std::thread> m_threads;
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        bool m_done;
+        std::deque<Job> m_jobs;
+        unsigned m_numBatches;
+        std::deque<std::shared_ptr<Batch>> m_finished;
+        moodycamel::ConcurrentQueue<ImportProgress> m_progress;
+    };
+} // namespace mck
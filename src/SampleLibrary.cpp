@@ -0,0 +1,617 @@
+#include "SampleLibrary.hpp"
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+#include <unistd.h>
+#include <sys/inotify.h>
+
+namespace fs = std::filesystem;
+
+mck::SampleLibrary::SampleLibrary()
+    : m_isInitialized(false),
+      m_samplePath(""),
+      m_indexPath(""),
+      m_featuresPath(""),
+      m_inotify(-1),
+      m_watches(),
+      m_entries(),
+      m_changed(),
+      m_packs(),
+      m_packPaths(),
+      m_packFiles(),
+      m_features(),
+      m_featuresChanged(false),
+      m_featuresDirty(false),
+      m_featuresStored()
+{
+}
+
+mck::SampleLibrary::~SampleLibrary()
+{
+    Close();
+}
+
+bool mck::SampleLibrary::Init(std::string samplePath, std::string indexPath)
+{
+    if (m_isInitialized)
+    {
+        return false;
+    }
+
+    m_samplePath = samplePath;
+    m_indexPath = indexPath;
+    m_featuresPath = fs::path(indexPath).replace_extension(".features.json").string();
+    std::error_code ec;
+    fs::create_directories(fs::path(indexPath).parent_path(), ec);
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify < 0)
+    {
+        std::fprintf(stderr, "Unable to watch the sample library, packs are checked on every refresh\n");
+    }
+
+    LoadIndex();
+    m_changed.clear();
+    ScanRoot();
+    if (m_changed.empty() == false)
+    {
+        StoreIndex();
+    }
+    Rebuild(true);
+    if (m_featuresDirty)
+    {
+        StoreFeatures();
+    }
+
+    // Everything counts as changed for the first caller
+    m_changed.clear();
+    for (auto &path : m_packPaths)
+    {
+        m_changed.insert(path);
+    }
+
+    m_isInitialized = true;
+    return true;
+}
+
+void mck::SampleLibrary::Close()
+{
+    if (m_isInitialized && m_featuresDirty)
+    {
+        StoreFeatures();
+    }
+    if (m_inotify >= 0)
+    {
+        close(m_inotify);
+        m_inotify = -1;
+    }
+    m_watches.clear();
+    m_isInitialized = false;
+}
+
+bool mck::SampleLibrary::Update()
+{
+    if (m_isInitialized == false)
+    {
+        return false;
+    }
+    m_changed.clear();
+
+    bool fullScan = m_inotify < 0;
+    std::set<std::string> dirs;
+    alignas(struct inotify_event) char buffer[16384];
+    while (m_inotify >= 0)
+    {
+        ssize_t len = read(m_inotify, buffer, sizeof(buffer));
+        if (len <= 0)
+        {
+            break;
+        }
+        for (char *ptr = buffer; ptr < buffer + len;)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                fullScan = true;
+                continue;
+            }
+            auto it = m_watches.find(ev->wd);
+            if (it == m_watches.end())
+            {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED)
+            {
+                m_watches.erase(it);
+                continue;
+            }
+            std::string name = ev->len > 0 ? ev->name : "";
+
+            if (it->second == m_samplePath)
+            {
+                // Pack folders come and go in the root
+                if ((ev->mask & IN_ISDIR) == 0)
+                {
+                    continue;
+                }
+                std::string dir = (fs::path(m_samplePath) / name).string();
+                if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                {
+                    RemovePack(dir);
+                    dirs.erase(dir);
+                }
+                else
+                {
+                    dirs.insert(dir);
+                }
+            }
+            else if (fs::path(name).extension() == ".mcksp")
+            {
+                dirs.insert(it->second);
+            }
+        }
+    }
+
+    if (fullScan)
+    {
+        ScanRoot();
+    }
+    else
+    {
+        // One scan per folder, saving a file triggers several events
+        for (auto &dir : dirs)
+        {
+            AddWatch(dir);
+            ScanPack(dir);
+        }
+    }
+
+    bool changed = m_changed.empty() == false;
+    if (changed)
+    {
+        Rebuild(false);
+        StoreIndex();
+    }
+    // Features arrive in small batches while the analysis runs, they are written together
+    auto sinceStored = std::chrono::steady_clock::now() - m_featuresStored;
+    if (m_featuresDirty && sinceStored >= std::chrono::milliseconds(SAMPLE_LIBRARY_FEATURES_STORE_MS))
+    {
+        StoreFeatures();
+    }
+    return changed;
+}
+
+bool mck::SampleLibrary::GetFeatures(std::string path, std::vector<float> &features)
+{
+    auto it = m_features.find(path);
+    if (it == m_features.end())
+    {
+        return false;
+    }
+    features = it->second.values;
+    return true;
+}
+
+bool mck::SampleLibrary::HasFeatures(std::string path)
+{
+    auto it = m_features.find(path);
+    if (it == m_features.end())
+    {
+        return false;
+    }
+    std::error_code ec;
+    uintmax_t fileSize = fs::file_size(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+    int64_t mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    return ec.value() == 0 && it->second.fileSize == fileSize && it->second.mtime == mtime;
+}
+
+void mck::SampleLibrary::SetFeatures(std::string path, const std::vector<float> &features)
+{
+    Features entry;
+    std::error_code ec;
+    entry.fileSize = fs::file_size(path, ec);
+    if (ec)
+    {
+        return;
+    }
+    entry.mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    if (ec)
+    {
+        return;
+    }
+    entry.values = features;
+    m_features[path] = entry;
+    m_featuresChanged = true;
+    m_featuresDirty = true;
+}
+
+bool mck::SampleLibrary::FeaturesChanged()
+{
+    bool changed = m_featuresChanged;
+    m_featuresChanged = false;
+    return changed;
+}
+
+void mck::SampleLibrary::ScanRoot()
+{
+    AddWatch(m_samplePath);
+
+    std::set<std::string> dirs;
+    std::error_code ec;
+    for (auto &dp : fs::directory_iterator(m_samplePath, ec))
+    {
+        if (dp.is_directory())
+        {
+            dirs.insert(dp.path().string());
+        }
+    }
+
+    // Packs of removed folders
+    std::set<std::string> removed;
+    for (auto &e : m_entries)
+    {
+        if (dirs.find(e.second.dir) == dirs.end())
+        {
+            removed.insert(e.second.dir);
+        }
+    }
+    for (auto &dir : removed)
+    {
+        RemovePack(dir);
+    }
+
+    for (auto &dir : dirs)
+    {
+        AddWatch(dir);
+        ScanPack(dir);
+    }
+}
+
+void mck::SampleLibrary::ScanPack(std::string dir)
+{
+    std::set<std::string> files;
+    std::error_code ec;
+    for (auto &cfp : fs::directory_iterator(dir, ec))
+    {
+        if (cfp.is_regular_file() && cfp.path().extension() == ".mcksp")
+        {
+            files.insert(cfp.path().string());
+        }
+    }
+
+    // Entries of a folder are adjacent, their keys start with the folder path
+    std::string prefix = (fs::path(dir) / "").string();
+    for (auto it = m_entries.lower_bound(prefix); it != m_entries.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+    {
+        if (it->second.dir == dir && files.find(it->first) == files.end())
+        {
+            it = m_entries.erase(it);
+            m_changed.insert(dir);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    for (auto &file : files)
+    {
+        int64_t mtime = fs::last_write_time(file, ec).time_since_epoch().count();
+        if (ec)
+        {
+            continue;
+        }
+        auto it = m_entries.find(file);
+        if (it != m_entries.end() && it->second.mtime == mtime)
+        {
+            continue;
+        }
+
+        Entry entry;
+        entry.dir = dir;
+        entry.mtime = mtime;
+        try
+        {
+            std::ifstream spFile(file);
+            nlohmann::json j;
+            spFile >> j;
+            entry.pack = j.get<SamplePack>();
+        }
+        catch (std::exception &e)
+        {
+            std::printf("File %s is malformed: %s\n", file.c_str(), e.what());
+            if (it != m_entries.end())
+            {
+                m_entries.erase(it);
+                m_changed.insert(dir);
+            }
+            continue;
+        }
+        m_entries[file] = entry;
+        m_changed.insert(dir);
+    }
+}
+
+void mck::SampleLibrary::RemovePack(std::string dir)
+{
+    std::string prefix = (fs::path(dir) / "").string();
+    for (auto it = m_entries.lower_bound(prefix); it != m_entries.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+    {
+        if (it->second.dir == dir)
+        {
+            it = m_entries.erase(it);
+            m_changed.insert(dir);
+        }
+        else
+        {
+            it++;
+        }
+    }
+    RemoveWatch(dir);
+}
+
+void mck::SampleLibrary::AddWatch(std::string dir)
+{
+    if (m_inotify < 0)
+    {
+        return;
+    }
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR;
+    int wd = inotify_add_watch(m_inotify, dir.c_str(), mask);
+    if (wd < 0)
+    {
+        std::fprintf(stderr, "Unable to watch %s\n", dir.c_str());
+        return;
+    }
+    // Adding a folder twice returns the same descriptor
+    m_watches[wd] = dir;
+}
+
+void mck::SampleLibrary::RemoveWatch(std::string dir)
+{
+    for (auto &w : m_watches)
+    {
+        if (w.second == dir)
+        {
+            inotify_rm_watch(m_inotify, w.first);
+            m_watches.erase(w.first);
+            return;
+        }
+    }
+}
+
+bool mck::SampleLibrary::LoadIndex()
+{
+    std::ifstream indexFile(m_indexPath);
+    if (indexFile.good() == false)
+    {
+        return false;
+    }
+    auto readFeatures = [this](const nlohmann::json &j) {
+        // Features of another version are computed again
+        if (j.contains("features") == false || j.at("featuresVersion").get<unsigned>() != SAMPLE_FEATURES_VERSION)
+        {
+            return;
+        }
+        for (auto &f : j.at("features"))
+        {
+            Features features;
+            features.fileSize = f.at("size").get<uint64_t>();
+            features.mtime = f.at("mtime").get<int64_t>();
+            features.values = f.at("values").get<std::vector<float>>();
+            m_features[f.at("path").get<std::string>()] = features;
+        }
+    };
+    try
+    {
+        nlohmann::json j;
+        indexFile >> j;
+        unsigned version = j.at("version").get<unsigned>();
+        // Version 2 kept the features in the index, they move to their own file
+        if (version != SAMPLE_LIBRARY_VERSION && version != 2)
+        {
+            return false;
+        }
+        for (auto &p : j.at("packs"))
+        {
+            Entry entry;
+            entry.dir = p.at("dir").get<std::string>();
+            entry.mtime = p.at("mtime").get<int64_t>();
+            entry.pack = p.at("pack").get<SamplePack>();
+            m_entries[p.at("file").get<std::string>()] = entry;
+        }
+        if (version == 2)
+        {
+            readFeatures(j);
+            m_featuresDirty = m_features.empty() == false;
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::printf("Sample library index is malformed, rescanning: %s\n", e.what());
+        m_entries.clear();
+        m_features.clear();
+        return false;
+    }
+
+    std::ifstream featuresFile(m_featuresPath);
+    if (m_featuresDirty || featuresFile.good() == false)
+    {
+        return true;
+    }
+    try
+    {
+        nlohmann::json j;
+        featuresFile >> j;
+        readFeatures(j);
+    }
+    catch (std::exception &e)
+    {
+        std::printf("Sample features are malformed, computing them again: %s\n", e.what());
+        m_features.clear();
+    }
+    return true;
+}
+
+static bool WriteIndexFile(std::string path, const nlohmann::json &j)
+{
+    std::string tmpPath = path + ".tmp";
+    std::ofstream file(tmpPath);
+    file << j.dump() << std::endl;
+    file.close();
+    if (file.fail() || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        std::fprintf(stderr, "Failed to write sample library index %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool mck::SampleLibrary::StoreIndex()
+{
+    nlohmann::json j;
+    j["version"] = SAMPLE_LIBRARY_VERSION;
+    j["packs"] = nlohmann::json::array();
+    for (auto &e : m_entries)
+    {
+        nlohmann::json p;
+        p["file"] = e.first;
+        p["dir"] = e.second.dir;
+        p["mtime"] = e.second.mtime;
+        p["pack"] = e.second.pack;
+        j["packs"].push_back(p);
+    }
+    return WriteIndexFile(m_indexPath, j);
+}
+
+bool mck::SampleLibrary::StoreFeatures()
+{
+    nlohmann::json j;
+    j["featuresVersion"] = SAMPLE_FEATURES_VERSION;
+    j["features"] = nlohmann::json::array();
+    for (auto &f : m_features)
+    {
+        nlohmann::json e;
+        e["path"] = f.first;
+        e["size"] = f.second.fileSize;
+        e["mtime"] = f.second.mtime;
+        e["values"] = f.second.values;
+        j["features"].push_back(e);
+    }
+    // A failed write is retried with the next batch
+    m_featuresStored = std::chrono::steady_clock::now();
+    if (WriteIndexFile(m_featuresPath, j) == false)
+    {
+        return false;
+    }
+    m_featuresDirty = false;
+    return true;
+}
+
+void mck::SampleLibrary::Rebuild(bool full)
+{
+    // Packs of unchanged folders are moved over, they are sorted already
+    std::vector<SamplePack> packs;
+    std::vector<std::string> paths;
+    std::vector<std::string> files;
+    for (unsigned i = 0; full == false && i < m_packs.size(); i++)
+    {
+        if (m_changed.find(m_packPaths[i]) == m_changed.end())
+        {
+            packs.push_back(std::move(m_packs[i]));
+            paths.push_back(std::move(m_packPaths[i]));
+            files.push_back(std::move(m_packFiles[i]));
+        }
+    }
+    size_t numKept = packs.size();
+
+    // Sample paths the entries of the changed folders list, their features are kept
+    std::set<std::string> listed;
+    auto addEntry = [&](const std::string &file, const Entry &e) {
+        packs.push_back(e.pack);
+        paths.push_back(e.dir);
+        files.push_back(file);
+        for (auto &sample : e.pack.samples)
+        {
+            listed.insert((fs::path(e.dir) / sample.path).string());
+        }
+    };
+    if (full)
+    {
+        for (auto &e : m_entries)
+        {
+            addEntry(e.first, e.second);
+        }
+    }
+    else
+    {
+        for (auto &dir : m_changed)
+        {
+            std::string prefix = (fs::path(dir) / "").string();
+            for (auto it = m_entries.lower_bound(prefix); it != m_entries.end() && it->first.compare(0, prefix.size(), prefix) == 0; it++)
+            {
+                if (it->second.dir == dir)
+                {
+                    addEntry(it->first, it->second);
+                }
+            }
+        }
+    }
+
+    // Sort by name, the new packs are merged into the kept ones
+    std::vector<size_t> order(packs.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    auto byName = [&](size_t a, size_t b) -> bool {
+        return packs[a].name < packs[b].name || (packs[a].name == packs[b].name && files[a] < files[b]);
+    };
+    std::sort(order.begin() + numKept, order.end(), byName);
+    std::inplace_merge(order.begin(), order.begin() + numKept, order.end(), byName);
+
+    m_packs.resize(order.size());
+    m_packPaths.resize(order.size());
+    m_packFiles.resize(order.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        m_packs[i] = std::move(packs[order[i]]);
+        m_packPaths[i] = std::move(paths[order[i]]);
+        m_packFiles[i] = std::move(files[order[i]]);
+    }
+
+    // Features of samples no pack lists any more, only below the changed folders
+    auto dropFeatures = [&](const std::string &prefix) {
+        for (auto it = m_features.lower_bound(prefix); it != m_features.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+        {
+            if (listed.find(it->first) == listed.end())
+            {
+                it = m_features.erase(it);
+                m_featuresDirty = true;
+            }
+            else
+            {
+                it++;
+            }
+        }
+    };
+    if (full)
+    {
+        dropFeatures("");
+    }
+    else
+    {
+        for (auto &dir : m_changed)
+        {
+            dropFeatures((fs::path(dir) / "").string());
+        }
+    }
+}
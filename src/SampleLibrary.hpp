@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <chrono>
+#include <cstdint>
+
+#include "Types.hpp"
+#include "SampleFeatures.hpp"
+
+namespace mck
+{
+    const unsigned SAMPLE_LIBRARY_VERSION = 3;
+    const unsigned SAMPLE_LIBRARY_FEATURES_STORE_MS = 10000; // Features are written at most this often, and on Close
+
+    // Index of all sample packs, persisted between runs and kept current with inotify. The
+    // similarity features are stored in a file of their own next to the index
+    class SampleLibrary
+    {
+    public:
+        SampleLibrary();
+        ~SampleLibrary();
+
+        // Loads the stored index, only pack files with a different mtime are parsed again
+        bool Init(std::string samplePath, std::string indexPath);
+        void Close();
+
+        // Applies pending file system events, returns true if any pack changed
+        bool Update();
+        // Pack folders changed by the last Update, all packs after Init
+        const std::set<std::string> &GetChangedPacks() { return m_changed; }
+
+        // Sorted by name, paths are the absolute pack folders. Updated in place, only the packs of
+        // changed folders are replaced. Callers may edit a pack before they write its file
+        std::vector<SamplePack> &GetPacks() { return m_packs; }
+        const std::vector<std::string> &GetPackPaths() { return m_packPaths; }
+
+        // Similarity features by absolute sample path, stored with the index
+        bool GetFeatures(std::string path, std::vector<float> &features);
+        // Checks size and mtime of the file, false if the features have to be computed
+        bool HasFeatures(std::string path);
+        void SetFeatures(std::string path, const std::vector<float> &features);
+        // True once after features were added
+        bool FeaturesChanged();
+
+    private:
+        struct Entry
+        {
+            std::string dir;
+            int64_t mtime;
+            SamplePack pack;
+        };
+        struct Features
+        {
+            uint64_t fileSize;
+            int64_t mtime;
+            std::vector<float> values;
+        };
+
+        void ScanRoot();
+        void ScanPack(std::string dir);
+        void RemovePack(std::string dir);
+        void AddWatch(std::string dir);
+        void RemoveWatch(std::string dir);
+        bool LoadIndex();
+        bool StoreIndex();
+        bool StoreFeatures();
+        // Replaces the packs of the changed folders, or all of them
+        void Rebuild(bool full);
+
+        bool m_isInitialized;
+        std::string m_samplePath;
+        std::string m_indexPath;
+        std::string m_featuresPath;
+        int m_inotify;
+        std::map<int, std::string> m_watches; // Watch descriptor, watched folder
+        std::map<std::string, Entry> m_entries; // Keyed by pack file path
+        std::set<std::string> m_changed;
+        std::vector<SamplePack> m_packs;
+        std::vector<std::string> m_packPaths;
+        std::vector<std::string> m_packFiles; // Keys of the entries, the order among equal names
+        std::map<std::string, Features> m_features;
+        bool m_featuresChanged;
+        bool m_featuresDirty; // Not stored yet
+        std::chrono::steady_clock::time_point m_featuresStored;
+    };
+} // namespace mck
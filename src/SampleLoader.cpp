@@ -0,0 +1,166 @@
+#include "SampleLoader.hpp"
+#include "KitBank.hpp"
+#include <algorithm>
+
+mck::SampleLoader::SampleLoader()
+    : m_isInitialized(false),
+      m_kitBank(nullptr),
+      m_threads(),
+      m_jobs(),
+      m_callbacks(),
+      m_upgrades(),
+      m_done(false),
+      m_pending(0)
+{
+}
+
+mck::SampleLoader::~SampleLoader()
+{
+    Close();
+}
+
+bool mck::SampleLoader::Init(KitBank *kitBank, unsigned numThreads)
+{
+    if (m_isInitialized || kitBank == nullptr)
+    {
+        return false;
+    }
+
+    m_kitBank = kitBank;
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    m_done = false;
+    for (unsigned i = 0; i < numThreads; i++)
+    {
+        m_threads.push_back(std::thread(&mck::SampleLoader::WorkerThread, this));
+    }
+
+    m_isInitialized = true;
+    return true;
+}
+
+void mck::SampleLoader::Close()
+{
+    if (m_isInitialized == false)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+        for (auto &c : m_callbacks)
+        {
+            m_pending -= c.second.size();
+        }
+        m_jobs.clear();
+        m_callbacks.clear();
+        m_upgrades.clear();
+    }
+    m_cond.notify_all();
+    for (auto &t : m_threads)
+    {
+        if (t.joinable())
+        {
+            t.join();
+        }
+    }
+    m_threads.clear();
+    m_isInitialized = false;
+}
+
+void mck::SampleLoader::Load(std::string path, Callback callback)
+{
+    if (m_isInitialized == false)
+    {
+        callback(nullptr);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending += 1;
+        auto it = m_callbacks.find(path);
+        if (it != m_callbacks.end())
+        {
+            // Slices of one loop load the same file on many pads
+            it->second.push_back(callback);
+            return;
+        }
+        m_callbacks[path].push_back(callback);
+        m_jobs.push_back(path);
+    }
+    m_cond.notify_one();
+}
+
+void mck::SampleLoader::Upgrade(std::string path)
+{
+    if (m_isInitialized == false)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_upgrades.push_back(path);
+    }
+    m_cond.notify_one();
+}
+
+unsigned mck::SampleLoader::GetPending()
+{
+    return m_pending.load();
+}
+
+void mck::SampleLoader::WorkerThread()
+{
+    while (true)
+    {
+        std::string path;
+        std::string upgrade;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_done.load() || m_jobs.empty() == false || m_upgrades.empty() == false; });
+            if (m_done.load())
+            {
+                return;
+            }
+            // Pads still waiting for a sample come first
+            if (m_jobs.empty())
+            {
+                upgrade = std::move(m_upgrades.front());
+                m_upgrades.pop_front();
+            }
+            else
+            {
+                path = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+        }
+
+        if (upgrade != "")
+        {
+            m_kitBank->UpgradeSample(upgrade);
+            continue;
+        }
+        auto sample = m_kitBank->LoadSample(path, this);
+        std::vector<Callback> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_callbacks.find(path);
+            if (it != m_callbacks.end())
+            {
+                callbacks.swap(it->second);
+                m_callbacks.erase(it);
+            }
+        }
+        for (auto &c : callbacks)
+        {
+            c(sample);
+        }
+        m_pending -= callbacks.size();
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+#include "Types.hpp"
+
+namespace mck
+{
+    class KitBank;
+
+    // Worker pool decoding and resampling samples off the GUI and RT threads
+    class SampleLoader
+    {
+    public:
+        typedef std::function<void(std::shared_ptr<SampleBuffer>)> Callback;
+
+        SampleLoader();
+        ~SampleLoader();
+
+        bool Init(KitBank *kitBank, unsigned numThreads = 0);
+        void Close();
+
+        // The callback is called from a worker thread, sample is nullptr on failure.
+        // Loads of a path that is already queued or decoding share its result
+        void Load(std::string path, Callback callback);
+        // Low priority, runs KitBank::UpgradeSample once no loads are waiting
+        void Upgrade(std::string path);
+        unsigned GetPending();
+
+    private:
+        void WorkerThread();
+
+        bool m_isInitialized;
+        KitBank *m_kitBank;
+        std::vector<std::thread> m_threads;
+        std::deque<std::string> m_jobs;
+        std::map<std::string, std::vector<Callback>> m_callbacks; // By path of a queued or running job
+        std::deque<std::string> m_upgrades;
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::atomic<bool> m_done;
+        std::atomic<unsigned> m_pending;
+    };
+} // namespace mck
@@ -0,0 +1,260 @@
+#include "SampleSearch.hpp"
+#include <algorithm>
+#include <sstream>
+#include <cctype>
+
+namespace
+{
+    std::string ToLower(std::string s)
+    {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+        return s;
+    }
+} // namespace
+
+mck::SampleSearch::SampleSearch()
+    : m_hits(),
+      m_text(),
+      m_trigrams(),
+      m_packBits(),
+      m_categoryBits(),
+      m_categories(),
+      m_categoryOf(),
+      m_numWords(0),
+      m_lastText(""),
+      m_lastMatches()
+{
+}
+
+mck::SampleSearch::~SampleSearch()
+{
+}
+
+void mck::SampleSearch::Build(const std::vector<SamplePack> &packs)
+{
+    m_hits.clear();
+    m_text.clear();
+    m_trigrams.clear();
+    m_packBits.clear();
+    m_categoryBits.clear();
+    m_categories.clear();
+    m_categoryOf.clear();
+    m_lastText = "";
+    m_lastMatches.clear();
+
+    for (unsigned p = 0; p < packs.size(); p++)
+    {
+        for (unsigned s = 0; s < packs[p].samples.size(); s++)
+        {
+            auto &sample = packs[p].samples[s];
+            SearchHit hit;
+            hit.packIdx = p;
+            hit.sampleIdx = s;
+            hit.name = sample.name;
+            hit.pack = packs[p].name;
+            hit.category = sample.type < packs[p].categories.size() ? packs[p].categories[sample.type] : "";
+            // Categories and packs work as tags, "kick" finds every sample of a Kicks category
+            m_text.push_back(ToLower(hit.name + " " + hit.category + " " + hit.pack));
+            m_hits.push_back(hit);
+        }
+    }
+    m_numWords = (m_hits.size() + 63) / 64;
+
+    std::vector<uint32_t> grams;
+    for (uint32_t id = 0; id < m_text.size(); id++)
+    {
+        const std::string &text = m_text[id];
+        grams.clear();
+        for (size_t i = 0; i + 3 <= text.size(); i++)
+        {
+            grams.push_back(Trigram(&text[i]));
+        }
+        std::sort(grams.begin(), grams.end());
+        grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+        // Ids are added in order, posting lists stay sorted
+        for (auto g : grams)
+        {
+            m_trigrams[g].push_back(id);
+        }
+    }
+
+    for (auto &hit : m_hits)
+    {
+        m_categories.push_back(hit.category);
+    }
+    std::sort(m_categories.begin(), m_categories.end());
+    m_categories.erase(std::unique(m_categories.begin(), m_categories.end()), m_categories.end());
+
+    m_packBits.assign(packs.size(), Bitmap(m_numWords, 0));
+    m_categoryBits.assign(m_categories.size(), Bitmap(m_numWords, 0));
+    m_categoryOf.resize(m_hits.size());
+    for (size_t id = 0; id < m_hits.size(); id++)
+    {
+        SetBit(m_packBits[m_hits[id].packIdx], id);
+        m_categoryOf[id] = std::lower_bound(m_categories.begin(), m_categories.end(), m_hits[id].category) - m_categories.begin();
+        SetBit(m_categoryBits[m_categoryOf[id]], id);
+    }
+}
+
+void mck::SampleSearch::Query(const SearchQuery &query, SearchResult &result)
+{
+    result.id = query.id;
+    result.total = 0;
+    result.offset = query.offset;
+    result.samples.clear();
+    result.packCounts.assign(m_packBits.size(), 0);
+    result.categories.clear();
+
+    Bitmap matches;
+    Match(query.text, matches);
+
+    // Facets, no selection lets everything through
+    Bitmap packFilter(m_numWords, query.packs.empty() ? ~(uint64_t)0 : 0);
+    for (auto p : query.packs)
+    {
+        if (p < m_packBits.size())
+        {
+            for (size_t w = 0; w < m_numWords; w++)
+            {
+                packFilter[w] |= m_packBits[p][w];
+            }
+        }
+    }
+    Bitmap categoryFilter(m_numWords, query.categories.empty() ? ~(uint64_t)0 : 0);
+    for (auto &c : query.categories)
+    {
+        auto it = std::lower_bound(m_categories.begin(), m_categories.end(), c);
+        if (it != m_categories.end() && *it == c)
+        {
+            auto &bits = m_categoryBits[it - m_categories.begin()];
+            for (size_t w = 0; w < m_numWords; w++)
+            {
+                categoryFilter[w] |= bits[w];
+            }
+        }
+    }
+
+    // Facet counts walk the matches, cheaper than a bitmap per pack once there are many packs
+    result.categories.resize(m_categories.size());
+    for (unsigned c = 0; c < m_categories.size(); c++)
+    {
+        result.categories[c].name = m_categories[c];
+    }
+    for (size_t w = 0; w < m_numWords; w++)
+    {
+        uint64_t packBits = matches[w] & categoryFilter[w];
+        while (packBits != 0)
+        {
+            size_t id = w * 64 + __builtin_ctzll(packBits);
+            packBits &= packBits - 1;
+            result.packCounts[m_hits[id].packIdx]++;
+        }
+        uint64_t categoryBits = matches[w] & packFilter[w];
+        while (categoryBits != 0)
+        {
+            size_t id = w * 64 + __builtin_ctzll(categoryBits);
+            categoryBits &= categoryBits - 1;
+            result.categories[m_categoryOf[id]].count++;
+        }
+    }
+
+    unsigned count = query.count > 0 ? std::min(query.count, SAMPLER_SEARCH_MAX_PAGE) : SAMPLER_SEARCH_PAGE_SIZE;
+    unsigned skip = query.offset;
+    for (size_t w = 0; w < m_numWords; w++)
+    {
+        uint64_t bits = matches[w] & packFilter[w] & categoryFilter[w];
+        result.total += __builtin_popcountll(bits);
+        while (bits != 0 && result.samples.size() < count)
+        {
+            size_t id = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (skip > 0)
+            {
+                skip--;
+                continue;
+            }
+            result.samples.push_back(m_hits[id]);
+        }
+    }
+}
+
+void mck::SampleSearch::Match(std::string text, Bitmap &matches)
+{
+    text = ToLower(text);
+
+    // Typing on extends the last query, its matches are a superset of the new ones
+    if (m_lastMatches.size() == m_numWords && m_lastText != "" && text.compare(0, m_lastText.size(), m_lastText) == 0)
+    {
+        matches = m_lastMatches;
+    }
+    else
+    {
+        matches.assign(m_numWords, ~(uint64_t)0);
+        if (m_hits.size() % 64 != 0)
+        {
+            matches.back() = ((uint64_t)1 << (m_hits.size() % 64)) - 1;
+        }
+    }
+
+    std::istringstream words(text);
+    std::string word;
+    while (words >> word)
+    {
+        if (MatchWord(word, matches) == false)
+        {
+            break;
+        }
+    }
+
+    m_lastText = text;
+    m_lastMatches = matches;
+}
+
+bool mck::SampleSearch::MatchWord(const std::string &word, Bitmap &matches)
+{
+    // The rarest trigram of the word narrows the candidates down
+    if (word.size() >= 3)
+    {
+        const std::vector<uint32_t> *rarest = nullptr;
+        for (size_t i = 0; i + 3 <= word.size(); i++)
+        {
+            auto it = m_trigrams.find(Trigram(&word[i]));
+            if (it == m_trigrams.end())
+            {
+                std::fill(matches.begin(), matches.end(), 0);
+                return false;
+            }
+            if (rarest == nullptr || it->second.size() < rarest->size())
+            {
+                rarest = &it->second;
+            }
+        }
+        Bitmap candidates(m_numWords, 0);
+        for (auto id : *rarest)
+        {
+            SetBit(candidates, id);
+        }
+        for (size_t w = 0; w < m_numWords; w++)
+        {
+            matches[w] &= candidates[w];
+        }
+    }
+
+    // Trigrams can match out of order, the text itself decides
+    bool any = false;
+    for (size_t w = 0; w < m_numWords; w++)
+    {
+        uint64_t bits = matches[w];
+        while (bits != 0)
+        {
+            size_t id = w * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (m_text[id].find(word) == std::string::npos)
+            {
+                matches[w] &= ~((uint64_t)1 << (id & 63));
+            }
+        }
+        any |= matches[w] != 0;
+    }
+    return any;
+}
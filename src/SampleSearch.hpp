@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+#include "Types.hpp"
+
+namespace mck
+{
+    const unsigned SAMPLER_SEARCH_PAGE_SIZE = 50;  // Results per page if the query asks for none
+    const unsigned SAMPLER_SEARCH_MAX_PAGE = 500;
+
+    // Trigram index over sample, category and pack names, with a bitmap per pack and category name as facets
+    class SampleSearch
+    {
+    public:
+        SampleSearch();
+        ~SampleSearch();
+
+        void Build(const std::vector<SamplePack> &packs);
+        // Every word of the text has to appear in the name of the sample, its category or its pack
+        void Query(const SearchQuery &query, SearchResult &result);
+
+    private:
+        typedef std::vector<uint64_t> Bitmap;
+
+        // Samples containing all words, a refined query only checks the previous matches
+        void Match(std::string text, Bitmap &matches);
+        bool MatchWord(const std::string &word, Bitmap &matches);
+        static void SetBit(Bitmap &b, size_t idx) { b[idx >> 6] |= (uint64_t)1 << (idx & 63); }
+        static uint32_t Trigram(const char *c) { return ((uint8_t)c[0] << 16) | ((uint8_t)c[1] << 8) | (uint8_t)c[2]; }
+
+        std::vector<SearchHit> m_hits;                        // By id, in pack and sample order
+        std::vector<std::string> m_text;                      // Lower case names of each id
+        std::map<uint32_t, std::vector<uint32_t>> m_trigrams; // Sorted ids
+        std::vector<Bitmap> m_packBits;
+        std::vector<Bitmap> m_categoryBits;
+        std::vector<std::string> m_categories; // Category names of all packs, sorted
+        std::vector<unsigned> m_categoryOf;    // Category name of each id
+        size_t m_numWords;
+
+        std::string m_lastText;
+        Bitmap m_lastMatches;
+    };
+} // namespace mck
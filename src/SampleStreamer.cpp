@@ -0,0 +1,209 @@
+#include "SampleStreamer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include <unistd.h>
+
+mck::SampleStreamer::SampleStreamer()
+    : m_isInitialized(false),
+      m_done(false),
+      m_streams(),
+      m_readBuffer(),
+      m_underruns(0)
+{
+}
+
+mck::SampleStreamer::~SampleStreamer()
+{
+    Close();
+}
+
+bool mck::SampleStreamer::Init()
+{
+    if (m_isInitialized)
+    {
+        return false;
+    }
+
+    for (unsigned i = 0; i < SAMPLER_NUM_STREAMS; i++)
+    {
+        auto s = std::make_unique<Stream>();
+        s->ring[0].resize(SAMPLER_STREAM_RING_FRAMES, 0.0f);
+        s->ring[1].resize(SAMPLER_STREAM_RING_FRAMES, 0.0f);
+        m_streams.push_back(std::move(s));
+    }
+    m_readBuffer.resize(SAMPLER_STREAM_RING_FRAMES);
+
+    m_done = false;
+    m_thread = std::thread(&mck::SampleStreamer::ReadAheadThread, this);
+    m_isInitialized = true;
+    return true;
+}
+
+void mck::SampleStreamer::Close()
+{
+    if (m_isInitialized == false)
+    {
+        return;
+    }
+    m_done = true;
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    m_isInitialized = false;
+}
+
+int mck::SampleStreamer::Start(SampleBuffer *sample, size_t start, size_t length, bool reverse)
+{
+    if (m_isInitialized == false || sample == nullptr || sample->fd < 0)
+    {
+        return -1;
+    }
+    for (unsigned i = 0; i < m_streams.size(); i++)
+    {
+        Stream &s = *m_streams[i];
+        if (s.state.load(std::memory_order_acquire) != SS_FREE)
+        {
+            continue;
+        }
+        sample->users.fetch_add(1, std::memory_order_relaxed);
+        s.sample = sample;
+        s.start = start;
+        s.length = length;
+        s.reverse = reverse;
+        s.readPos.store(0, std::memory_order_relaxed);
+        s.writePos.store(0, std::memory_order_relaxed);
+        s.state.store(SS_PLAYING, std::memory_order_release);
+        return (int)i;
+    }
+    return -1;
+}
+
+unsigned mck::SampleStreamer::Read(int idx, float **dst, unsigned offset, unsigned n)
+{
+    if (idx < 0 || idx >= (int)m_streams.size())
+    {
+        return 0;
+    }
+    Stream &s = *m_streams[idx];
+    size_t r = s.readPos.load(std::memory_order_relaxed);
+    size_t w = s.writePos.load(std::memory_order_acquire);
+    unsigned count = (unsigned)std::min((size_t)n, w - r);
+    unsigned numChans = std::min((size_t)2, s.sample->channels.size());
+
+    for (unsigned c = 0; c < numChans; c++)
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            dst[c][offset + i] = s.ring[c][(r + i) & (SAMPLER_STREAM_RING_FRAMES - 1)];
+        }
+    }
+    s.readPos.store(r + count, std::memory_order_release);
+
+    // Running out before the end of the stream means the read-ahead fell behind
+    size_t missing = std::min((size_t)n, s.length - r) - count;
+    if (missing > 0)
+    {
+        m_underruns.fetch_add(missing, std::memory_order_relaxed);
+    }
+    return count;
+}
+
+void mck::SampleStreamer::Release(int idx)
+{
+    if (idx < 0 || idx >= (int)m_streams.size())
+    {
+        return;
+    }
+    m_streams[idx]->state.store(SS_RELEASED, std::memory_order_release);
+}
+
+bool mck::SampleStreamer::IsReady(int idx)
+{
+    if (idx < 0 || idx >= (int)m_streams.size())
+    {
+        return false;
+    }
+    return m_streams[idx]->writePos.load(std::memory_order_acquire) > 0;
+}
+
+unsigned mck::SampleStreamer::GetUnderruns()
+{
+    return m_underruns.exchange(0, std::memory_order_relaxed);
+}
+
+unsigned mck::SampleStreamer::GetActiveStreams()
+{
+    unsigned active = 0;
+    for (auto &s : m_streams)
+    {
+        active += s->state.load(std::memory_order_relaxed) == SS_PLAYING ? 1 : 0;
+    }
+    return active;
+}
+
+void mck::SampleStreamer::ReadAheadThread()
+{
+    while (m_done.load() == false)
+    {
+        bool busy = false;
+        for (auto &s : m_streams)
+        {
+            int state = s->state.load(std::memory_order_acquire);
+            if (state == SS_RELEASED)
+            {
+                // Nothing reads the stream anymore, it can be reused
+                s->sample->users.fetch_sub(1, std::memory_order_release);
+                s->sample = nullptr;
+                s->state.store(SS_FREE, std::memory_order_release);
+            }
+            else if (state == SS_PLAYING)
+            {
+                busy = Fill(*s) || busy;
+            }
+        }
+        if (busy == false)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLER_STREAM_PERIOD_MS));
+        }
+    }
+}
+
+bool mck::SampleStreamer::Fill(Stream &s)
+{
+    size_t w = s.writePos.load(std::memory_order_relaxed);
+    size_t r = s.readPos.load(std::memory_order_acquire);
+    size_t n = std::min(SAMPLER_STREAM_RING_FRAMES - (w - r), s.length - w);
+
+    // Larger reads are cheaper, a new stream is filled right away
+    if (n == 0 || (w > 0 && n < SAMPLER_STREAM_RING_FRAMES / 4 && w + n < s.length))
+    {
+        return false;
+    }
+
+    const SampleBuffer &sample = *s.sample;
+    unsigned numChans = std::min((size_t)2, sample.channels.size());
+    size_t first = s.reverse ? s.start - w - (n - 1) : s.start + w;
+    for (unsigned c = 0; c < numChans; c++)
+    {
+        off_t pos = sample.dataOffset + (off_t)(c * sample.numFrames + first) * sizeof(float);
+        ssize_t bytes = pread(sample.fd, m_readBuffer.data(), n * sizeof(float), pos);
+        if (bytes != (ssize_t)(n * sizeof(float)))
+        {
+            std::fprintf(stderr, "Failed to stream sample data\n");
+            std::fill(m_readBuffer.begin(), m_readBuffer.begin() + n, 0.0f);
+        }
+        if (s.reverse)
+        {
+            std::reverse(m_readBuffer.begin(), m_readBuffer.begin() + n);
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            s.ring[c][(w + i) & (SAMPLER_STREAM_RING_FRAMES - 1)] = m_readBuffer[i];
+        }
+    }
+    s.writePos.store(w + n, std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+#include "Types.hpp"
+
+namespace mck
+{
+    const size_t SAMPLER_STREAM_THRESHOLD = 8 * 1024 * 1024; // Decoded bytes above which samples are streamed
+    const unsigned SAMPLER_STREAM_HEAD_FRAMES = 16384;        // Head and tail kept in RAM, cover the read-ahead latency
+    const unsigned SAMPLER_STREAM_RING_FRAMES = 65536;        // Per stream and channel, power of two
+    const unsigned SAMPLER_NUM_STREAMS = 16;
+    const unsigned SAMPLER_STREAM_PERIOD_MS = 2;
+
+    // Read-ahead for samples that only keep their head and tail in RAM, the RT side never blocks
+    class SampleStreamer
+    {
+    public:
+        SampleStreamer();
+        ~SampleStreamer();
+
+        bool Init();
+        void Close();
+
+        // RT thread: start streaming length frames from start, returns the stream index or -1
+        int Start(SampleBuffer *sample, size_t start, size_t length, bool reverse);
+        // RT thread: copies up to n frames in playback order to dst[c] + offset, returns the frames copied
+        unsigned Read(int idx, float **dst, unsigned offset, unsigned n);
+        // RT thread: hands the stream back to the read-ahead thread
+        void Release(int idx);
+        // RT thread: true once the first frames were read ahead
+        bool IsReady(int idx);
+
+        // Frames the RT thread was missing since the last call
+        unsigned GetUnderruns();
+        unsigned GetActiveStreams();
+
+    private:
+        enum StreamState
+        {
+            SS_FREE = 0,
+            SS_PLAYING,
+            SS_RELEASED,
+        };
+
+        struct Stream
+        {
+            std::atomic<int> state;
+            SampleBuffer *sample;
+            size_t start;
+            size_t length;
+            bool reverse;
+            std::atomic<size_t> readPos;
+            std::atomic<size_t> writePos;
+            std::vector<float> ring[2];
+            Stream() : state(SS_FREE), sample(nullptr), start(0), length(0), reverse(false), readPos(0), writePos(0) {}
+        };
+
+        void ReadAheadThread();
+        bool Fill(Stream &s);
+
+        bool m_isInitialized;
+        std::atomic<bool> m_done;
+        std::thread m_thread;
+        std::vector<std::unique_ptr<Stream>> m_streams;
+        std::vector<float> m_readBuffer;
+        std::atomic<unsigned> m_underruns;
+    };
+} // namespace mck
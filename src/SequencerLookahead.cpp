@@ -0,0 +1,268 @@
+#include "SequencerLookahead.hpp"
+#include <algorithm>
+#include <chrono>
+
+mck::SequencerLookahead::SequencerLookahead()
+    : m_isInitialized(false),
+      m_done(false),
+      m_sampleRate(48000),
+      m_timelineMutex(),
+      m_newTimeline(),
+      m_newSwitchTick(-1.0),
+      m_newEpoch(0),
+      m_timelineChanged(false),
+      m_ring(),
+      m_running(false),
+      m_epoch(0),
+      m_tick(0.0),
+      m_endTick(0.0),
+      m_ticksPerMs(1.0),
+      m_timeline(),
+      m_rendering(false),
+      m_renderEpoch(0),
+      m_renderedTick(0.0),
+      m_pending(),
+      m_pendingHead(0),
+      m_pendingTail(0),
+      m_rtEpoch(0),
+      m_rtRunning(false)
+{
+}
+
+mck::SequencerLookahead::~SequencerLookahead()
+{
+    Close();
+}
+
+bool mck::SequencerLookahead::Init(unsigned sampleRate)
+{
+    if (m_isInitialized)
+    {
+        return false;
+    }
+    m_sampleRate = std::max(1u, sampleRate);
+    m_done = false;
+    m_thread = std::thread(&mck::SequencerLookahead::RenderThread, this);
+    m_isInitialized = true;
+    return true;
+}
+
+void mck::SequencerLookahead::Close()
+{
+    if (m_isInitialized == false)
+    {
+        return;
+    }
+    m_done = true;
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    m_isInitialized = false;
+}
+
+void mck::SequencerLookahead::SetTimeline(const SequencerTimeline &timeline, double switchTick)
+{
+    std::lock_guard<std::mutex> lock(m_timelineMutex);
+    // Most config changes leave the patterns alone, the rendered events stay
+    if (timeline == m_newTimeline)
+    {
+        return;
+    }
+    m_newTimeline = timeline;
+    m_newSwitchTick = switchTick;
+    m_newEpoch = m_epoch.load(std::memory_order_acquire);
+    m_timelineChanged = true;
+}
+
+double mck::SequencerLookahead::GetNextBar() const
+{
+    if (m_running.load(std::memory_order_acquire) == false)
+    {
+        return -1.0;
+    }
+    // The RT thread might be in the buffer after the published one already and miss the update
+    // there. Past that and the margin, the render thread still has the time to rebuild
+    double tick = m_tick.load(std::memory_order_acquire);
+    double endTick = m_endTick.load(std::memory_order_acquire);
+    double margin = SAMPLER_LOOKAHEAD_MARGIN_MS * m_ticksPerMs.load(std::memory_order_acquire);
+    return std::ceil((endTick + (endTick - tick) + margin) / SAMPLER_TICKS_PER_BAR) * SAMPLER_TICKS_PER_BAR;
+}
+
+unsigned mck::SequencerLookahead::Process(const StepScheduler &scheduler, bool running, SequencerTrigger *triggers, unsigned maxTriggers)
+{
+    if (running == false)
+    {
+        if (m_rtRunning)
+        {
+            m_rtRunning = false;
+            m_pendingHead = m_pendingTail;
+        }
+        m_running.store(false, std::memory_order_release);
+        // Keeps the events primed for a start from the top
+        Drain(m_rtEpoch + 1);
+        return 0;
+    }
+    if (scheduler.HasJumped())
+    {
+        if (m_rtRunning == false && scheduler.GetStartTick() == 0.0)
+        {
+            m_rtEpoch += 1;
+        }
+        else
+        {
+            // Everything rendered before belongs to another position
+            m_rtEpoch += 2;
+            m_pendingHead = m_pendingTail;
+        }
+        m_rtRunning = true;
+    }
+    // The epoch goes last, whoever sees it also sees the position it started at
+    m_tick.store(scheduler.GetStartTick(), std::memory_order_release);
+    m_endTick.store(scheduler.GetTick((unsigned)(scheduler.GetBufferEnd() - scheduler.GetBufferStart())), std::memory_order_release);
+    m_ticksPerMs.store((double)m_sampleRate / (1000.0 * scheduler.GetFramesPerTick()), std::memory_order_release);
+    m_epoch.store(m_rtEpoch, std::memory_order_release);
+    m_running.store(true, std::memory_order_release);
+
+    Drain(m_rtEpoch);
+
+    unsigned numTriggers = 0;
+    int64_t bufferStart = scheduler.GetBufferStart();
+    int64_t lateFrames = (int64_t)(SAMPLER_LOOKAHEAD_LATE_MS * m_sampleRate / 1000.0);
+    while (m_pendingHead < m_pendingTail && numTriggers < maxTriggers)
+    {
+        const Event &p = m_pending[m_pendingHead & (SAMPLER_LOOKAHEAD_EVENTS - 1)];
+        int64_t frame = scheduler.GetFrame(p.tick);
+        if (frame >= scheduler.GetBufferEnd())
+        {
+            break;
+        }
+        m_pendingHead++;
+        if (bufferStart - frame > lateFrames)
+        {
+            continue;
+        }
+        triggers[numTriggers].padIdx = p.padIdx;
+        triggers[numTriggers].offset = (unsigned)(std::max(frame, bufferStart) - bufferStart);
+        triggers[numTriggers].strength = p.strength;
+        numTriggers++;
+    }
+    return numTriggers;
+}
+
+void mck::SequencerLookahead::Drain(unsigned epoch)
+{
+    Event e;
+    while (m_ring.Pop(e))
+    {
+        if (e.epoch != epoch)
+        {
+            continue;
+        }
+        if (e.type == SE_REBUILD)
+        {
+            // Pending events are sorted, the replaced ones are at the end
+            while (m_pendingTail > m_pendingHead && m_pending[(m_pendingTail - 1) & (SAMPLER_LOOKAHEAD_EVENTS - 1)].tick >= e.tick)
+            {
+                m_pendingTail--;
+            }
+        }
+        else if (m_pendingTail - m_pendingHead < SAMPLER_LOOKAHEAD_EVENTS)
+        {
+            m_pending[m_pendingTail & (SAMPLER_LOOKAHEAD_EVENTS - 1)] = e;
+            m_pendingTail++;
+        }
+    }
+}
+
+void mck::SequencerLookahead::RenderThread()
+{
+    while (m_done.load() == false)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLER_LOOKAHEAD_PERIOD_MS));
+
+        bool running = m_running.load(std::memory_order_acquire);
+        unsigned epoch = m_epoch.load(std::memory_order_acquire);
+        double tick = m_tick.load(std::memory_order_acquire);
+        double margin = SAMPLER_LOOKAHEAD_MARGIN_MS * m_ticksPerMs.load(std::memory_order_acquire);
+        if (running == false)
+        {
+            // A stopped transport most likely starts from the top, the RT thread takes on the
+            // next epoch then and finds the first bars already waiting
+            epoch += 1;
+            tick = 0.0;
+            margin = 0.0;
+        }
+        if (m_rendering == false || epoch != m_renderEpoch)
+        {
+            m_rendering = true;
+            m_renderEpoch = epoch;
+            m_renderedTick = tick;
+        }
+
+        std::unique_lock<std::mutex> lock(m_timelineMutex);
+        if (m_timelineChanged)
+        {
+            double start = tick + margin;
+            if (m_newSwitchTick >= 0.0 && running && m_newEpoch == epoch)
+            {
+                // The bar the RT thread flips the rest of the config on
+                start = m_newSwitchTick;
+            }
+            // Up to the switch the old timeline keeps playing
+            Render(start);
+            if (m_renderedTick >= start && m_ring.Push({SE_REBUILD, m_renderEpoch, start, 0, 0.0}))
+            {
+                m_renderedTick = start;
+                m_timeline = m_newTimeline;
+                m_timelineChanged = false;
+            }
+        }
+        lock.unlock();
+
+        Render(tick + SAMPLER_LOOKAHEAD_BARS * SAMPLER_TICKS_PER_BAR);
+    }
+}
+
+void mck::SequencerLookahead::Render(double to)
+{
+    if (m_renderedTick >= to)
+    {
+        return;
+    }
+    if (m_timeline.cycleTicks <= 0 || m_timeline.events.empty())
+    {
+        m_renderedTick = to;
+        return;
+    }
+
+    auto &events = m_timeline.events;
+    double cycle = (double)m_timeline.cycleTicks;
+    double cycleStart = std::floor(m_renderedTick / cycle) * cycle;
+    size_t idx = std::lower_bound(events.begin(), events.end(), m_renderedTick - cycleStart, [](const TimelineEvent &e, double t) {
+                     return e.tick < t;
+                 }) -
+                 events.begin();
+    while (true)
+    {
+        if (idx >= events.size())
+        {
+            idx = 0;
+            cycleStart += cycle;
+        }
+        double tick = cycleStart + events[idx].tick;
+        if (tick >= to)
+        {
+            break;
+        }
+        // Room for every pad on the same tick and a rebuild, so a tick is never rendered in part
+        if (SAMPLER_LOOKAHEAD_EVENTS - m_ring.GetSize() < 64)
+        {
+            m_renderedTick = tick;
+            return;
+        }
+        m_ring.Push({SE_TRIGGER, m_renderEpoch, tick, events[idx].padIdx, events[idx].strength});
+        idx++;
+    }
+    m_renderedTick = to;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include "SequencerTimeline.hpp"
+#include "StepScheduler.hpp"
+#include "SpscRing.hpp"
+
+namespace mck
+{
+    const unsigned SAMPLER_LOOKAHEAD_BARS = 2;
+    const unsigned SAMPLER_LOOKAHEAD_PERIOD_MS = 2;
+    const double SAMPLER_LOOKAHEAD_MARGIN_MS = 10.0; // A new timeline starts this far behind the RT thread
+    const double SAMPLER_LOOKAHEAD_LATE_MS = 20.0;   // Events rendered too late still play up to this
+    const size_t SAMPLER_LOOKAHEAD_EVENTS = 8192;    // Ring and pending events, power of two
+    const unsigned SAMPLER_MAX_TRIGGERS = 256;       // Per buffer
+
+    struct SequencerTrigger
+    {
+        unsigned padIdx;
+        unsigned offset; // Frame in the buffer
+        double strength;
+    };
+
+    // Renders the next bars of the timeline into timestamped events on its own thread. The RT
+    // thread only drains them, the cost of the patterns never reaches it
+    class SequencerLookahead
+    {
+    public:
+        SequencerLookahead();
+        ~SequencerLookahead();
+
+        bool Init(unsigned sampleRate);
+        void Close();
+
+        // Any thread but the RT thread. The timeline takes over at switchTick, a bar from GetNextBar,
+        // or right after the events that might already be playing if switchTick is negative
+        void SetTimeline(const SequencerTimeline &timeline, double switchTick);
+        // Any thread. The first bar a new timeline can still take over at, -1 while stopped
+        double GetNextBar() const;
+        // RT thread, after the scheduler placed the buffer. Returns the number of triggers written
+        unsigned Process(const StepScheduler &scheduler, bool running, SequencerTrigger *triggers, unsigned maxTriggers);
+
+    private:
+        enum EventType
+        {
+            SE_TRIGGER = 0,
+            SE_REBUILD, // Drops the pending events from its tick on
+        };
+        struct Event
+        {
+            char type;
+            unsigned epoch;
+            double tick; // From the start of the transport
+            unsigned padIdx;
+            double strength;
+        };
+
+        // RT thread, moves the events of an epoch from the ring to the pending ones
+        void Drain(unsigned epoch);
+        void RenderThread();
+        // Pushes the events of [m_renderedTick, to) until the ring is full
+        void Render(double to);
+
+        bool m_isInitialized;
+        std::atomic<bool> m_done;
+        std::thread m_thread;
+        unsigned m_sampleRate;
+
+        // Handed over to the render thread
+        std::mutex m_timelineMutex;
+        SequencerTimeline m_newTimeline;
+        double m_newSwitchTick;
+        unsigned m_newEpoch; // A switch tick of an older epoch has no meaning anymore
+        bool m_timelineChanged;
+
+        SpscRing<Event, SAMPLER_LOOKAHEAD_EVENTS> m_ring;
+        // Published by the RT thread once per buffer
+        std::atomic<bool> m_running;
+        std::atomic<unsigned> m_epoch; // Advances on transport starts and relocations
+        std::atomic<double> m_tick;
+        std::atomic<double> m_endTick;
+        std::atomic<double> m_ticksPerMs;
+
+        // Render thread
+        SequencerTimeline m_timeline;
+        bool m_rendering;
+        unsigned m_renderEpoch;
+        double m_renderedTick;
+
+        // RT thread, events waiting for their buffer
+        std::array<Event, SAMPLER_LOOKAHEAD_EVENTS> m_pending;
+        size_t m_pendingHead;
+        size_t m_pendingTail;
+        unsigned m_rtEpoch;
+        bool m_rtRunning;
+    };
+} // namespace mck
@@ -0,0 +1,121 @@
+#include "SequencerTimeline.hpp"
+#include "Groove.hpp"
+#include <algorithm>
+#include <numeric>
+
+namespace
+{
+    int64_t GetStepTicks(const mck::sampler::Pattern &pattern)
+    {
+        return mck::SAMPLER_TICKS_PER_BEAT / mck::sampler::CheckResolution(pattern.resolution);
+    }
+    unsigned GetNumPatterns(const mck::sampler::Pad &pad)
+    {
+        return std::min(pad.nPatterns, (unsigned)pad.patterns.size());
+    }
+    unsigned GetNumSteps(const mck::sampler::Pattern &pattern)
+    {
+        return std::min(pattern.nSteps, (unsigned)pattern.steps.size());
+    }
+} // namespace
+
+bool mck::operator==(const TimelineEvent &a, const TimelineEvent &b)
+{
+    return a.tick == b.tick && a.padIdx == b.padIdx && a.strength == b.strength;
+}
+
+bool mck::operator==(const SequencerTimeline &a, const SequencerTimeline &b)
+{
+    return a.cycleTicks == b.cycleTicks && a.events == b.events;
+}
+
+int64_t mck::GetChainTicks(const sampler::Pad &pad)
+{
+    int64_t ticks = 0;
+    bool active = false;
+    for (unsigned p = 0; p < GetNumPatterns(pad); p++)
+    {
+        auto &pattern = pad.patterns[p];
+        for (unsigned s = 0; s < GetNumSteps(pattern); s++)
+        {
+            active |= pattern.steps[s].active;
+        }
+        ticks += GetNumSteps(pattern) * GetStepTicks(pattern);
+    }
+    return active ? ticks : 0;
+}
+
+void mck::CompileTimeline(const sampler::Config &config, SequencerTimeline &timeline)
+{
+    timeline.cycleTicks = 0;
+    timeline.events.clear();
+
+    unsigned numPads = std::min(config.numPads, (unsigned)config.pads.size());
+    std::vector<int64_t> chainTicks(numPads, 0);
+    int64_t longest = 0;
+    bool fits = true;
+    // Grooves repeat every bar
+    int64_t grid = config.groove.type == sampler::GRV_STRAIGHT ? 0 : SAMPLER_TICKS_PER_BAR;
+    for (unsigned i = 0; i < numPads; i++)
+    {
+        chainTicks[i] = std::min(GetChainTicks(config.pads[i]), SAMPLER_MAX_CYCLE_TICKS);
+        if (chainTicks[i] == 0)
+        {
+            continue;
+        }
+        longest = std::max(longest, chainTicks[i]);
+        if (fits)
+        {
+            int64_t cycle = timeline.cycleTicks == 0 ? chainTicks[i] : std::lcm(timeline.cycleTicks, chainTicks[i]);
+            cycle = grid == 0 ? cycle : std::lcm(cycle, grid);
+            fits = cycle <= SAMPLER_MAX_CYCLE_TICKS;
+            timeline.cycleTicks = cycle;
+        }
+    }
+    if (longest == 0)
+    {
+        timeline.cycleTicks = 0;
+        return;
+    }
+    if (fits == false)
+    {
+        // The longest chain still plays through, the others are cut off where the cycle wraps
+        int64_t unit = grid == 0 ? longest : std::lcm(longest, grid);
+        unit = unit > SAMPLER_MAX_CYCLE_TICKS ? longest : unit;
+        timeline.cycleTicks = SAMPLER_MAX_CYCLE_TICKS / unit * unit;
+    }
+
+    for (unsigned i = 0; i < numPads; i++)
+    {
+        if (chainTicks[i] == 0)
+        {
+            continue;
+        }
+        auto &pad = config.pads[i];
+        for (int64_t start = 0; start < timeline.cycleTicks; start += chainTicks[i])
+        {
+            int64_t tick = start;
+            for (unsigned p = 0; p < GetNumPatterns(pad) && tick < timeline.cycleTicks; p++)
+            {
+                auto &pattern = pad.patterns[p];
+                int64_t stepTicks = GetStepTicks(pattern);
+                for (unsigned s = 0; s < GetNumSteps(pattern) && tick < timeline.cycleTicks; s++, tick += stepTicks)
+                {
+                    auto &step = pattern.steps[s];
+                    if (step.active)
+                    {
+                        double strength = (double)step.velocity / 127.0;
+                        double shifted = ApplyGroove(config.groove, tick + step.offset * stepTicks, strength);
+                        // Shifted past either end of the cycle, it plays at the other one
+                        shifted -= std::floor(shifted / timeline.cycleTicks) * timeline.cycleTicks;
+                        timeline.events.push_back({shifted, i, std::min(1.0, strength)});
+                    }
+                }
+            }
+        }
+    }
+
+    std::sort(timeline.events.begin(), timeline.events.end(), [](const TimelineEvent &a, const TimelineEvent &b) {
+        return a.tick < b.tick || (a.tick == b.tick && a.padIdx < b.padIdx);
+    });
+}
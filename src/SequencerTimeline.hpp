@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Config.hpp"
+#include "StepScheduler.hpp"
+
+namespace mck
+{
+    // Pads whose chains do not fit into a common cycle this long restart together after it
+    const int64_t SAMPLER_MAX_CYCLE_TICKS = (int64_t)SAMPLER_TICKS_PER_BAR * 256;
+
+    struct TimelineEvent
+    {
+        double tick; // In the cycle, with groove and micro timing
+        unsigned padIdx;
+        double strength;
+    };
+    bool operator==(const TimelineEvent &a, const TimelineEvent &b);
+
+    // Active steps of all pads over one cycle, sorted by tick. The cycle is the least common
+    // multiple of the pattern chain lengths, so pads of different lengths drift against each other.
+    // A groove makes it a whole number of bars
+    struct SequencerTimeline
+    {
+        int64_t cycleTicks;
+        std::vector<TimelineEvent> events;
+        SequencerTimeline() : cycleTicks(0), events() {}
+    };
+    bool operator==(const SequencerTimeline &a, const SequencerTimeline &b);
+
+    // Ticks the patterns of a pad play for in a row, 0 if the pad has no active step
+    int64_t GetChainTicks(const sampler::Pad &pad);
+    // Off the RT thread, the pads play their patterns one after the other. Groove and micro timing
+    // are resolved here, the scheduler turns the shifted ticks into frames
+    void CompileTimeline(const sampler::Config &config, SequencerTimeline &timeline);
+} // namespace mck
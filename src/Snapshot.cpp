@@ -0,0 +1,297 @@
+#include "Snapshot.hpp"
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+namespace
+{
+    class SnapshotWriter
+    {
+    public:
+        SnapshotWriter(std::string &data) : m_data(data) {}
+
+        template <typename T>
+        void Write(T value)
+        {
+            m_data.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+        void Write(bool value)
+        {
+            Write<uint8_t>(value ? 1 : 0);
+        }
+        void Write(const std::string &value)
+        {
+            Write<uint32_t>(value.size());
+            m_data.append(value);
+        }
+        void Write(const std::vector<std::string> &value)
+        {
+            Write<uint32_t>(value.size());
+            for (auto &v : value)
+            {
+                Write(v);
+            }
+        }
+
+    private:
+        std::string &m_data;
+    };
+
+    class SnapshotReader
+    {
+    public:
+        SnapshotReader(const std::string &data) : m_data(data), m_pos(0), m_valid(true) {}
+
+        template <typename T>
+        T Read()
+        {
+            T value{};
+            if (m_valid == false || m_pos + sizeof(T) > m_data.size())
+            {
+                m_valid = false;
+                return value;
+            }
+            std::memcpy(&value, m_data.data() + m_pos, sizeof(T));
+            m_pos += sizeof(T);
+            return value;
+        }
+        bool ReadBool()
+        {
+            return Read<uint8_t>() != 0;
+        }
+        std::string ReadString()
+        {
+            uint32_t len = Read<uint32_t>();
+            if (m_valid == false || m_pos + len > m_data.size())
+            {
+                m_valid = false;
+                return "";
+            }
+            std::string value = m_data.substr(m_pos, len);
+            m_pos += len;
+            return value;
+        }
+        std::vector<std::string> ReadStringList()
+        {
+            uint32_t count = Read<uint32_t>();
+            std::vector<std::string> value;
+            for (uint32_t i = 0; i < count && m_valid; i++)
+            {
+                value.push_back(ReadString());
+            }
+            return value;
+        }
+        // Guards vector sizes against corrupt files
+        uint32_t ReadCount(size_t minElementSize)
+        {
+            uint32_t count = Read<uint32_t>();
+            if (m_valid && (size_t)count * minElementSize > m_data.size() - m_pos)
+            {
+                m_valid = false;
+                return 0;
+            }
+            return count;
+        }
+        bool IsValid() const
+        {
+            return m_valid;
+        }
+
+    private:
+        const std::string &m_data;
+        size_t m_pos;
+        bool m_valid;
+    };
+} // namespace
+
+bool mck::sampler::IsSnapshot(const std::string &data)
+{
+    return data.size() >= sizeof(SNAPSHOT_MAGIC) && std::memcmp(data.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+}
+
+void mck::sampler::WriteSnapshot(const Config &config, std::string &data)
+{
+    data.clear();
+    data.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+
+    SnapshotWriter w(data);
+    w.Write<uint32_t>(SNAPSHOT_VERSION);
+
+    w.Write<double>(config.tempo);
+    w.Write<uint32_t>(config.numPads);
+    w.Write<uint32_t>(config.numSamples);
+    w.Write<uint32_t>(config.midiChan);
+    w.Write(config.reconnect);
+    w.Write(config.midiInConnections);
+    w.Write(config.midiOutConnections);
+    w.Write(config.audioLeftConnections);
+    w.Write(config.audioRightConnections);
+    w.Write(config.compactSamples);
+
+    w.Write<int8_t>(config.groove.type);
+    w.Write<double>(config.groove.swing);
+    for (unsigned i = 0; i < SAMPLER_GROOVE_SLOTS; i++)
+    {
+        w.Write<double>(config.groove.timing[i]);
+        w.Write<double>(config.groove.velocity[i]);
+    }
+    w.Write<uint32_t>(config.saveDelayMs);
+
+    w.Write<uint32_t>(config.pads.size());
+    for (auto &p : config.pads)
+    {
+        w.Write(p.available);
+        w.Write(p.reverse);
+        w.Write<uint32_t>(p.lengthMs);
+        w.Write<uint32_t>(p.maxLengthMs);
+        w.Write<uint32_t>(p.tone);
+        w.Write<uint32_t>(p.ctrl);
+        w.Write(p.samplePath);
+        w.Write(p.sampleName);
+        w.Write<double>(p.gain);
+        w.Write<double>(p.pan);
+        w.Write<double>(p.pitch);
+        w.Write<double>(p.startMs);
+
+        w.Write(p.delay.active);
+        w.Write<int8_t>(p.delay.type);
+        w.Write<uint32_t>(p.delay.timeMs);
+        w.Write<double>(p.delay.gain);
+        w.Write<double>(p.delay.feedback);
+
+        w.Write(p.comp.active);
+        w.Write<uint32_t>(p.comp.attackMs);
+        w.Write<uint32_t>(p.comp.releaseMs);
+        w.Write<double>(p.comp.threshold);
+        w.Write<double>(p.comp.ratio);
+        w.Write<double>(p.comp.makeup);
+
+        w.Write<uint32_t>(p.nPatterns);
+        w.Write<uint32_t>(p.patterns.size());
+        for (auto &pat : p.patterns)
+        {
+            w.Write<uint32_t>(pat.nSteps);
+            w.Write<uint32_t>(pat.resolution);
+            w.Write<uint32_t>(pat.steps.size());
+            for (auto &s : pat.steps)
+            {
+                w.Write(s.active);
+                w.Write<uint8_t>(s.velocity);
+                w.Write<double>(s.offset);
+            }
+        }
+    }
+}
+
+bool mck::sampler::ReadSnapshot(const std::string &data, Config &config)
+{
+    if (IsSnapshot(data) == false)
+    {
+        return false;
+    }
+
+    SnapshotReader r(data);
+    r.Read<uint32_t>(); // magic
+    unsigned version = r.Read<uint32_t>();
+    if (version == 0 || version > SNAPSHOT_VERSION)
+    {
+        return false;
+    }
+
+    Config c;
+    c.tempo = r.Read<double>();
+    c.numPads = r.Read<uint32_t>();
+    c.numSamples = r.Read<uint32_t>();
+    c.midiChan = r.Read<uint32_t>();
+    c.reconnect = r.ReadBool();
+    c.midiInConnections = r.ReadStringList();
+    c.midiOutConnections = r.ReadStringList();
+    c.audioLeftConnections = r.ReadStringList();
+    c.audioRightConnections = r.ReadStringList();
+    if (version >= 2)
+    {
+        c.compactSamples = r.ReadBool();
+    }
+    if (version >= 5)
+    {
+        c.groove.type = std::min((char)(GRV_LENGTH - 1), std::max((char)GRV_STRAIGHT, (char)r.Read<int8_t>()));
+        c.groove.swing = std::min(75.0, std::max(50.0, r.Read<double>()));
+        for (unsigned i = 0; i < SAMPLER_GROOVE_SLOTS; i++)
+        {
+            c.groove.timing[i] = std::min(0.45, std::max(-0.45, r.Read<double>()));
+            c.groove.velocity[i] = std::min(1.0, std::max(0.0, r.Read<double>()));
+        }
+    }
+    if (version >= 6)
+    {
+        c.saveDelayMs = std::min(SAMPLER_MAX_SAVE_DELAY_MS, (unsigned)r.Read<uint32_t>());
+    }
+
+    c.pads.resize(r.ReadCount(1));
+    for (auto &p : c.pads)
+    {
+        p.available = r.ReadBool();
+        p.reverse = r.ReadBool();
+        p.lengthMs = r.Read<uint32_t>();
+        p.maxLengthMs = r.Read<uint32_t>();
+        p.tone = r.Read<uint32_t>();
+        p.ctrl = r.Read<uint32_t>();
+        p.samplePath = r.ReadString();
+        p.sampleName = r.ReadString();
+        p.gain = r.Read<double>();
+        p.pan = r.Read<double>();
+        p.pitch = r.Read<double>();
+        if (version >= 3)
+        {
+            p.startMs = std::max(0.0, r.Read<double>());
+        }
+
+        p.delay.active = r.ReadBool();
+        p.delay.type = std::min((char)DLY_ANALOG, std::max((char)DLY_DIGITAL, (char)r.Read<int8_t>()));
+        p.delay.timeMs = std::max((unsigned)10, std::min((unsigned)1000, (unsigned)r.Read<uint32_t>()));
+        p.delay.gain = r.Read<double>();
+        p.delay.feedback = std::min(1.0, std::max(0.0, r.Read<double>()));
+
+        p.comp.active = r.ReadBool();
+        p.comp.attackMs = std::max((unsigned)1, std::min((unsigned)500, (unsigned)r.Read<uint32_t>()));
+        p.comp.releaseMs = std::max((unsigned)1, std::min((unsigned)1000, (unsigned)r.Read<uint32_t>()));
+        p.comp.threshold = std::max(-60.0, std::min(0.0, r.Read<double>()));
+        p.comp.ratio = std::max(1.0, std::min(10.0, r.Read<double>()));
+        p.comp.makeup = std::max(0.0, std::min(20.0, r.Read<double>()));
+
+        p.nPatterns = std::max(1u, std::min(SAMPLER_MAX_PATTERNS, (unsigned)r.Read<uint32_t>()));
+        p.patterns.resize(r.ReadCount(1));
+        for (auto &pat : p.patterns)
+        {
+            pat.nSteps = std::max(1u, std::min(SAMPLER_MAX_STEPS, (unsigned)r.Read<uint32_t>()));
+            if (version >= 4)
+            {
+                pat.resolution = CheckResolution(r.Read<uint32_t>());
+            }
+            pat.steps.resize(r.ReadCount(2));
+            for (auto &s : pat.steps)
+            {
+                s.active = r.ReadBool();
+                s.velocity = std::min((unsigned)127, (unsigned)r.Read<uint8_t>());
+                if (version >= 5)
+                {
+                    s.offset = std::min(SAMPLER_MAX_STEP_OFFSET, std::max(-SAMPLER_MAX_STEP_OFFSET, r.Read<double>()));
+                }
+            }
+            // Same as from_json, the counts decide and the arrays follow
+            pat.steps.resize(pat.nSteps);
+        }
+        p.patterns.resize(p.nPatterns);
+        if (r.IsValid() == false)
+        {
+            break;
+        }
+    }
+
+    if (r.IsValid() == false)
+    {
+        return false;
+    }
+    config = c;
+    return true;
+}
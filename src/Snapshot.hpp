@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include "Config.hpp"
+
+namespace mck
+{
+    namespace sampler
+    {
+        // Compact binary layout of a Config, used for the live config and saved kits.
+        // JSON stays the import / export format.
+        const char SNAPSHOT_MAGIC[4] = {'M', 'C', 'K', 'S'};
+        const unsigned SNAPSHOT_VERSION = 6;
+
+        bool IsSnapshot(const std::string &data);
+        void WriteSnapshot(const Config &config, std::string &data);
+        bool ReadSnapshot(const std::string &data, Config &config);
+    } // namespace sampler
+} // namespace mck
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace mck
+{
+    // Lock-free single producer / single consumer ring, safe to use from the RT thread
+    template <typename T, size_t Size>
+    class SpscRing
+    {
+        static_assert((Size & (Size - 1)) == 0, "SpscRing size must be a power of two");
+
+    public:
+        SpscRing() : m_data(), m_write(0), m_read(0) {}
+
+        bool Push(const T &value)
+        {
+            size_t w = m_write.load(std::memory_order_relaxed);
+            if (w - m_read.load(std::memory_order_acquire) >= Size)
+            {
+                return false;
+            }
+            m_data[w & (Size - 1)] = value;
+            m_write.store(w + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool Pop(T &value)
+        {
+            size_t r = m_read.load(std::memory_order_relaxed);
+            if (r == m_write.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            value = m_data[r & (Size - 1)];
+            m_read.store(r + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t GetSize() const
+        {
+            return m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::array<T, Size> m_data;
+        alignas(64) std::atomic<size_t> m_write;
+        alignas(64) std::atomic<size_t> m_read;
+    };
+} // namespace mck
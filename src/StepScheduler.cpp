@@ -0,0 +1,94 @@
+#include "StepScheduler.hpp"
+#include <algorithm>
+
+mck::StepScheduler::StepScheduler()
+    : m_sampleRate(48000),
+      m_running(false),
+      m_jumped(false),
+      m_tempo(120.0),
+      m_framesPerTick(25.0),
+      m_bufferStart(0),
+      m_bufferEnd(0),
+      m_anchorFrame(0),
+      m_anchorTick(0.0)
+{
+}
+
+mck::StepScheduler::~StepScheduler()
+{
+}
+
+void mck::StepScheduler::Init(unsigned sampleRate)
+{
+    m_sampleRate = std::max(1u, sampleRate);
+    m_running = false;
+}
+
+bool mck::StepScheduler::Process(bool running, double tempo, int transportTick, unsigned nframes)
+{
+    m_jumped = false;
+    if (running == false || tempo <= 0.0)
+    {
+        m_running = false;
+        return false;
+    }
+
+    if (m_running == false)
+    {
+        // The tick the transport starts on falls on the first frame
+        m_running = true;
+        m_jumped = true;
+        m_bufferEnd = 0;
+        m_anchorFrame = 0;
+        SetAnchor(std::max(0, transportTick), tempo);
+    }
+    else if (tempo != m_tempo)
+    {
+        // Ticks already played stay where they were, the grid bends from here on
+        SetAnchor(GetPosition(m_bufferEnd), tempo);
+    }
+    else if (transportTick >= 0)
+    {
+        // The transport may report its position anywhere in the buffer, only a larger gap is a relocation
+        double position = GetPosition(m_bufferEnd);
+        double tolerance = (double)nframes / m_framesPerTick + SAMPLER_TICKS_PER_BEAT / 4.0;
+        double diff = std::fmod(transportTick - std::fmod(position, SAMPLER_TICKS_PER_BAR) + 1.5 * SAMPLER_TICKS_PER_BAR, SAMPLER_TICKS_PER_BAR) - 0.5 * SAMPLER_TICKS_PER_BAR;
+        if (tolerance < 0.5 * SAMPLER_TICKS_PER_BAR && std::abs(diff) > tolerance)
+        {
+            m_jumped = true;
+            SetAnchor(std::floor(position / SAMPLER_TICKS_PER_BAR) * SAMPLER_TICKS_PER_BAR + transportTick, tempo);
+        }
+    }
+
+    m_bufferStart = m_bufferEnd;
+    m_bufferEnd += nframes;
+    return true;
+}
+
+bool mck::StepScheduler::FindGrid(unsigned interval, unsigned &offset) const
+{
+    if (m_running == false || interval == 0)
+    {
+        return false;
+    }
+    int64_t idx = (int64_t)std::floor(GetPosition(m_bufferStart) / interval);
+    while (GetFrame((double)(idx * interval)) < m_bufferStart)
+    {
+        idx++;
+    }
+    int64_t frame = GetFrame((double)(idx * interval));
+    if (frame >= m_bufferEnd)
+    {
+        return false;
+    }
+    offset = (unsigned)(frame - m_bufferStart);
+    return true;
+}
+
+void mck::StepScheduler::SetAnchor(double tick, double tempo)
+{
+    m_anchorFrame = m_bufferEnd;
+    m_anchorTick = tick;
+    m_tempo = tempo;
+    m_framesPerTick = (double)m_sampleRate * 60.0 / (tempo * SAMPLER_TICKS_PER_BEAT);
+}
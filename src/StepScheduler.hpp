@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+
+namespace mck
+{
+    const unsigned SAMPLER_TICKS_PER_BEAT = 960; // Divisible by every step resolution a pattern may use
+    const unsigned SAMPLER_BEATS_PER_BAR = 4;
+    const unsigned SAMPLER_TICKS_PER_BAR = SAMPLER_TICKS_PER_BEAT * SAMPLER_BEATS_PER_BAR;
+
+    // Maps sequencer ticks to exact frames. The tick grid is anchored to a frame and only moves
+    // with tempo changes, so the frames do not depend on the buffer size
+    class StepScheduler
+    {
+    public:
+        StepScheduler();
+        ~StepScheduler();
+
+        void Init(unsigned sampleRate);
+        // RT thread, once per buffer. transportTick is the tick in the bar the transport reports, it
+        // relocates the grid when it is too far off. Returns false while the transport is stopped
+        bool Process(bool running, double tempo, int transportTick, unsigned nframes);
+
+        // True if the grid does not continue the previous buffer, after a start or a relocation
+        bool HasJumped() const { return m_jumped; }
+        // Position in ticks at the first frame of the buffer
+        double GetStartTick() const { return GetPosition(m_bufferStart); }
+        // Tick at a frame of the buffer
+        double GetTick(unsigned offset) const { return GetPosition(m_bufferStart + offset); }
+        // Frame of a tick, counted from the start of the transport
+        int64_t GetFrame(double tick) const { return m_anchorFrame + std::llround((tick - m_anchorTick) * m_framesPerTick); }
+        double GetFramesPerTick() const { return m_framesPerTick; }
+        int64_t GetBufferStart() const { return m_bufferStart; }
+        int64_t GetBufferEnd() const { return m_bufferEnd; }
+        // Offset in the buffer of the first multiple of interval starting in it
+        bool FindGrid(unsigned interval, unsigned &offset) const;
+
+    private:
+        // Position in ticks at a frame of the current anchor
+        double GetPosition(int64_t frame) const { return m_anchorTick + (double)(frame - m_anchorFrame) / m_framesPerTick; }
+        void SetAnchor(double tick, double tempo);
+
+        unsigned m_sampleRate;
+        bool m_running;
+        bool m_jumped;
+        double m_tempo;
+        double m_framesPerTick;
+        int64_t m_bufferStart;
+        int64_t m_bufferEnd;
+        int64_t m_anchorFrame;
+        double m_anchorTick;
+    };
+} // namespace mck
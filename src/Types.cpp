@@ -1,4 +1,50 @@
 #include "Types.hpp"
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
+
+mck::SampleBuffer::~SampleBuffer()
+{
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappingSize);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+void mck::SampleBuffer::Update()
+{
+    channels.clear();
+    channels16.clear();
+    numFrames = buffer.empty() ? 0 : buffer[0].size();
+    for (auto &b : buffer)
+    {
+        channels.push_back(b.data());
+        numFrames = std::min(numFrames, b.size());
+    }
+    if (buffer.empty())
+    {
+        numFrames = compact.empty() ? 0 : compact[0].size();
+    }
+    for (auto &b : compact)
+    {
+        channels16.push_back(b.data());
+        numFrames = std::min(numFrames, b.size());
+    }
+    headFrames = numFrames;
+}
+
+void mck::to_json(nlohmann::json &j, const RealtimeStatus &s)
+{
+    j["transport"] = s.transport;
+    j["peak"] = {s.peak[0], s.peak[1]};
+    j["voices"] = s.voices;
+    j["streams"] = s.streams;
+    j["underruns"] = s.underruns;
+}
 
 void mck::to_json(nlohmann::json &j, const Connection &c)
 {
@@ -54,6 +100,12 @@ void mck::to_json(nlohmann::json &j, const SamplePackSample &s)
     j["name"] = s.name;
     j["type"] = s.type;
     j["index"] = s.index;
+    if (s.analysed)
+    {
+        j["onsetMs"] = s.onsetMs;
+        j["peakDb"] = s.peakDb;
+        j["loudness"] = s.loudness;
+    }
 }
 void mck::from_json(const nlohmann::json &j, SamplePackSample &s)
 {
@@ -61,6 +113,13 @@ void mck::from_json(const nlohmann::json &j, SamplePackSample &s)
     s.name = j.at("name").get<std::string>();
     s.type = j.at("type").get<unsigned>();
     s.index = j.at("index").get<unsigned>();
+    s.analysed = j.contains("onsetMs") && j.contains("peakDb") && j.contains("loudness");
+    if (s.analysed)
+    {
+        s.onsetMs = j.at("onsetMs").get<double>();
+        s.peakDb = j.at("peakDb").get<double>();
+        s.loudness = j.at("loudness").get<double>();
+    }
 }
 
 void mck::to_json(nlohmann::json &j, const SamplePack &s)
@@ -89,6 +148,7 @@ void mck::to_json(nlohmann::json &j, const SampleCommand &s)
     j["packIdx"] = s.packIdx;
     j["sampleIdx"] = s.sampleIdx;
     j["padIdx"] = s.padIdx;
+    j["sync"] = s.sync;
 }
 void mck::from_json(const nlohmann::json &j, SampleCommand &s)
 {
@@ -96,6 +156,10 @@ void mck::from_json(const nlohmann::json &j, SampleCommand &s)
     s.packIdx = j.at("packIdx").get<unsigned>();
     s.sampleIdx = j.at("sampleIdx").get<unsigned>();
     s.padIdx = j.at("padIdx").get<unsigned>();
+    if (j.contains("sync"))
+    {
+        s.sync = j.at("sync").get<bool>();
+    }
 }
 void mck::to_json(nlohmann::json &j, const SampleEdit &s)
 {
@@ -140,4 +204,186 @@ void mck::from_json(const nlohmann::json &j, SampleInfo &s) {
     s.lengthSamps = j.at("lengthSamps").get<unsigned>();
     s.path = j.at("path").get<std::string>();
     s.waveForm = j.at("waveForm").get<std::vector<std::vector<double>>>();
+}
+void mck::to_json(nlohmann::json &j, const PeakRequest &p)
+{
+    j["packIdx"] = p.packIdx;
+    j["sampleIdx"] = p.sampleIdx;
+    j["start"] = p.start;
+    j["end"] = p.end;
+    j["width"] = p.width;
+}
+void mck::from_json(const nlohmann::json &j, PeakRequest &p)
+{
+    p.packIdx = j.at("packIdx").get<unsigned>();
+    p.sampleIdx = j.at("sampleIdx").get<unsigned>();
+    p.start = j.at("start").get<size_t>();
+    p.end = j.at("end").get<size_t>();
+    p.width = j.at("width").get<unsigned>();
+}
+void mck::to_json(nlohmann::json &j, const WavePeakRange &p)
+{
+    j["packIdx"] = p.packIdx;
+    j["sampleIdx"] = p.sampleIdx;
+    j["level"] = p.level;
+    j["framesPerPeak"] = p.framesPerPeak;
+    j["start"] = p.start;
+    j["end"] = p.end;
+    j["min"] = p.min;
+    j["max"] = p.max;
+}
+void mck::from_json(const nlohmann::json &j, WavePeakRange &p)
+{
+    p.packIdx = j.at("packIdx").get<unsigned>();
+    p.sampleIdx = j.at("sampleIdx").get<unsigned>();
+    p.level = j.at("level").get<unsigned>();
+    p.framesPerPeak = j.at("framesPerPeak").get<size_t>();
+    p.start = j.at("start").get<size_t>();
+    p.end = j.at("end").get<size_t>();
+    p.min = j.at("min").get<std::vector<std::vector<int>>>();
+    p.max = j.at("max").get<std::vector<std::vector<int>>>();
+}
+void mck::to_json(nlohmann::json &j, const ImportProgress &p)
+{
+    j["batch"] = p.batch;
+    j["done"] = p.done;
+    j["failed"] = p.failed;
+    j["total"] = p.total;
+    j["file"] = p.file;
+    j["error"] = p.error;
+    j["finished"] = p.finished;
+}
+void mck::from_json(const nlohmann::json &j, ImportProgress &p)
+{
+    p.batch = j.at("batch").get<unsigned>();
+    p.done = j.at("done").get<unsigned>();
+    p.failed = j.at("failed").get<unsigned>();
+    p.total = j.at("total").get<unsigned>();
+    p.file = j.at("file").get<std::string>();
+    p.error = j.at("error").get<std::string>();
+    p.finished = j.at("finished").get<bool>();
+}
+void mck::to_json(nlohmann::json &j, const SimilarSample &s)
+{
+    j["packIdx"] = s.packIdx;
+    j["sampleIdx"] = s.sampleIdx;
+    j["distance"] = s.distance;
+}
+void mck::from_json(const nlohmann::json &j, SimilarSample &s)
+{
+    s.packIdx = j.at("packIdx").get<unsigned>();
+    s.sampleIdx = j.at("sampleIdx").get<unsigned>();
+    s.distance = j.at("distance").get<float>();
+}
+void mck::to_json(nlohmann::json &j, const SimilarSamples &s)
+{
+    j["packIdx"] = s.packIdx;
+    j["sampleIdx"] = s.sampleIdx;
+    j["samples"] = s.samples;
+}
+void mck::from_json(const nlohmann::json &j, SimilarSamples &s)
+{
+    s.packIdx = j.at("packIdx").get<unsigned>();
+    s.sampleIdx = j.at("sampleIdx").get<unsigned>();
+    s.samples = j.at("samples").get<std::vector<SimilarSample>>();
+}
+void mck::to_json(nlohmann::json &j, const SearchQuery &q)
+{
+    j["id"] = q.id;
+    j["text"] = q.text;
+    j["packs"] = q.packs;
+    j["categories"] = q.categories;
+    j["offset"] = q.offset;
+    j["count"] = q.count;
+}
+void mck::from_json(const nlohmann::json &j, SearchQuery &q)
+{
+    q.id = j.at("id").get<unsigned>();
+    q.text = j.at("text").get<std::string>();
+    if (j.contains("packs"))
+    {
+        q.packs = j.at("packs").get<std::vector<unsigned>>();
+    }
+    if (j.contains("categories"))
+    {
+        q.categories = j.at("categories").get<std::vector<std::string>>();
+    }
+    if (j.contains("offset"))
+    {
+        q.offset = j.at("offset").get<unsigned>();
+    }
+    if (j.contains("count"))
+    {
+        q.count = j.at("count").get<unsigned>();
+    }
+}
+void mck::to_json(nlohmann::json &j, const SearchHit &h)
+{
+    j["packIdx"] = h.packIdx;
+    j["sampleIdx"] = h.sampleIdx;
+    j["name"] = h.name;
+    j["pack"] = h.pack;
+    j["category"] = h.category;
+}
+void mck::from_json(const nlohmann::json &j, SearchHit &h)
+{
+    h.packIdx = j.at("packIdx").get<unsigned>();
+    h.sampleIdx = j.at("sampleIdx").get<unsigned>();
+    h.name = j.at("name").get<std::string>();
+    h.pack = j.at("pack").get<std::string>();
+    h.category = j.at("category").get<std::string>();
+}
+void mck::to_json(nlohmann::json &j, const SearchFacet &f)
+{
+    j["name"] = f.name;
+    j["count"] = f.count;
+}
+void mck::from_json(const nlohmann::json &j, SearchFacet &f)
+{
+    f.name = j.at("name").get<std::string>();
+    f.count = j.at("count").get<unsigned>();
+}
+void mck::to_json(nlohmann::json &j, const SearchResult &r)
+{
+    j["id"] = r.id;
+    j["total"] = r.total;
+    j["offset"] = r.offset;
+    j["samples"] = r.samples;
+    j["packCounts"] = r.packCounts;
+    j["categories"] = r.categories;
+}
+void mck::from_json(const nlohmann::json &j, SearchResult &r)
+{
+    r.id = j.at("id").get<unsigned>();
+    r.total = j.at("total").get<unsigned>();
+    r.offset = j.at("offset").get<unsigned>();
+    r.samples = j.at("samples").get<std::vector<SearchHit>>();
+    r.packCounts = j.at("packCounts").get<std::vector<unsigned>>();
+    r.categories = j.at("categories").get<std::vector<SearchFacet>>();
+}
+void mck::to_json(nlohmann::json &j, const KitInfo &k)
+{
+    j["name"] = k.name;
+    j["index"] = k.index;
+    j["resident"] = k.resident;
+    j["active"] = k.active;
+}
+void mck::from_json(const nlohmann::json &j, KitInfo &k)
+{
+    k.name = j.at("name").get<std::string>();
+    k.index = j.at("index").get<unsigned>();
+    k.resident = j.at("resident").get<bool>();
+    k.active = j.at("active").get<bool>();
+}
+void mck::to_json(nlohmann::json &j, const KitCommand &k)
+{
+    j["type"] = k.type;
+    j["index"] = k.index;
+    j["name"] = k.name;
+}
+void mck::from_json(const nlohmann::json &j, KitCommand &k)
+{
+    k.type = j.at("type").get<std::string>();
+    k.index = j.at("index").get<unsigned>();
+    k.name = j.at("name").get<std::string>();
 }
\ No newline at end of file
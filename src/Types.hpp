@@ -2,8 +2,10 @@
 #include <string>
 #include <vector>
 #include <atomic>
+#include <cstdint>
 #include <nlohmann/json.hpp>
 #include "helper/WaveHelper.hpp"
+#include "helper/Transport.hpp"
 //#include <rubberband/RubberBandStretcher.h>
 #include <q/fx/delay.hpp>
 #include <q/fx/lowpass.hpp>
@@ -12,17 +14,45 @@
 
 namespace mck
 {
+    // Decoded PCM at the engine rate, either owned or mapped from the sample cache
+    struct SampleBuffer
+    {
+        WaveInfo info;
+        std::vector<std::vector<float>> buffer;
+        // Channel pointers used by the mixer, into buffer or the mapping
+        std::vector<const float *> channels;
+        // Compact storage replaces buffer and channels, sample values are compact * scale
+        std::vector<std::vector<int16_t>> compact;
+        std::vector<const int16_t *> channels16;
+        float scale;
+        int quality; // Converter used for the sample rate conversion
+        size_t numFrames;
+        // Frames behind channels, streamed samples only keep their head in RAM
+        size_t headFrames;
+        // Last frames of a streamed sample, reverse voices start there
+        std::vector<std::vector<float>> tail;
+        size_t tailFrames;
+        void *mapping;
+        size_t mappingSize;
+        // Cache entry of a streamed sample
+        int fd;
+        size_t dataOffset;
+        // Voices and streams reading the buffer, retired buffers are freed at zero
+        std::atomic<unsigned> users;
+        SampleBuffer() : info(), buffer(), channels(), compact(), channels16(), scale(1.0f), quality(0), numFrames(0), headFrames(0), tail(), tailFrames(0), mapping(nullptr), mappingSize(0), fd(-1), dataOffset(0), users(0) {}
+        ~SampleBuffer();
+        SampleBuffer(const SampleBuffer &) = delete;
+        SampleBuffer &operator=(const SampleBuffer &) = delete;
+        // Points the channels to the owned buffer
+        void Update();
+        size_t GetMemSize() const
+        {
+            return headFrames * (channels.size() * sizeof(float) + channels16.size() * sizeof(int16_t)) + tailFrames * tail.size() * sizeof(float);
+        }
+    };
     struct AudioSample
     {
-        // Sample
-        bool update;
-        char curSample;
-        char curDelay;
-        char newDelay;
-        WaveInfo info[2];
-        std::vector<std::vector<float>> buffer[2];
-        // Delay
-        cycfi::q::delay *delay[2][2];
+        // Sample and delay lines come with the config slot of the pad, see Processing::ConfigSlot
         cycfi::q::one_pole_lowpass *lp[2];
         // Compressor
         cycfi::q::fast_rms_envelope_follower *env[2];
@@ -35,10 +65,6 @@ namespace mck
         RubberBand::RubberBandStretcher *pitcher;
         */
         AudioSample()
-            : update(false),
-              curSample(0),
-              curDelay(0),
-              newDelay(1)
         {
         }
         ~AudioSample()
@@ -66,6 +92,15 @@ namespace mck
             }
         }
     };
+    enum PadLoadState
+    {
+        PLS_EMPTY = 0,
+        PLS_LOADING,
+        PLS_READY,
+        PLS_FAILED,
+        PLS_LENGTH,
+    };
+
     struct AudioVoice
     {
         bool playSample;
@@ -76,8 +111,22 @@ namespace mck
         float gainL;
         float gainR;
         float pitch;
-        AudioVoice() : playSample(false), padIdx(0), startIdx(0), bufferIdx(0), bufferLen(0), gainL(0.0), gainR(0.0), pitch(1.0) {}
+        bool reverse;
+        int streamIdx;
+        SampleBuffer *sample; // Holds a reference while playing
+        AudioVoice() : playSample(false), padIdx(0), startIdx(0), bufferIdx(0), bufferLen(0), gainL(0.0), gainR(0.0), pitch(1.0), reverse(false), streamIdx(-1), sample(nullptr) {}
+    };
+    struct RealtimeStatus
+    {
+        TransportState transport;
+        float peak[2];
+        unsigned voices;
+        unsigned streams;
+        unsigned underruns; // Frames missed by streaming voices
+        RealtimeStatus() : transport(), peak{0.0f, 0.0f}, voices(0), streams(0), underruns(0) {}
     };
+    void to_json(nlohmann::json &j, const RealtimeStatus &s);
+
     struct Connection
     {
         std::string name;
@@ -122,11 +171,20 @@ namespace mck
         std::string name;
         unsigned type;
         unsigned index;
+        // Background analysis, only stored once it ran
+        bool analysed;
+        double onsetMs; // Leading silence
+        double peakDb;
+        double loudness; // Integrated, LUFS
         SamplePackSample()
             : path(""),
               name(""),
               type(0),
-              index(0) {}
+              index(0),
+              analysed(false),
+              onsetMs(0.0),
+              peakDb(0.0),
+              loudness(0.0) {}
     };
     void to_json(nlohmann::json &j, const SamplePackSample &s);
     void from_json(const nlohmann::json &j, SamplePackSample &s);
@@ -158,11 +216,13 @@ namespace mck
         unsigned packIdx;
         unsigned sampleIdx;
         unsigned padIdx;
+        bool sync; // Auditions start on the next beat
         SampleCommand()
             : type("show"),
               packIdx(0),
               sampleIdx(0),
-              padIdx(0) {}
+              padIdx(0),
+              sync(false) {}
     };
     void to_json(nlohmann::json &j, const SampleCommand &s);
     void from_json(const nlohmann::json &j, SampleCommand &s);
@@ -174,6 +234,7 @@ namespace mck
         SCMD_CHANGE,
         SCMD_IMPORT,
         SCMD_EXPORT,
+        SCMD_ANALYSE,
         SCMD_LENGTH
     };
 
@@ -241,4 +302,187 @@ namespace mck
     };
     void to_json(nlohmann::json &j, const SampleInfo &s);
     void from_json(const nlohmann::json &j, SampleInfo &s);
+
+    struct PeakRequest
+    {
+        unsigned packIdx;
+        unsigned sampleIdx;
+        size_t start; // Frame range of the source file
+        size_t end;
+        unsigned width; // Columns the GUI draws
+        PeakRequest()
+            : packIdx(0),
+              sampleIdx(0),
+              start(0),
+              end(0),
+              width(0) {}
+    };
+    void to_json(nlohmann::json &j, const PeakRequest &p);
+    void from_json(const nlohmann::json &j, PeakRequest &p);
+
+    struct WavePeakRange
+    {
+        unsigned packIdx;
+        unsigned sampleIdx;
+        unsigned level;
+        size_t framesPerPeak;
+        size_t start;
+        size_t end;
+        // Per channel and column, scaled to +-32767
+        std::vector<std::vector<int>> min;
+        std::vector<std::vector<int>> max;
+        WavePeakRange()
+            : packIdx(0),
+              sampleIdx(0),
+              level(0),
+              framesPerPeak(0),
+              start(0),
+              end(0),
+              min(),
+              max() {}
+    };
+    void to_json(nlohmann::json &j, const WavePeakRange &p);
+    void from_json(const nlohmann::json &j, WavePeakRange &p);
+
+    struct ImportProgress
+    {
+        unsigned batch;
+        unsigned done; // Files converted or failed so far
+        unsigned failed;
+        unsigned total;
+        std::string file; // Last file handled
+        std::string error; // Empty if it was converted
+        bool finished;
+        ImportProgress()
+            : batch(0),
+              done(0),
+              failed(0),
+              total(0),
+              file(""),
+              error(""),
+              finished(false) {}
+    };
+    void to_json(nlohmann::json &j, const ImportProgress &p);
+    void from_json(const nlohmann::json &j, ImportProgress &p);
+
+    struct SimilarSample
+    {
+        unsigned packIdx;
+        unsigned sampleIdx;
+        float distance;
+        SimilarSample()
+            : packIdx(0),
+              sampleIdx(0),
+              distance(0.0f) {}
+    };
+    void to_json(nlohmann::json &j, const SimilarSample &s);
+    void from_json(const nlohmann::json &j, SimilarSample &s);
+
+    struct SimilarSamples
+    {
+        unsigned packIdx; // The sample the others are compared to
+        unsigned sampleIdx;
+        std::vector<SimilarSample> samples; // Closest first
+        SimilarSamples()
+            : packIdx(0),
+              sampleIdx(0),
+              samples() {}
+    };
+    void to_json(nlohmann::json &j, const SimilarSamples &s);
+    void from_json(const nlohmann::json &j, SimilarSamples &s);
+
+    struct SearchQuery
+    {
+        unsigned id; // Echoed in the result, the GUI drops answers to outdated queries
+        std::string text;
+        std::vector<unsigned> packs; // Facets, empty selects all
+        std::vector<std::string> categories;
+        unsigned offset;
+        unsigned count;
+        SearchQuery()
+            : id(0),
+              text(""),
+              packs(),
+              categories(),
+              offset(0),
+              count(0) {}
+    };
+    void to_json(nlohmann::json &j, const SearchQuery &q);
+    void from_json(const nlohmann::json &j, SearchQuery &q);
+
+    struct SearchHit
+    {
+        unsigned packIdx;
+        unsigned sampleIdx;
+        std::string name;
+        std::string pack;
+        std::string category;
+        SearchHit()
+            : packIdx(0),
+              sampleIdx(0),
+              name(""),
+              pack(""),
+              category("") {}
+    };
+    void to_json(nlohmann::json &j, const SearchHit &h);
+    void from_json(const nlohmann::json &j, SearchHit &h);
+
+    struct SearchFacet
+    {
+        std::string name;
+        unsigned count;
+        SearchFacet()
+            : name(""),
+              count(0) {}
+    };
+    void to_json(nlohmann::json &j, const SearchFacet &f);
+    void from_json(const nlohmann::json &j, SearchFacet &f);
+
+    struct SearchResult
+    {
+        unsigned id;
+        unsigned total; // Matches of all pages
+        unsigned offset;
+        std::vector<SearchHit> samples;
+        // Matches per pack and category, each counted with the other facet applied
+        std::vector<unsigned> packCounts;
+        std::vector<SearchFacet> categories;
+        SearchResult()
+            : id(0),
+              total(0),
+              offset(0),
+              samples(),
+              packCounts(),
+              categories() {}
+    };
+    void to_json(nlohmann::json &j, const SearchResult &r);
+    void from_json(const nlohmann::json &j, SearchResult &r);
+
+    struct KitInfo
+    {
+        std::string name;
+        unsigned index;
+        bool resident;
+        bool active;
+        KitInfo()
+            : name(""),
+              index(0),
+              resident(false),
+              active(false) {}
+    };
+    void to_json(nlohmann::json &j, const KitInfo &k);
+    void from_json(const nlohmann::json &j, KitInfo &k);
+
+    struct KitCommand
+    {
+        std::string type;
+        unsigned index;
+        std::string name;
+        KitCommand()
+            : type("select"),
+              index(0),
+              name("") {}
+    };
+    void to_json(nlohmann::json &j, const KitCommand &k);
+    void from_json(const nlohmann::json &j, KitCommand &k);
 }
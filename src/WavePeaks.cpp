@@ -0,0 +1,315 @@
+#include "WavePeaks.hpp"
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <sndfile.h>
+
+namespace fs = std::filesystem;
+
+mck::WavePeaks::WavePeaks()
+    : m_sampleRate(0),
+      m_numChans(0),
+      m_numFrames(0),
+      m_levels()
+{
+}
+
+mck::WavePeaks::~WavePeaks()
+{
+}
+
+bool mck::WavePeaks::Build(std::string path)
+{
+    SF_INFO info;
+    std::memset(&info, 0, sizeof(SF_INFO));
+    SNDFILE *file = sf_open(path.c_str(), SFM_READ, &info);
+    if (file == nullptr)
+    {
+        std::fprintf(stderr, "Failed to open %s for peak analysis: %s\n", path.c_str(), sf_strerror(nullptr));
+        return false;
+    }
+    if (info.channels <= 0 || info.frames <= 0)
+    {
+        sf_close(file);
+        return false;
+    }
+
+    m_sampleRate = info.samplerate;
+    m_numChans = std::min(2, info.channels);
+    m_numFrames = info.frames;
+    m_levels.clear();
+
+    Level base;
+    base.framesPerPeak = WAVE_PEAKS_BASE_FRAMES;
+    base.numPeaks = (m_numFrames + WAVE_PEAKS_BASE_FRAMES - 1) / WAVE_PEAKS_BASE_FRAMES;
+    base.peaks.resize(m_numChans, std::vector<int16_t>(base.numPeaks * 2, 0));
+
+    // Blocks are a multiple of the peak size, so peaks never span two reads
+    const size_t blockFrames = WAVE_PEAKS_BASE_FRAMES * 256;
+    std::vector<float> block(blockFrames * info.channels);
+    size_t pos = 0;
+    while (pos < m_numFrames)
+    {
+        sf_count_t n = sf_readf_float(file, block.data(), blockFrames);
+        if (n <= 0)
+        {
+            break;
+        }
+        for (unsigned c = 0; c < m_numChans; c++)
+        {
+            for (sf_count_t i = 0; i < n; i += WAVE_PEAKS_BASE_FRAMES)
+            {
+                float mn = 1.0f;
+                float mx = -1.0f;
+                sf_count_t end = std::min(n, i + (sf_count_t)WAVE_PEAKS_BASE_FRAMES);
+                for (sf_count_t s = i; s < end; s++)
+                {
+                    float v = block[s * info.channels + c];
+                    mn = std::min(mn, v);
+                    mx = std::max(mx, v);
+                }
+                size_t p = (pos + i) / WAVE_PEAKS_BASE_FRAMES;
+                base.peaks[c][2 * p] = (int16_t)std::lrint(std::max(-1.0f, mn) * 32767.0f);
+                base.peaks[c][2 * p + 1] = (int16_t)std::lrint(std::min(1.0f, mx) * 32767.0f);
+            }
+        }
+        pos += n;
+    }
+    sf_close(file);
+
+    m_levels.push_back(std::move(base));
+    AddLevels();
+    return true;
+}
+
+bool mck::WavePeaks::Load(std::string entryPath, std::string path)
+{
+    Header key;
+    if (GetKey(path, key) == false)
+    {
+        return false;
+    }
+    FILE *file = std::fopen(entryPath.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    Header header;
+    if (std::fread(&header, sizeof(Header), 1, file) != 1 ||
+        std::memcmp(header.magic, key.magic, sizeof(key.magic)) != 0 ||
+        header.version != key.version ||
+        header.fileSize != key.fileSize ||
+        header.mtime != key.mtime ||
+        header.baseFrames != WAVE_PEAKS_BASE_FRAMES ||
+        header.factor != WAVE_PEAKS_FACTOR ||
+        header.numChans == 0 ||
+        header.numChans > 2 ||
+        header.numLevels == 0)
+    {
+        std::fclose(file);
+        return false;
+    }
+
+    m_sampleRate = header.sampleRate;
+    m_numChans = header.numChans;
+    m_numFrames = header.numFrames;
+    m_levels.resize(header.numLevels);
+    size_t framesPerPeak = WAVE_PEAKS_BASE_FRAMES;
+    bool ok = true;
+    for (auto &level : m_levels)
+    {
+        level.framesPerPeak = framesPerPeak;
+        level.numPeaks = (m_numFrames + framesPerPeak - 1) / framesPerPeak;
+        level.peaks.resize(m_numChans);
+        for (auto &p : level.peaks)
+        {
+            p.resize(level.numPeaks * 2);
+            ok = ok && std::fread(p.data(), sizeof(int16_t), p.size(), file) == p.size();
+        }
+        framesPerPeak *= WAVE_PEAKS_FACTOR;
+    }
+    std::fclose(file);
+
+    if (ok == false)
+    {
+        m_levels.clear();
+    }
+    return ok;
+}
+
+bool mck::WavePeaks::Store(std::string entryPath, std::string path)
+{
+    Header header;
+    if (m_levels.empty() || GetKey(path, header) == false)
+    {
+        return false;
+    }
+    header.sampleRate = m_sampleRate;
+    header.numChans = m_numChans;
+    header.numFrames = m_numFrames;
+    header.numLevels = m_levels.size();
+
+    std::error_code ec;
+    fs::create_directories(fs::path(entryPath).parent_path(), ec);
+    // The scan and a GUI request may store the same sample at once
+    std::string tmpPath = entryPath + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    FILE *file = std::fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(Header), 1, file) == 1;
+    for (auto &level : m_levels)
+    {
+        for (auto &p : level.peaks)
+        {
+            ok = ok && std::fwrite(p.data(), sizeof(int16_t), p.size(), file) == p.size();
+        }
+    }
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (ok == false || std::rename(tmpPath.c_str(), entryPath.c_str()) != 0)
+    {
+        std::remove(tmpPath.c_str());
+        std::fprintf(stderr, "Failed to write peak file %s\n", entryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool mck::WavePeaks::IsValid(std::string entryPath, std::string path)
+{
+    Header key;
+    if (GetKey(path, key) == false)
+    {
+        return false;
+    }
+    FILE *file = std::fopen(entryPath.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    Header header;
+    bool ok = std::fread(&header, sizeof(Header), 1, file) == 1 &&
+              std::memcmp(header.magic, key.magic, sizeof(key.magic)) == 0 &&
+              header.version == key.version &&
+              header.fileSize == key.fileSize &&
+              header.mtime == key.mtime &&
+              header.baseFrames == WAVE_PEAKS_BASE_FRAMES &&
+              header.factor == WAVE_PEAKS_FACTOR;
+    std::fclose(file);
+    return ok;
+}
+
+std::string mck::WavePeaks::GetEntryPath(std::string packPath, std::string relPath)
+{
+    fs::path entryPath(packPath);
+    entryPath.append(".peaks").append(relPath + ".mckpk");
+    return entryPath.string();
+}
+
+bool mck::WavePeaks::GetRange(size_t start, size_t end, unsigned width, WavePeakRange &range)
+{
+    end = std::min(end, m_numFrames);
+    if (m_levels.empty() || start >= end || width == 0)
+    {
+        return false;
+    }
+
+    // Coarsest level that still resolves every column
+    size_t framesPerColumn = (end - start) / width;
+    unsigned levelIdx = 0;
+    while (levelIdx + 1 < m_levels.size() && m_levels[levelIdx + 1].framesPerPeak <= framesPerColumn)
+    {
+        levelIdx++;
+    }
+    const Level &level = m_levels[levelIdx];
+
+    size_t firstPeak = start / level.framesPerPeak;
+    size_t lastPeak = (end + level.framesPerPeak - 1) / level.framesPerPeak;
+    unsigned numCols = (unsigned)std::min((size_t)width, lastPeak - firstPeak);
+
+    range.level = levelIdx;
+    range.framesPerPeak = level.framesPerPeak;
+    range.start = start;
+    range.end = end;
+    range.min.assign(m_numChans, std::vector<int>(numCols, 0));
+    range.max.assign(m_numChans, std::vector<int>(numCols, 0));
+    for (unsigned c = 0; c < m_numChans; c++)
+    {
+        for (unsigned col = 0; col < numCols; col++)
+        {
+            size_t p0 = firstPeak + col * (lastPeak - firstPeak) / numCols;
+            size_t p1 = std::max(p0 + 1, firstPeak + (col + 1) * (lastPeak - firstPeak) / numCols);
+            int mn = 32767;
+            int mx = -32767;
+            for (size_t p = p0; p < p1; p++)
+            {
+                mn = std::min(mn, (int)level.peaks[c][2 * p]);
+                mx = std::max(mx, (int)level.peaks[c][2 * p + 1]);
+            }
+            range.min[c][col] = mn;
+            range.max[c][col] = mx;
+        }
+    }
+    return true;
+}
+
+bool mck::WavePeaks::GetKey(std::string path, Header &key)
+{
+    std::error_code ec;
+    uintmax_t fileSize = fs::file_size(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    std::memset(&key, 0, sizeof(Header));
+    std::memcpy(key.magic, WAVE_PEAKS_MAGIC, sizeof(key.magic));
+    key.version = WAVE_PEAKS_VERSION;
+    key.fileSize = fileSize;
+    key.mtime = mtime.time_since_epoch().count();
+    key.baseFrames = WAVE_PEAKS_BASE_FRAMES;
+    key.factor = WAVE_PEAKS_FACTOR;
+    return true;
+}
+
+void mck::WavePeaks::AddLevels()
+{
+    while (m_levels.back().numPeaks > WAVE_PEAKS_MIN_PEAKS)
+    {
+        const Level &prev = m_levels.back();
+        Level next;
+        next.framesPerPeak = prev.framesPerPeak * WAVE_PEAKS_FACTOR;
+        next.numPeaks = (m_numFrames + next.framesPerPeak - 1) / next.framesPerPeak;
+        next.peaks.resize(m_numChans, std::vector<int16_t>(next.numPeaks * 2, 0));
+        for (unsigned c = 0; c < m_numChans; c++)
+        {
+            for (size_t p = 0; p < next.numPeaks; p++)
+            {
+                size_t p0 = p * WAVE_PEAKS_FACTOR;
+                size_t p1 = std::min(prev.numPeaks, p0 + WAVE_PEAKS_FACTOR);
+                int16_t mn = prev.peaks[c][2 * p0];
+                int16_t mx = prev.peaks[c][2 * p0 + 1];
+                for (size_t q = p0 + 1; q < p1; q++)
+                {
+                    mn = std::min(mn, prev.peaks[c][2 * q]);
+                    mx = std::max(mx, prev.peaks[c][2 * q + 1]);
+                }
+                next.peaks[c][2 * p] = mn;
+                next.peaks[c][2 * p + 1] = mx;
+            }
+        }
+        m_levels.push_back(std::move(next));
+    }
+}
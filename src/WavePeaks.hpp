@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Types.hpp"
+
+namespace mck
+{
+    const char WAVE_PEAKS_MAGIC[4] = {'M', 'C', 'K', 'W'};
+    const unsigned WAVE_PEAKS_VERSION = 1;
+    const unsigned WAVE_PEAKS_BASE_FRAMES = 64; // Source frames per peak on level 0
+    const unsigned WAVE_PEAKS_FACTOR = 4;       // Peaks merged into one on the next level
+    const unsigned WAVE_PEAKS_MIN_PEAKS = 256;  // The coarsest level still has this many peaks
+
+    // Min/max peak pyramid of a sample file, levels are computed once and stored next to the pack
+    class WavePeaks
+    {
+    public:
+        WavePeaks();
+        ~WavePeaks();
+
+        // Decodes the file at its own rate and computes all levels
+        bool Build(std::string path);
+        // Loads an entry written by Store, fails if the source file changed since
+        bool Load(std::string entryPath, std::string path);
+        bool Store(std::string entryPath, std::string path);
+        // Header check only, used to skip samples with an up to date entry
+        static bool IsValid(std::string entryPath, std::string path);
+        // Entries live in the pack folder, mirroring its category folders
+        static std::string GetEntryPath(std::string packPath, std::string relPath);
+
+        // Picks the coarsest level with at least width peaks in [start, end) and merges it down to width columns
+        bool GetRange(size_t start, size_t end, unsigned width, WavePeakRange &range);
+
+        unsigned GetNumLevels() { return m_levels.size(); }
+        size_t GetNumFrames() { return m_numFrames; }
+        unsigned GetSampleRate() { return m_sampleRate; }
+
+    private:
+        struct Header
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t fileSize;
+            int64_t mtime;
+            uint32_t sampleRate;
+            uint32_t numChans;
+            uint64_t numFrames;
+            uint32_t numLevels;
+            uint32_t baseFrames;
+            uint32_t factor;
+        };
+        struct Level
+        {
+            size_t framesPerPeak;
+            size_t numPeaks;
+            // Per channel, interleaved min and max
+            std::vector<std::vector<int16_t>> peaks;
+        };
+
+        static bool GetKey(std::string path, Header &key);
+        void AddLevels();
+
+        unsigned m_sampleRate;
+        unsigned m_numChans;
+        size_t m_numFrames;
+        std::vector<Level> m_levels;
+    };
+} // namespace mck
@@ -0,0 +1,166 @@
+// Checks the 16 bit mix kernels against the scalar float path and compares the throughput of float
+// and 16 bit storage with many voices. Returns 1 if a kernel does not match
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "MixKernel.hpp"
+
+const unsigned NUM_VOICES = 64;
+const unsigned SAMPLE_FRAMES = 48000 * 5; // Per voice and channel, far beyond the caches
+const unsigned BLOCK_FRAMES = 128;
+const unsigned NUM_PASSES = 5;
+
+struct Sample
+{
+    std::vector<float> data[2];
+    std::vector<int16_t> compact[2];
+    float scale;
+};
+
+static void CreateSample(Sample &s, unsigned numFrames, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> dist(-0.9f, 0.9f);
+    float peak = 0.0f;
+    for (unsigned c = 0; c < 2; c++)
+    {
+        s.data[c].resize(numFrames);
+        for (auto &v : s.data[c])
+        {
+            v = dist(rng);
+            peak = std::max(peak, std::abs(v));
+        }
+    }
+    // Same conversion as KitBank::CompactSample
+    s.scale = peak > 0.0f ? peak / 32767.0f : 1.0f;
+    for (unsigned c = 0; c < 2; c++)
+    {
+        s.compact[c].resize(numFrames);
+        for (unsigned i = 0; i < numFrames; i++)
+        {
+            s.compact[c][i] = (int16_t)std::lrint(s.data[c][i] / s.scale);
+        }
+    }
+}
+
+static bool CheckKernels(const Sample &s)
+{
+    // Every length around the vector width, at unaligned positions, in both directions
+    const float gain = 0.7f;
+    float maxDiff = 0.0f;
+    float maxQuantDiff = 0.0f;
+    for (unsigned len = 0; len < 67; len++)
+    {
+        for (unsigned pos = 100; pos < 108; pos++)
+        {
+            for (int reverse = 0; reverse < 2; reverse++)
+            {
+                std::vector<float> kernel(len + 1, 0.25f);
+                std::vector<float> scalar(len + 1, 0.25f);
+                std::vector<float> floatPath(len + 1, 0.25f);
+                if (reverse)
+                {
+                    mck::MixInt16Reverse(kernel.data(), s.compact[0].data() + pos, gain * s.scale, len);
+                }
+                else
+                {
+                    mck::MixInt16(kernel.data(), s.compact[0].data() + pos, gain * s.scale, len);
+                }
+                for (unsigned i = 0; i < len; i++)
+                {
+                    unsigned idx = reverse ? pos - i : pos + i;
+                    scalar[i] += (float)s.compact[0][idx] * gain * s.scale;
+                    floatPath[i] += s.data[0][idx] * gain;
+                }
+                // The frame behind the block is never touched
+                if (kernel[len] != 0.25f)
+                {
+                    std::printf("FAIL: %s kernel writes past %u frames\n", reverse ? "reverse" : "forward", len);
+                    return false;
+                }
+                for (unsigned i = 0; i < len; i++)
+                {
+                    maxDiff = std::max(maxDiff, std::abs(kernel[i] - scalar[i]));
+                    maxQuantDiff = std::max(maxQuantDiff, std::abs(kernel[i] - floatPath[i]));
+                }
+            }
+        }
+    }
+    // Widening is exact, only the order of the gain multiplications may round differently
+    float quantStep = gain * s.scale;
+    bool ok = maxDiff <= 1e-6f && maxQuantDiff <= 0.5f * quantStep + 1e-6f;
+    std::printf("%s: kernels against the scalar path, max diff %.2e, against float storage %.2e (half a step %.2e)\n",
+                ok ? "PASS" : "FAIL", maxDiff, maxQuantDiff, 0.5f * quantStep);
+    return ok;
+}
+
+template <typename MixBlock>
+static double MeasureMix(MixBlock mix)
+{
+    std::vector<float> dst[2];
+    dst[0].resize(BLOCK_FRAMES);
+    dst[1].resize(BLOCK_FRAMES);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned pass = 0; pass < NUM_PASSES; pass++)
+    {
+        for (unsigned pos = 0; pos + BLOCK_FRAMES <= SAMPLE_FRAMES; pos += BLOCK_FRAMES)
+        {
+            std::fill(dst[0].begin(), dst[0].end(), 0.0f);
+            std::fill(dst[1].begin(), dst[1].end(), 0.0f);
+            for (unsigned v = 0; v < NUM_VOICES; v++)
+            {
+                mix(v, pos, dst);
+            }
+        }
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / NUM_PASSES;
+}
+
+int main()
+{
+#if defined(__SSE2__)
+    std::printf("Kernel: SSE2\n");
+#elif defined(__ARM_NEON)
+    std::printf("Kernel: NEON\n");
+#else
+    std::printf("Kernel: scalar\n");
+#endif
+    std::mt19937 rng(1);
+    std::vector<Sample> samples(NUM_VOICES);
+    for (auto &s : samples)
+    {
+        CreateSample(s, SAMPLE_FRAMES, rng);
+    }
+
+    bool ok = CheckKernels(samples[0]);
+
+    const float gain = 0.7f;
+    double floatMs = MeasureMix([&](unsigned v, unsigned pos, std::vector<float> *dst) {
+        const Sample &s = samples[v];
+        for (unsigned c = 0; c < 2; c++)
+        {
+            const float *src = s.data[c].data() + pos;
+            for (unsigned i = 0; i < BLOCK_FRAMES; i++)
+            {
+                dst[c][i] += src[i] * gain;
+            }
+        }
+    });
+    double compactMs = MeasureMix([&](unsigned v, unsigned pos, std::vector<float> *dst) {
+        const Sample &s = samples[v];
+        for (unsigned c = 0; c < 2; c++)
+        {
+            mck::MixInt16(dst[c].data(), s.compact[c].data() + pos, gain * s.scale, BLOCK_FRAMES);
+        }
+    });
+
+    double frames = (double)NUM_VOICES * 2 * (SAMPLE_FRAMES / BLOCK_FRAMES * BLOCK_FRAMES);
+    std::printf("%u stereo voices, %u s each, %u frame blocks\n", NUM_VOICES, SAMPLE_FRAMES / 48000, BLOCK_FRAMES);
+    std::printf("float: %7.2f ms per pass, %5.2f GB/s sample data\n", floatMs, frames * sizeof(float) / (floatMs * 1e6));
+    std::printf("int16: %7.2f ms per pass, %5.2f GB/s sample data, %.2fx faster\n", compactMs, frames * sizeof(int16_t) / (compactMs * 1e6), floatMs / compactMs);
+    return ok ? 0 : 1;
+}
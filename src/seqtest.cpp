@@ -0,0 +1,554 @@
+// Renders the sequencer through StepScheduler and SequencerLookahead at buffer sizes from 32 to 8192
+// frames and checks that every step starts on its exact frame, whatever the buffer size. Covers
+// chained patterns of any length and resolution, grooves and timeline switches while playing.
+// Returns 1 if a check fails
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <set>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+#include "Config.hpp"
+#include "StepScheduler.hpp"
+#include "SequencerTimeline.hpp"
+#include "SequencerLookahead.hpp"
+#include "Groove.hpp"
+
+const unsigned SAMPLE_RATE = 48000;
+const unsigned BUFFER_SIZES[] = {32, 64, 128, 256, 512, 1024, 2048, 4096, 8192};
+
+struct Hit
+{
+    int64_t frame;
+    unsigned padIdx;
+    double strength;
+};
+bool operator<(const Hit &a, const Hit &b)
+{
+    return a.frame < b.frame || (a.frame == b.frame && a.padIdx < b.padIdx);
+}
+
+// Called for every buffer after the scheduler placed it, may change the tempo of the next one
+typedef std::function<void(int64_t frame, const mck::StepScheduler &scheduler, mck::SequencerLookahead &lookahead, double &tempo)> BufferHook;
+
+// Plays the timeline from the top like the RT thread does, paced at speed times real time so the
+// render thread keeps up as it would with JACK. Every buffer keeps a copy of the scheduler
+static std::vector<Hit> RunSequencer(const mck::SequencerTimeline &timeline, double tempo, unsigned bufferSize, int64_t numFrames,
+                                     double speed, std::vector<mck::StepScheduler> *schedulers = nullptr, BufferHook hook = nullptr)
+{
+    mck::SequencerLookahead lookahead;
+    mck::StepScheduler scheduler;
+    std::array<mck::SequencerTrigger, mck::SAMPLER_MAX_TRIGGERS> triggers;
+    std::vector<Hit> hits;
+    lookahead.Init(SAMPLE_RATE);
+    lookahead.SetTimeline(timeline, -1.0);
+    scheduler.Init(SAMPLE_RATE);
+
+    // The transport is stopped for a moment first, the first bars are rendered by then
+    for (unsigned i = 0; i < 10; i++)
+    {
+        scheduler.Process(false, tempo, -1, bufferSize);
+        lookahead.Process(scheduler, false, triggers.data(), triggers.size());
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t frame = 0; frame < numFrames; frame += bufferSize)
+    {
+        scheduler.Process(true, tempo, -1, bufferSize);
+        if (hook)
+        {
+            hook(frame, scheduler, lookahead, tempo);
+        }
+        unsigned numTriggers = lookahead.Process(scheduler, true, triggers.data(), triggers.size());
+        for (unsigned i = 0; i < numTriggers; i++)
+        {
+            hits.push_back({frame + triggers[i].offset, triggers[i].padIdx, triggers[i].strength});
+        }
+        if (schedulers != nullptr)
+        {
+            schedulers->push_back(scheduler);
+        }
+        double seconds = (double)(frame + bufferSize) / (SAMPLE_RATE * speed);
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+    }
+    lookahead.Close();
+    std::sort(hits.begin(), hits.end());
+    return hits;
+}
+
+// Hits of steps given in ticks at a constant tempo, up to numFrames
+static std::vector<Hit> ExpectHits(const std::vector<std::pair<double, unsigned>> &ticks, double cycleTicks, double tempo, int64_t numFrames)
+{
+    double framesPerTick = (double)SAMPLE_RATE * 60.0 / (tempo * mck::SAMPLER_TICKS_PER_BEAT);
+    std::vector<Hit> hits;
+    for (double cycle = 0.0; cycle * framesPerTick < numFrames; cycle += cycleTicks)
+    {
+        for (auto &t : ticks)
+        {
+            int64_t frame = std::llround((cycle + t.first) * framesPerTick);
+            if (frame < numFrames)
+            {
+                hits.push_back({frame, t.second, 0.0});
+            }
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+    return hits;
+}
+
+// Largest distance in frames between the hits of each pad and the expected ones
+static int64_t CompareHits(const std::vector<Hit> &hits, const std::vector<Hit> &expected, int64_t numFrames, size_t &count, size_t &missing)
+{
+    std::vector<std::vector<int64_t>> got;
+    std::vector<std::vector<int64_t>> exp;
+    for (auto &h : hits)
+    {
+        if (h.frame < numFrames)
+        {
+            got.resize(std::max(got.size(), (size_t)h.padIdx + 1));
+            got[h.padIdx].push_back(h.frame);
+        }
+    }
+    for (auto &h : expected)
+    {
+        exp.resize(std::max(exp.size(), (size_t)h.padIdx + 1));
+        exp[h.padIdx].push_back(h.frame);
+    }
+    got.resize(std::max(got.size(), exp.size()));
+    exp.resize(got.size());
+
+    int64_t maxErr = 0;
+    count = 0;
+    missing = 0;
+    for (unsigned p = 0; p < got.size(); p++)
+    {
+        count += got[p].size();
+        // The last step may fall just past numFrames on one side
+        if (got[p].size() + 1 < exp[p].size() || exp[p].size() + 1 < got[p].size())
+        {
+            missing += std::max(got[p].size(), exp[p].size()) - std::min(got[p].size(), exp[p].size());
+        }
+        for (size_t k = 0; k < std::min(got[p].size(), exp[p].size()); k++)
+        {
+            maxErr = std::max(maxErr, std::abs(got[p][k] - exp[p][k]));
+        }
+    }
+    return maxErr;
+}
+
+static bool Check(bool ok, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static bool Check(bool ok, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    std::printf("%s: ", ok ? "PASS" : "FAIL");
+    std::vprintf(fmt, args);
+    std::printf("\n");
+    va_end(args);
+    return ok;
+}
+
+// Runs the expected ticks at every buffer size, each hit has to land on its exact frame
+static bool CheckBufferSizes(const char *name, const mck::sampler::Config &config, const std::vector<std::pair<double, unsigned>> &ticks,
+                             double cycleTicks, double tempo, double seconds, int64_t tolerance)
+{
+    bool ok = true;
+    mck::SequencerTimeline timeline;
+    mck::CompileTimeline(config, timeline);
+    int64_t numFrames = (int64_t)(seconds * SAMPLE_RATE);
+    std::vector<Hit> expected = ExpectHits(ticks, cycleTicks, tempo, numFrames);
+
+    std::vector<int64_t> reference;
+    for (unsigned bufferSize : BUFFER_SIZES)
+    {
+        std::vector<Hit> hits = RunSequencer(timeline, tempo, bufferSize, numFrames, 16.0);
+        size_t count = 0;
+        size_t missing = 0;
+        int64_t maxErr = CompareHits(hits, expected, numFrames, count, missing);
+
+        // Every buffer size plays the same frames
+        std::vector<int64_t> frames;
+        for (auto &h : hits)
+        {
+            if (h.frame < numFrames)
+            {
+                frames.push_back(h.frame * 64 + h.padIdx);
+            }
+        }
+        if (reference.empty())
+        {
+            reference = frames;
+        }
+        ok &= Check(maxErr <= tolerance && missing == 0 && frames == reference, "%s, %g bpm, %4u frames: %zu hits, %zu missing, max error %lld frames, same as 32 frames %d",
+                    name, tempo, bufferSize, count, missing, (long long)maxErr, (int)(frames == reference));
+    }
+    return ok;
+}
+
+static bool CheckChains()
+{
+    // Pads of different lengths and resolutions drift against each other
+    mck::sampler::Config config;
+    config.numPads = 16;
+    config.pads.resize(config.numPads);
+    config.pads[0].patterns[0] = mck::sampler::Pattern(3);
+    config.pads[0].patterns[0].steps[0].active = true;
+    config.pads[1].patterns[0] = mck::sampler::Pattern(4);
+    config.pads[1].patterns[0].steps[0].active = true;
+    config.pads[2].patterns[0] = mck::sampler::Pattern(1);
+    config.pads[2].patterns[0].resolution = 3;
+    config.pads[2].patterns[0].steps[0].active = true;
+    config.pads[3].nPatterns = 2;
+    config.pads[3].patterns = {mck::sampler::Pattern(5), mck::sampler::Pattern(7)};
+    config.pads[3].patterns[1].steps[0].active = true;
+    // Several steps fall into every large buffer
+    config.pads[4].patterns[0].resolution = 8;
+    for (auto &s : config.pads[4].patterns[0].steps)
+    {
+        s.active = true;
+    }
+
+    // 720, 960, 320 and 120 ticks apart, pad 3 plays on the 6th of every 12 16ths
+    std::vector<std::pair<double, unsigned>> ticks;
+    for (int k = 0; k < 16; k++)
+    {
+        ticks.push_back({k * 720.0, 0});
+    }
+    for (int k = 0; k < 12; k++)
+    {
+        ticks.push_back({k * 960.0, 1});
+    }
+    for (int k = 0; k < 36; k++)
+    {
+        ticks.push_back({k * 320.0, 2});
+    }
+    for (int k = 0; k < 4; k++)
+    {
+        ticks.push_back({1200.0 + k * 2880.0, 3});
+    }
+    for (int k = 0; k < 96; k++)
+    {
+        ticks.push_back({k * 120.0, 4});
+    }
+
+    bool ok = true;
+    for (double tempo : {110.0, 174.0, 300.0})
+    {
+        ok &= CheckBufferSizes("chains", config, ticks, 11520.0, tempo, 4.0, 0);
+    }
+    return ok;
+}
+
+static double Swing(double tick, double pair, double split)
+{
+    double start = std::floor(tick / pair) * pair;
+    double x = (tick - start) / pair;
+    return start + (x < 0.5 ? x * 2.0 * split : split + (x - 0.5) * 2.0 * (1.0 - split)) * pair;
+}
+
+static bool CheckGroove()
+{
+    // 16ths, 8th triplets and two micro shifted steps under 66 % 16th swing
+    mck::sampler::Config config;
+    config.numPads = 16;
+    config.pads.resize(config.numPads);
+    for (auto &s : config.pads[0].patterns[0].steps)
+    {
+        s.active = true;
+    }
+    config.pads[1].patterns[0] = mck::sampler::Pattern(3);
+    config.pads[1].patterns[0].resolution = 3;
+    for (auto &s : config.pads[1].patterns[0].steps)
+    {
+        s.active = true;
+    }
+    config.pads[2].patterns[0].steps[4].active = true;
+    config.pads[2].patterns[0].steps[4].offset = -0.25;
+    config.pads[2].patterns[0].steps[12].active = true;
+    config.pads[2].patterns[0].steps[12].offset = 0.1;
+    config.groove.type = mck::sampler::GRV_SWING_16;
+    config.groove.swing = 66.0;
+
+    std::vector<std::pair<double, unsigned>> ticks;
+    for (int k = 0; k < 16; k++)
+    {
+        ticks.push_back({Swing(k * 240.0, 480.0, 0.66), 0});
+    }
+    for (int k = 0; k < 12; k++)
+    {
+        ticks.push_back({Swing(k * 320.0, 480.0, 0.66), 1});
+    }
+    ticks.push_back({Swing(960.0 - 60.0, 480.0, 0.66), 2});
+    ticks.push_back({Swing(2880.0 + 24.0, 480.0, 0.66), 2});
+
+    bool ok = true;
+    // Swung ticks are fractional, the rounding of the last frame may differ from the expectation
+    for (double tempo : {96.0, 174.0})
+    {
+        ok &= CheckBufferSizes("swing", config, ticks, 3840.0, tempo, 4.0, 1);
+    }
+
+    // Learns 60 % swing with accents on the beats from slightly loose playing
+    std::vector<mck::GrooveHit> played;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> noise(-0.025, 0.025);
+    for (int bar = 0; bar < 8; bar++)
+    {
+        for (int k = 0; k < 16; k++)
+        {
+            double shift = (k % 2 ? 0.4 : 0.0) + noise(rng);
+            played.push_back({bar * 3840.0 + (k + shift) * 240.0, k % 4 == 0 ? 1.0 : 0.6});
+        }
+    }
+    mck::sampler::Groove learned;
+    bool extracted = mck::ExtractGroove(played, learned);
+    double maxTimingErr = 0.0;
+    double maxVelocityErr = 0.0;
+    for (unsigned k = 0; k < 16; k++)
+    {
+        maxTimingErr = std::max(maxTimingErr, std::abs(learned.timing[k] - (k % 2 ? 0.4 : 0.0)));
+        maxVelocityErr = std::max(maxVelocityErr, std::abs(learned.velocity[k] - (k % 4 == 0 ? 1.0 : 0.6)));
+    }
+    ok &= Check(extracted && learned.type == mck::sampler::GRV_USER && maxTimingErr < 0.02 && maxVelocityErr < 1e-9,
+                "learned groove, timing off by %.3f 16ths, velocity off by %.3f", maxTimingErr, maxVelocityErr);
+
+    // The learned groove moves and accents every 16th
+    mck::sampler::Config user;
+    user.numPads = 16;
+    user.pads.resize(user.numPads);
+    for (auto &s : user.pads[0].patterns[0].steps)
+    {
+        s.active = true;
+        s.velocity = 127;
+    }
+    user.groove = learned;
+    mck::SequencerTimeline timeline;
+    mck::CompileTimeline(user, timeline);
+    double framesPerTick = (double)SAMPLE_RATE * 60.0 / (120.0 * mck::SAMPLER_TICKS_PER_BEAT);
+    std::vector<Hit> hits = RunSequencer(timeline, 120.0, 256, SAMPLE_RATE * 4, 16.0);
+    int64_t maxErr = 0;
+    double maxStrengthErr = 0.0;
+    for (size_t i = 0; i < hits.size(); i++)
+    {
+        unsigned k = i % 16;
+        int64_t frame = std::llround((i / 16 * 3840.0 + (k + learned.timing[k]) * 240.0) * framesPerTick);
+        maxErr = std::max(maxErr, std::abs(hits[i].frame - frame));
+        maxStrengthErr = std::max(maxStrengthErr, std::abs(hits[i].strength - learned.velocity[k]));
+    }
+    ok &= Check(hits.size() == 32 && maxErr <= 1 && maxStrengthErr < 1e-9, "learned groove plays %zu hits, max error %lld frames, strength off by %.3f",
+                hits.size(), (long long)maxErr, maxStrengthErr);
+    return ok;
+}
+
+// Hits of the events with ticks in [from, to), placed by the scheduler of each buffer
+static std::set<std::pair<int64_t, unsigned>> ExpandTimeline(const mck::SequencerTimeline &timeline, const std::vector<mck::StepScheduler> &schedulers,
+                                                             unsigned bufferSize, double from, double to)
+{
+    std::set<std::pair<int64_t, unsigned>> hits;
+    double cycle = (double)timeline.cycleTicks;
+    for (auto &s : schedulers)
+    {
+        double start = s.GetStartTick();
+        double end = s.GetTick(bufferSize);
+        for (double cycleStart = std::floor((start - 1.0) / cycle) * cycle; cycleStart < end + 1.0; cycleStart += cycle)
+        {
+            for (auto &e : timeline.events)
+            {
+                double tick = cycleStart + e.tick;
+                int64_t frame = s.GetFrame(tick);
+                if (tick >= from && tick < to && frame >= s.GetBufferStart() && frame < s.GetBufferEnd())
+                {
+                    hits.insert({frame, e.padIdx});
+                }
+            }
+        }
+    }
+    return hits;
+}
+
+static bool CheckSwitch()
+{
+    // Two dense timelines, the second one replaces the first while playing and the tempo changes
+    mck::sampler::Config configA;
+    configA.numPads = 16;
+    configA.pads.resize(configA.numPads);
+    std::mt19937 rng(1);
+    for (unsigned i = 0; i < configA.numPads; i++)
+    {
+        auto &pad = configA.pads[i];
+        pad.nPatterns = 4;
+        pad.patterns.assign(pad.nPatterns, mck::sampler::Pattern(16 + i));
+        for (auto &pattern : pad.patterns)
+        {
+            pattern.resolution = i % 2 ? 3 : 4;
+            for (auto &s : pattern.steps)
+            {
+                s.active = rng() % 3 == 0;
+            }
+        }
+    }
+    configA.groove.type = mck::sampler::GRV_SWING_16;
+    configA.groove.swing = 60.0;
+    mck::sampler::Config configB = configA;
+    for (auto &pad : configB.pads)
+    {
+        for (auto &pattern : pad.patterns)
+        {
+            for (auto &s : pattern.steps)
+            {
+                s.active = !s.active;
+            }
+        }
+    }
+    mck::SequencerTimeline timelineA;
+    mck::SequencerTimeline timelineB;
+    mck::CompileTimeline(configA, timelineA);
+    mck::CompileTimeline(configB, timelineB);
+
+    bool ok = true;
+    int64_t numFrames = SAMPLE_RATE * 3;
+    int64_t tempoFrame = SAMPLE_RATE * 2;
+    for (unsigned bufferSize : {32u, 1024u})
+    {
+        for (int quantize = 0; quantize < 2; quantize++)
+        {
+            // A quantised switch is requested inside the margin before a bar, it has to skip that bar
+            int64_t switchFrame = quantize ? SAMPLE_RATE * 2 - SAMPLE_RATE / 200 : SAMPLE_RATE * 3 / 2;
+            double switchTick = -1.0;
+            double switchBar = -1.0;
+            std::vector<mck::StepScheduler> schedulers;
+            std::vector<Hit> hits = RunSequencer(timelineA, 120.0, bufferSize, numFrames, 1.0, &schedulers,
+                                                 [&](int64_t frame, const mck::StepScheduler &scheduler, mck::SequencerLookahead &lookahead, double &tempo) {
+                                                     if (frame >= switchFrame && switchTick < 0.0)
+                                                     {
+                                                         // Like a kit switch, the bar is taken before the RT thread publishes this buffer
+                                                         switchTick = scheduler.GetStartTick();
+                                                         switchBar = lookahead.GetNextBar();
+                                                         lookahead.SetTimeline(timelineB, quantize ? switchBar : -1.0);
+                                                     }
+                                                     if (frame + bufferSize >= tempoFrame)
+                                                     {
+                                                         tempo = 140.0;
+                                                     }
+                                                 });
+            std::set<std::pair<int64_t, unsigned>> got;
+            for (auto &h : hits)
+            {
+                got.insert({h.frame, h.padIdx});
+            }
+
+            // The switch takes effect at a tick after the request, exactly on the bar handed over if quantised
+            std::vector<double> candidates;
+            double bar = mck::SAMPLER_TICKS_PER_BAR;
+            if (quantize)
+            {
+                candidates.push_back(switchBar);
+            }
+            else
+            {
+                for (auto &e : timelineB.events)
+                {
+                    double tick = std::floor(switchTick / timelineB.cycleTicks) * timelineB.cycleTicks + e.tick;
+                    if (tick >= switchTick && tick < switchTick + bar)
+                    {
+                        candidates.push_back(tick);
+                    }
+                }
+                std::sort(candidates.begin(), candidates.end());
+                candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+            }
+            double switchedAt = -1.0;
+            for (double tick : candidates)
+            {
+                auto expected = ExpandTimeline(timelineA, schedulers, bufferSize, 0.0, tick);
+                auto expectedB = ExpandTimeline(timelineB, schedulers, bufferSize, tick, 1e12);
+                expected.insert(expectedB.begin(), expectedB.end());
+                if (expected == got)
+                {
+                    switchedAt = tick;
+                    break;
+                }
+            }
+            // Right away takes over after the margin, the render period and some scheduling slack
+            double ticksPerMs = 120.0 * mck::SAMPLER_TICKS_PER_BEAT / 60000.0;
+            double latest = 1e12;
+            for (double tick : candidates)
+            {
+                if (quantize == false && tick >= switchTick + 50.0 * ticksPerMs)
+                {
+                    latest = tick;
+                    break;
+                }
+            }
+            // The RT thread flips the rest of the config in the first buffer that reaches the bar,
+            // from the buffer after the request on. The bar must not have passed by then
+            bool onTime = true;
+            if (quantize)
+            {
+                for (size_t i = (switchFrame + bufferSize - 1) / bufferSize + 1; i < schedulers.size(); i++)
+                {
+                    if (schedulers[i].GetFrame(switchBar) < schedulers[i].GetBufferEnd())
+                    {
+                        onTime = schedulers[i].GetFrame(switchBar) >= schedulers[i].GetBufferStart();
+                        break;
+                    }
+                }
+            }
+            double delayMs = (switchedAt - switchTick) / ticksPerMs;
+            ok &= Check(switchedAt >= 0.0 && switchedAt <= latest && onTime, "switch, %4u frames, %s: %zu hits all on their frames, new timeline %.1f ms after the request%s",
+                        bufferSize, quantize ? "quantised" : "immediate", got.size(), switchedAt >= 0.0 ? delayMs : -1.0,
+                        quantize ? " (on the bar handed over)" : "");
+        }
+    }
+    return ok;
+}
+
+static bool CheckCost()
+{
+    // The RT side only drains events, the number of patterns does not reach it
+    mck::sampler::Config config;
+    config.numPads = 16;
+    config.pads.resize(config.numPads);
+    std::mt19937 rng(1);
+    for (unsigned i = 0; i < config.numPads; i++)
+    {
+        auto &pad = config.pads[i];
+        pad.nPatterns = mck::sampler::SAMPLER_MAX_PATTERNS;
+        pad.patterns.assign(pad.nPatterns, mck::sampler::Pattern(mck::sampler::SAMPLER_MAX_STEPS));
+        for (auto &pattern : pad.patterns)
+        {
+            pattern.resolution = i % 2 ? 3 : 4;
+            for (auto &s : pattern.steps)
+            {
+                s.active = rng() % 8 == 0;
+            }
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    mck::SequencerTimeline timeline;
+    mck::CompileTimeline(config, timeline);
+    double compileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::printf("16 pads x 16 patterns x 64 steps: compiled in %.2f ms, %zu events over %g bars\n", compileMs, timeline.events.size(),
+                (double)timeline.cycleTicks / mck::SAMPLER_TICKS_PER_BAR);
+    return Check(timeline.cycleTicks > 0 && timeline.cycleTicks <= mck::SAMPLER_MAX_CYCLE_TICKS, "cycle capped at %g bars",
+                 (double)mck::SAMPLER_MAX_CYCLE_TICKS / mck::SAMPLER_TICKS_PER_BAR);
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= CheckChains();
+    ok &= CheckGroove();
+    ok &= CheckSwitch();
+    ok &= CheckCost();
+    std::printf("%s\n", ok ? "All checks passed" : "Some checks failed");
+    return ok ? 0 : 1;
+}
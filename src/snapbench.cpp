@@ -0,0 +1,121 @@
+// Load time of the binary snapshot against the JSON config, and checks that a snapshot reads
+// back like the JSON does. Returns 1 if a check fails
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <filesystem>
+
+#include "Config.hpp"
+#include "ConfigFile.hpp"
+#include "Snapshot.hpp"
+
+namespace fs = std::filesystem;
+
+const unsigned NUM_RUNS = 20;
+
+static mck::sampler::Config CreateConfig()
+{
+    // 16 pads x 16 patterns x 64 steps, as many steps as 16 pads x 64 patterns of 16
+    mck::sampler::Config config;
+    config.numPads = 16;
+    config.pads.resize(config.numPads);
+    std::srand(1);
+    for (auto &p : config.pads)
+    {
+        p.samplePath = "pack/sample.wav";
+        p.sampleName = "sample.wav";
+        p.nPatterns = mck::sampler::SAMPLER_MAX_PATTERNS;
+        p.patterns.assign(p.nPatterns, mck::sampler::Pattern(mck::sampler::SAMPLER_MAX_STEPS));
+        for (auto &pat : p.patterns)
+        {
+            for (auto &s : pat.steps)
+            {
+                s.active = std::rand() % 2;
+                s.velocity = std::rand() % 128;
+            }
+        }
+    }
+    return config;
+}
+
+static double MeasureLoad(const std::string &path)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < NUM_RUNS; i++)
+    {
+        mck::sampler::Config config;
+        if (mck::ConfigFile::Load(path, config) == false)
+        {
+            return -1.0;
+        }
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / NUM_RUNS;
+}
+
+static bool Check(bool ok, const char *name)
+{
+    std::printf("%s: %s\n", ok ? "PASS" : "FAIL", name);
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+    mck::sampler::Config config = CreateConfig();
+
+    fs::path dir = fs::temp_directory_path() / "mck-snapbench";
+    fs::create_directories(dir);
+    std::string snapshotPath = (dir / "config.mcks").string();
+    std::string jsonPath = (dir / "config.json").string();
+    if (mck::ConfigFile::Save(snapshotPath, config) == false || mck::ConfigFile::Save(jsonPath, config) == false)
+    {
+        std::fprintf(stderr, "Failed to write the configs to %s\n", dir.c_str());
+        return 1;
+    }
+
+    double snapshotMs = MeasureLoad(snapshotPath);
+    double jsonMs = MeasureLoad(jsonPath);
+    std::printf("16 pads x 16 patterns x 64 steps\n");
+    std::printf("snapshot: %8zu bytes, %7.2f ms per load\n", (size_t)fs::file_size(snapshotPath), snapshotMs);
+    std::printf("json:     %8zu bytes, %7.2f ms per load\n", (size_t)fs::file_size(jsonPath), jsonMs);
+    if (snapshotMs > 0.0 && jsonMs > 0.0)
+    {
+        std::printf("speedup:  %.1fx\n", jsonMs / snapshotMs);
+    }
+
+    mck::sampler::Config snapshotConfig;
+    mck::sampler::Config jsonConfig;
+    ok &= Check(mck::ConfigFile::Load(snapshotPath, snapshotConfig) && mck::ConfigFile::Load(jsonPath, jsonConfig), "both formats load");
+    ok &= Check(nlohmann::json(snapshotConfig) == nlohmann::json(jsonConfig), "snapshot reads back like the JSON");
+
+    // Counts that disagree with the arrays are normalised like from_json does
+    mck::sampler::Config odd = config;
+    odd.pads[0].nPatterns = 2;
+    odd.pads[1].nPatterns = 4;
+    odd.pads[1].patterns.resize(1);
+    odd.pads[2].patterns[0].nSteps = 8;
+    odd.pads[3].patterns[0].nSteps = 32;
+    odd.pads[3].patterns[0].steps.resize(4);
+    std::string data;
+    mck::sampler::WriteSnapshot(odd, data);
+    mck::sampler::Config fromSnapshot;
+    bool read = mck::sampler::ReadSnapshot(data, fromSnapshot);
+    mck::sampler::Config fromJson = nlohmann::json(odd).get<mck::sampler::Config>();
+    bool consistent = read;
+    for (unsigned i = 0; read && i < fromSnapshot.pads.size(); i++)
+    {
+        auto &p = fromSnapshot.pads[i];
+        consistent &= p.patterns.size() == p.nPatterns;
+        for (auto &pat : p.patterns)
+        {
+            consistent &= pat.steps.size() == pat.nSteps;
+        }
+    }
+    ok &= Check(consistent, "pattern and step arrays follow their counts");
+    ok &= Check(read && nlohmann::json(fromSnapshot) == nlohmann::json(fromJson), "normalised like from_json");
+
+    ok &= Check(mck::sampler::ReadSnapshot(data.substr(0, data.size() / 2), fromSnapshot) == false, "truncated snapshot is rejected");
+
+    fs::remove_all(dir);
+    return ok ? 0 : 1;
+}